@@ -0,0 +1,26 @@
+// CPU sets are GNU extensions, so this file does not include err.h, whose
+// error_t clashes with the GNU one.
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "affinity.h"
+
+int allowed_cpus(int* cpus, int max_count) {
+    cpu_set_t allowed;
+    int count = 0;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) return -1;
+    for (int cpu = 0; cpu < CPU_SETSIZE && count < max_count; cpu++) {
+        if (CPU_ISSET(cpu, &allowed)) cpus[count++] = cpu;
+    }
+    return count;
+}
+
+bool pin_to_cpu(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) == 0;
+}
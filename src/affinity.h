@@ -0,0 +1,15 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <stdbool.h>
+
+// Upper bound on CPU numbers.
+#define MAX_CPUS 1024
+
+// Get the CPUs the process may run on, return their count or -1 on error.
+int allowed_cpus(int* cpus, int max_count);
+
+// Pin the calling thread to the CPU, return false on error.
+bool pin_to_cpu(int cpu);
+
+#endif
@@ -0,0 +1,349 @@
+// recvmmsg() and sendmmsg() are GNU extensions, so this file does not
+// include err.h, whose error_t clashes with the GNU one.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netinet/udp.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "batch.h"
+#include "common.h"
+#include "stats.h"
+
+struct batch {
+    int count;     // datagrams queued
+    int msg_count; // messages, a segmented one carries several datagrams
+    size_t bytes;  // of all datagrams queued
+    bool segment;  // merge equal-sized datagrams into segmented messages
+    bool zerocopy; // send with MSG_ZEROCOPY
+    uint32_t zerocopy_sends;
+    struct mmsghdr msgs[BATCH_MAX];
+    udp_control_t controls[BATCH_MAX];
+    struct sockaddr_in addresses[BATCH_MAX];
+
+    // Per datagram: header and payload, the iovecs of a message are adjacent.
+    struct iovec iovs[BATCH_MAX][2];
+
+    // Headers of BATCH_MAX datagrams per set. Zero-copy sends take turns
+    // with ZEROCOPY_HEADER_SETS sets, as the kernel may still read the
+    // headers of the last ones sent.
+    char (*headers)[BATCH_HEADER_MAX];
+    int header_set;
+    uint32_t set_sends[ZEROCOPY_HEADER_SETS]; // sends reading from each set
+
+    // Per message: first datagram, segment size and length of the last one.
+    int firsts[BATCH_MAX];
+    size_t segment_sizes[BATCH_MAX];
+    size_t tails[BATCH_MAX];
+    size_t lengths[BATCH_MAX]; // of all datagrams together
+
+    char* buffers; // receive buffers, one after another
+    size_t buffer_size;
+    int next_msg; // position of batch_next() among received datagrams
+    size_t next_offset;
+};
+
+batch_t* batch_new(size_t buffer_size) {
+    batch_t* batch = calloc(1, sizeof(*batch));
+    if (batch == NULL) return NULL;
+    batch->headers = malloc(BATCH_MAX * sizeof(*batch->headers));
+    if (batch->headers == NULL) {
+        free(batch);
+        return NULL;
+    }
+    if (buffer_size > 0) {
+        batch->buffer_size = buffer_size;
+        batch->buffers     = malloc(BATCH_RECV_MAX * buffer_size);
+        if (batch->buffers == NULL) {
+            free(batch->headers);
+            free(batch);
+            return NULL;
+        }
+    }
+    return batch;
+}
+
+void batch_free(batch_t* batch) {
+    if (batch == NULL) return;
+    free(batch->buffers);
+    free(batch->headers);
+    free(batch);
+}
+
+void batch_set_segmentation(batch_t* batch, bool segment) {
+    batch->segment = segment;
+}
+
+bool batch_set_zerocopy(batch_t* batch, bool zerocopy) {
+    if (zerocopy && !batch->zerocopy) {
+        void* headers = realloc(batch->headers,
+                                ZEROCOPY_HEADER_SETS * BATCH_MAX *
+                                    sizeof(*batch->headers));
+        if (headers == NULL) return false;
+        batch->headers = headers;
+    }
+    batch->zerocopy = zerocopy;
+    return true;
+}
+
+uint32_t batch_zerocopy_sends(const batch_t* batch) {
+    return batch->zerocopy_sends;
+}
+
+uint32_t batch_zerocopy_reuse(const batch_t* batch) {
+    return batch->set_sends[batch->header_set];
+}
+
+int batch_recv(int fd, batch_t* batch) {
+    for (int i = 0; i < BATCH_RECV_MAX; i++) {
+        struct msghdr* hdr = &batch->msgs[i].msg_hdr;
+        batch->iovs[i][0]  = (struct iovec){
+            .iov_base = batch->buffers + i * batch->buffer_size,
+            .iov_len  = batch->buffer_size,
+        };
+        memset(hdr, 0, sizeof(*hdr));
+        hdr->msg_name       = &batch->addresses[i];
+        hdr->msg_namelen    = sizeof(batch->addresses[i]);
+        hdr->msg_iov        = batch->iovs[i];
+        hdr->msg_iovlen     = 1;
+        hdr->msg_control    = &batch->controls[i];
+        hdr->msg_controllen = sizeof(batch->controls[i]);
+    }
+    batch->msg_count   = 0;
+    batch->next_msg    = 0;
+    batch->next_offset = 0;
+
+    int received;
+    do {
+        stats.syscalls++;
+        received =
+            recvmmsg(fd, batch->msgs, BATCH_RECV_MAX, MSG_DONTWAIT, NULL);
+    } while (received < 0 && errno == EINTR);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        errno = 0;
+        return 0;
+    }
+    if (received < 0) return -1;
+
+    // A datagram coalesced by UDP GRO is split by batch_next().
+    batch->msg_count = received;
+    for (int i = 0; i < received; i++) {
+        batch->lengths[i]       = batch->msgs[i].msg_len;
+        batch->segment_sizes[i] = udp_segment_size(&batch->msgs[i].msg_hdr);
+    }
+    return received;
+}
+
+const char* batch_next(batch_t* batch,
+                       size_t* length,
+                       struct sockaddr_in* address) {
+    if (batch->next_msg == batch->msg_count) return NULL;
+
+    int i = batch->next_msg;
+    const char* datagram =
+        batch->buffers + i * batch->buffer_size + batch->next_offset;
+    *length = batch->lengths[i] - batch->next_offset;
+    if (batch->segment_sizes[i] > 0 && *length > batch->segment_sizes[i]) {
+        *length = batch->segment_sizes[i];
+    }
+    *address = batch->addresses[i];
+
+    batch->next_offset += *length;
+    if (batch->next_offset == batch->lengths[i]) {
+        batch->next_msg++;
+        batch->next_offset = 0;
+    }
+    return datagram;
+}
+
+// Set up message m to carry the datagrams from first on.
+static void start_message(batch_t* batch,
+                          int m,
+                          int first,
+                          size_t length,
+                          const struct sockaddr_in* address) {
+    struct msghdr* hdr = &batch->msgs[m].msg_hdr;
+    memset(hdr, 0, sizeof(*hdr));
+    if (address != NULL) {
+        batch->addresses[m] = *address;
+        hdr->msg_name       = &batch->addresses[m];
+        hdr->msg_namelen    = sizeof(batch->addresses[m]);
+    }
+    hdr->msg_iov    = batch->iovs[first];
+    hdr->msg_iovlen = 2;
+
+    batch->firsts[m]        = first;
+    batch->segment_sizes[m] = length;
+    batch->tails[m]         = length;
+    batch->lengths[m]       = length;
+}
+
+// Check if a datagram can be appended to the last message as a segment:
+// all but the last segment have the same size.
+static bool fits_segment(const batch_t* batch,
+                         size_t length,
+                         const struct sockaddr_in* address) {
+    if (!batch->segment || batch->msg_count == 0) return false;
+
+    int m                        = batch->msg_count - 1;
+    const struct sockaddr_in* to = &batch->addresses[m];
+    int segments                 = batch->count - batch->firsts[m];
+    return to->sin_addr.s_addr == address->sin_addr.s_addr &&
+           to->sin_port == address->sin_port &&
+           batch->tails[m] == batch->segment_sizes[m] &&
+           length <= batch->segment_sizes[m] && segments < GSO_MAX_SEGMENTS &&
+           batch->lengths[m] + length <= UDP_PAYLOAD_MAX;
+}
+
+bool batch_add(batch_t* batch,
+               const void* header,
+               size_t header_length,
+               const void* payload,
+               size_t payload_length,
+               const struct sockaddr_in* address) {
+    if (batch->count == BATCH_MAX) return false;
+
+    int i         = batch->count;
+    size_t length = header_length + payload_length;
+    char* copy    = batch->headers[batch->header_set * BATCH_MAX + i];
+    memcpy(copy, header, header_length);
+    batch->iovs[i][0] = (struct iovec){copy, header_length};
+    batch->iovs[i][1] = (struct iovec){(void*)payload, payload_length};
+
+    if (fits_segment(batch, length, address)) {
+        int m              = batch->msg_count - 1;
+        struct msghdr* hdr = &batch->msgs[m].msg_hdr;
+        hdr->msg_iovlen += 2;
+        batch->tails[m] = length;
+        batch->lengths[m] += length;
+    }
+    else {
+        start_message(batch, batch->msg_count++, i, length, address);
+    }
+    batch->count++;
+    batch->bytes += length;
+    return true;
+}
+
+int batch_count(const batch_t* batch) {
+    return batch->count;
+}
+
+size_t batch_bytes(const batch_t* batch) {
+    return batch->bytes;
+}
+
+// Attach UDP_SEGMENT to messages carrying more than one datagram.
+static void set_segment_sizes(batch_t* batch) {
+    for (int m = 0; m < batch->msg_count; m++) {
+        struct msghdr* hdr = &batch->msgs[m].msg_hdr;
+        if (hdr->msg_iovlen == 2) continue;
+
+        uint16_t segment_size = (uint16_t)batch->segment_sizes[m];
+        hdr->msg_control      = &batch->controls[m];
+        hdr->msg_controllen   = CMSG_SPACE(sizeof(segment_size));
+        struct cmsghdr* cmsg  = CMSG_FIRSTHDR(hdr);
+        cmsg->cmsg_level      = SOL_UDP;
+        cmsg->cmsg_type       = UDP_SEGMENT;
+        cmsg->cmsg_len        = CMSG_LEN(sizeof(segment_size));
+        memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+    }
+}
+
+// Send every datagram from message m on in a message of its own.
+static void unsegment(batch_t* batch, int m) {
+    struct sockaddr_in addresses[BATCH_MAX];
+    int firsts[BATCH_MAX];
+    int msg_count = batch->msg_count;
+    memcpy(addresses, batch->addresses, sizeof(addresses));
+    memcpy(firsts, batch->firsts, sizeof(firsts));
+
+    batch->segment   = false;
+    batch->msg_count = m;
+    for (int k = m; k < msg_count; k++) {
+        int end = k + 1 < msg_count ? firsts[k + 1] : batch->count;
+        for (int i = firsts[k]; i < end; i++) {
+            size_t length =
+                batch->iovs[i][0].iov_len + batch->iovs[i][1].iov_len;
+            start_message(batch, batch->msg_count++, i, length, &addresses[k]);
+        }
+    }
+}
+
+static void clear(batch_t* batch) {
+    batch->count     = 0;
+    batch->msg_count = 0;
+    batch->bytes     = 0;
+    if (batch->zerocopy) {
+        batch->set_sends[batch->header_set] = batch->zerocopy_sends;
+        batch->header_set = (batch->header_set + 1) % ZEROCOPY_HEADER_SETS;
+    }
+}
+
+// Check if a zero-copy send failed where a copying one would not: out of
+// memory for pinned pages, or a datagram over more pages than an skb holds.
+static bool zerocopy_failed(int flags) {
+    return flags != 0 && (errno == ENOBUFS || errno == EMSGSIZE);
+}
+
+int batch_send(int fd, batch_t* batch) {
+    int sent  = 0;
+    int flags = batch->zerocopy ? MSG_ZEROCOPY : 0;
+    set_segment_sizes(batch);
+    while (sent < batch->msg_count) {
+        // Only the message a zero-copy send failed on is copied.
+        int count = flags == 0 && batch->zerocopy ? 1 : batch->msg_count - sent;
+        stats.syscalls++;
+        int n = sendmmsg(fd, batch->msgs + sent, (unsigned)count, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && zerocopy_failed(flags)) {
+            flags = 0;
+            continue;
+        }
+        if (n < 0 && batch->segment &&
+            (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT))
+        {
+            // The route cannot segment, send datagrams one by one from now.
+            unsegment(batch, sent);
+            continue;
+        }
+        if (n < 0) {
+            clear(batch);
+            return -1;
+        }
+        if (flags != 0) batch->zerocopy_sends += (uint32_t)n;
+        flags = batch->zerocopy ? MSG_ZEROCOPY : 0;
+        sent += n;
+    }
+    clear(batch);
+    return 0;
+}
+
+int batch_write(int fd, batch_t* batch) {
+    // The iovecs of all datagrams are adjacent, whatever the messages.
+    struct msghdr msg = {.msg_iov = batch->iovs[0]};
+    int iovcnt        = 2 * batch->count;
+    int flags         = batch->zerocopy ? MSG_ZEROCOPY : 0;
+
+    while (iovcnt > 0) {
+        msg.msg_iovlen = (size_t)iovcnt;
+        stats.syscalls++;
+        ssize_t n = sendmsg(fd, &msg, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && zerocopy_failed(flags)) {
+            flags = 0;
+            continue;
+        }
+        if (n < 0) {
+            clear(batch);
+            return -1;
+        }
+        if (flags != 0) batch->zerocopy_sends++;
+        flags = batch->zerocopy ? MSG_ZEROCOPY : 0;
+        iov_advance(&msg.msg_iov, &iovcnt, (size_t)n);
+    }
+    clear(batch);
+    return 0;
+}
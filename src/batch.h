@@ -0,0 +1,83 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Maximum number of datagrams received with one system call.
+#define BATCH_RECV_MAX 64
+
+// Maximum number of datagrams queued to be sent with one system call.
+#define BATCH_MAX 256
+
+// Longest header copied into a batch, any PPCB packet but DATA payload fits.
+#define BATCH_HEADER_MAX 64
+
+// Most datagrams the kernel splits one UDP GSO message into.
+#define GSO_MAX_SEGMENTS 64
+
+// Batches sent with MSG_ZEROCOPY before the headers of the first are reused.
+#define ZEROCOPY_HEADER_SETS 16
+
+/*
+    Datagrams received with one recvmmsg() or sent with one sendmmsg().
+
+    A datagram to be sent is a header, copied into the batch, followed by an
+    optional payload, referenced until the batch is sent. With segmentation,
+    consecutive datagrams of equal size to the same address are sent as one
+    UDP GSO message and split by the kernel. Received datagrams coalesced by
+    UDP GRO are split again. Functions return -1 on failure.
+*/
+typedef struct batch batch_t;
+
+// Create a batch, with receive buffers of the given size unless it is 0.
+batch_t* batch_new(size_t buffer_size);
+void batch_free(batch_t* batch);
+
+// Send equal-sized datagrams with UDP GSO.
+void batch_set_segmentation(batch_t* batch, bool segment);
+
+// Send with MSG_ZEROCOPY, return false if out of memory. A payload must
+// stay intact until the kernel reports its send complete, see zerocopy.h.
+bool batch_set_zerocopy(batch_t* batch, bool zerocopy);
+
+// Get the number of sends made with MSG_ZEROCOPY so far.
+uint32_t batch_zerocopy_sends(const batch_t* batch);
+
+// Get the number of sends which must complete before the next datagram is
+// added, as it reuses the header memory they read.
+uint32_t batch_zerocopy_reuse(const batch_t* batch);
+
+// Receive up to BATCH_RECV_MAX datagrams, each possibly coalesced by UDP GRO,
+// without blocking. Return how many.
+int batch_recv(int fd, batch_t* batch);
+
+// Get the next received datagram, NULL if all were handed out.
+const char* batch_next(batch_t* batch,
+                       size_t* length,
+                       struct sockaddr_in* address);
+
+// Queue a datagram, return false if the batch is full.
+bool batch_add(batch_t* batch,
+               const void* header,
+               size_t header_length,
+               const void* payload,
+               size_t payload_length,
+               const struct sockaddr_in* address);
+
+int batch_count(const batch_t* batch);
+
+// Get the length of all queued datagrams.
+size_t batch_bytes(const batch_t* batch);
+
+// Send all queued datagrams and empty the batch.
+int batch_send(int fd, batch_t* batch);
+
+// Write all queued datagrams back to back to a stream socket with one
+// sendmsg() and empty the batch. Their addresses are not used, so they may
+// be NULL.
+int batch_write(int fd, batch_t* batch);
+
+#endif
@@ -1,18 +1,35 @@
 #include <arpa/inet.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <netinet/udp.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "err.h"
 #include "protconst.h"
+#include "stats.h"
+#include "uring.h"
+#include "writer.h"
 
 #define QUEUE_LENGTH 5
 
+// Segments of a datagram coalesced by UDP GRO, not handed out yet.
+static struct {
+    int fd;
+    char* buf;
+    size_t start;
+    size_t end;
+    size_t segment_size;
+    struct sockaddr_in address;
+} gro = {.fd = -1};
+
 // Robert Jenkins' 96 bit Mix Function
 static unsigned long mix(unsigned long a, unsigned long b, unsigned long c) {
     a = a - b;
@@ -88,6 +105,22 @@ uint16_t read_port(char const* string) {
     return (uint16_t)port;
 }
 
+// Parse a numeric option argument, which must lie within [min, max].
+uint64_t read_number(char const* string, uint64_t min, uint64_t max) {
+    char* endptr;
+    errno                    = 0;
+    unsigned long long value = strtoull(string, &endptr, 10);
+    if (errno != 0 || *endptr != 0 || *string == '-' || value < min ||
+        max < value)
+    {
+        fatal("%s is not a number between %" PRIu64 " and %" PRIu64,
+              string,
+              min,
+              max);
+    }
+    return (uint64_t)value;
+}
+
 struct sockaddr_in get_server_address(char const* host, uint16_t port) {
     struct addrinfo hints;
     memset(&hints, 0, sizeof(struct addrinfo));
@@ -117,10 +150,13 @@ bool tcp_readn(int fd, void* vptr, size_t n) {
     ssize_t nleft, nread;
     char* ptr;
 
+    if (uring_active()) return uring_readn(fd, vptr, n);
+
     ptr   = vptr;
     nleft = n;
 
     while (nleft > 0) {
+        stats.syscalls++;
         nread = read(fd, ptr, nleft);
         if (nread < 0 && errno == EINTR) {
             // interrupted by signal
@@ -156,6 +192,7 @@ bool tcp_writen(int fd, const void* vptr, size_t n) {
     ptr   = vptr;
     nleft = n;
     while (nleft > 0) {
+        stats.syscalls++;
         nwritten = write(fd, ptr, nleft);
         if (nwritten < 0 && errno == EINTR) {
             continue;
@@ -171,24 +208,125 @@ bool tcp_writen(int fd, const void* vptr, size_t n) {
     return true;
 }
 
-void print_packet(char* packet, uint32_t packet_count) {
+// Write all iovecs, moving them past the bytes written on the way.
+bool tcp_writev(int fd, struct iovec* iov, int iovcnt) {
+    ssize_t nwritten;
+
+    while (iovcnt > 0) {
+        stats.syscalls++;
+        nwritten = writev(fd, iov, iovcnt);
+        if (nwritten < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (nwritten < 0) {
+            error("%s: failed", __func__);
+            current_error = ERRIO;
+            return false;
+        }
+        iov_advance(&iov, &iovcnt, (size_t)nwritten);
+    }
+    return true;
+}
+
+// Move iovecs past n bytes, dropping those written whole.
+void iov_advance(struct iovec** iov, int* iovcnt, size_t n) {
+    while (*iovcnt > 0 && n >= (*iov)->iov_len) {
+        n -= (*iov)->iov_len;
+        (*iov)++;
+        (*iovcnt)--;
+    }
+    if (*iovcnt > 0) {
+        (*iov)->iov_base = (char*)(*iov)->iov_base + n;
+        (*iov)->iov_len -= n;
+    }
+}
+
+void print_packet(const char* packet, uint32_t packet_count) {
+    if (uring_active()) {
+        uring_write_output(packet, packet_count);
+        return;
+    }
+    if (writer_active()) {
+        writer_put(packet, packet_count);
+        return;
+    }
     if (!tcp_writen(STDOUT_FILENO, packet, packet_count)) fatal("write to stdout failed");
     fflush(stdout);
 }
 
+// Make sure all printed packets reached stdout.
+void print_flush(void) {
+    if (uring_active()) uring_flush_output();
+    if (writer_active()) writer_flush();
+}
+
 void socket_set_timeout(int socket_fd) {
-    struct timeval to = {.tv_sec = MAX_WAIT, .tv_usec = 0};
+    socket_set_timeout_ms(socket_fd, MAX_WAIT * 1000);
+}
+
+void socket_set_timeout_ms(int socket_fd, int timeout_ms) {
+    struct timeval to = {.tv_sec  = timeout_ms / 1000,
+                         .tv_usec = timeout_ms % 1000 * 1000};
     ASSERT_SYS_OK(
         setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof to));
+    uring_set_timeout(socket_fd, timeout_ms);
 }
 
 void socket_clear_timeout(int socket_fd) {
     struct timeval to = {.tv_sec = 0, .tv_usec = 0};
     ASSERT_SYS_OK(
         setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof to));
+    uring_set_timeout(socket_fd, -1);
+}
+
+// Enlarge socket buffers (the kernel caps the size at net.core.*mem_max).
+void socket_set_buffers(int socket_fd, int size) {
+    ASSERT_SYS_OK(
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof size));
+    ASSERT_SYS_OK(
+        setsockopt(socket_fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof size));
 }
 
-int tcp_listen(struct sockaddr_in* server_address) {
+// Let the kernel pace the socket to bytes per second as well, which the fq
+// qdisc enforces per packet, even within a GSO segment.
+bool socket_set_pacing_rate(int socket_fd, uint64_t rate) {
+    if (setsockopt(
+            socket_fd, SOL_SOCKET, SO_MAX_PACING_RATE, &rate, sizeof rate) < 0)
+    {
+        error("cannot set the pacing rate: %s", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void socket_set_nonblocking(int socket_fd) {
+    int flags;
+    ASSERT_SYS_OK(flags = fcntl(socket_fd, F_GETFL));
+    ASSERT_SYS_OK(fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK));
+}
+
+// Wait until the socket is readable, return false on timeout.
+bool socket_wait(int socket_fd, int timeout_ms) {
+    struct pollfd pfd = {.fd = socket_fd, .events = POLLIN};
+    int ready;
+    if (uring_active()) return uring_wait(socket_fd, timeout_ms);
+    if (gro.fd == socket_fd && gro.start < gro.end) return true;
+    do {
+        stats.syscalls++;
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    ASSERT_SYS_OK(ready);
+    return ready > 0;
+}
+
+// Get the current time of the monotonic clock in nanoseconds.
+uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    ASSERT_SYS_OK(clock_gettime(CLOCK_MONOTONIC, &ts));
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+int tcp_listen(struct sockaddr_in* server_address, bool reuse_port) {
     int socket_fd;
 
     // Create a socket for listening.
@@ -201,6 +339,15 @@ int tcp_listen(struct sockaddr_in* server_address) {
                              &(int){1},
                              sizeof(int)));
 
+    // Let other sockets bind the same port, the kernel spreads clients.
+    if (reuse_port) {
+        ASSERT_SYS_OK(setsockopt(socket_fd,
+                                 SOL_SOCKET,
+                                 SO_REUSEPORT,
+                                 &(int){1},
+                                 sizeof(int)));
+    }
+
     // Bind the socket to the provided address.
     ASSERT_SYS_OK(bind(socket_fd,
                        (struct sockaddr*)server_address,
@@ -227,9 +374,9 @@ int tcp_accept(int socket_fd, struct sockaddr_in* client_address) {
                                      (struct sockaddr*)client_address,
                                      &((socklen_t){sizeof(*client_address)})));
 
-    debug("connected to %s:%" PRIu16,
-          inet_ntoa(client_address->sin_addr),
-          ntohs(client_address->sin_port));
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &client_address->sin_addr, host, sizeof(host));
+    debug("connected to %s:%" PRIu16, host, ntohs(client_address->sin_port));
 
     socket_set_timeout(client_fd);
 
@@ -248,9 +395,9 @@ int tcp_connect_to_server(struct sockaddr_in* server_address) {
                           (struct sockaddr*)server_address,
                           (socklen_t)sizeof(*server_address)));
 
-    debug("connected to %s:%" PRIu16,
-          inet_ntoa(server_address->sin_addr),
-          ntohs(server_address->sin_port));
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &server_address->sin_addr, host, sizeof(host));
+    debug("connected to %s:%" PRIu16, host, ntohs(server_address->sin_port));
 
     socket_set_timeout(socket_fd);
 
@@ -258,18 +405,40 @@ int tcp_connect_to_server(struct sockaddr_in* server_address) {
 }
 
 void tcp_disconnect(int socket_fd, struct sockaddr_in* address) {
+    uring_forget(socket_fd);
     ASSERT_SYS_OK(close(socket_fd));
-    debug("disconnected from %s:%" PRIu16,
-          inet_ntoa(address->sin_addr),
-          ntohs(address->sin_port));
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address->sin_addr, host, sizeof(host));
+    debug("disconnected from %s:%" PRIu16, host, ntohs(address->sin_port));
 }
 
-int udp_listen(struct sockaddr_in* server_address) {
+int udp_listen(struct sockaddr_in* server_address, bool reuse_port) {
     int socket_fd;
 
     // Create a socket for listening.
     ASSERT_SYS_OK(socket_fd = socket(AF_INET, SOCK_DGRAM, 0));
 
+    // Make room for a window of DATA packets in flight.
+    socket_set_buffers(socket_fd, UDP_SOCKET_BUFFER);
+
+    // Let other sockets bind the same port, the kernel spreads clients.
+    if (reuse_port) {
+        ASSERT_SYS_OK(setsockopt(socket_fd,
+                                 SOL_SOCKET,
+                                 SO_REUSEPORT,
+                                 &(int){1},
+                                 sizeof(int)));
+    }
+
+    // Take DATA sent with UDP GSO in one piece, it is split on receive. The
+    // io_uring path does not split, and the kernel splits for it instead.
+    if (!uring_active() &&
+        setsockopt(socket_fd, SOL_UDP, UDP_GRO, &(int){1}, sizeof(int)) < 0)
+    {
+        debug("UDP GRO not available");
+        errno = 0;
+    }
+
     // Bind the socket to the provided address.
     ASSERT_SYS_OK(bind(socket_fd,
                        (struct sockaddr*)server_address,
@@ -291,13 +460,16 @@ int udp_connect_to_server(struct sockaddr_in* server_address) {
     // Create a socket.
     ASSERT_SYS_OK(socket_fd = socket(AF_INET, SOCK_DGRAM, 0));
 
+    // Make room for a window of DATA packets in flight.
+    socket_set_buffers(socket_fd, UDP_SOCKET_BUFFER);
+
     // Connect to the server.
     ASSERT_SYS_OK(connect(socket_fd,
                           (struct sockaddr*)server_address,
                           (socklen_t)sizeof(*server_address)));
-    debug("connected to %s:%" PRIu16,
-          inet_ntoa(server_address->sin_addr),
-          ntohs(server_address->sin_port));
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &server_address->sin_addr, host, sizeof(host));
+    debug("connected to %s:%" PRIu16, host, ntohs(server_address->sin_port));
 
     socket_set_timeout(socket_fd);
 
@@ -310,14 +482,35 @@ bool udp_recvfrom(int fd,
                   struct sockaddr_in* client_address) {
     ssize_t nread;
 
-    nread = recvfrom(fd,
-                     buf,
-                     *n,
-                     0,
-                     (struct sockaddr*)client_address,
-                     &((socklen_t){sizeof(*client_address)}));
+    if (uring_active()) return uring_recvfrom(fd, buf, n, client_address);
+
+    // Hand out the next segment of a coalesced datagram.
+    if (gro.fd == fd && gro.start < gro.end) {
+        size_t length = gro.end - gro.start;
+        if (length > gro.segment_size) length = gro.segment_size;
+        if (length > *n) length = *n;
+        memcpy(buf, gro.buf + gro.start, length);
+        gro.start += length;
+        *n              = length;
+        *client_address = gro.address;
+        return true;
+    }
+
+    struct iovec iov = {.iov_base = buf, .iov_len = *n};
+    udp_control_t control;
+    struct msghdr msg = {
+        .msg_name       = client_address,
+        .msg_namelen    = sizeof(*client_address),
+        .msg_iov        = &iov,
+        .msg_iovlen     = 1,
+        .msg_control    = &control,
+        .msg_controllen = sizeof(control),
+    };
+    stats.syscalls++;
+    nread = recvmsg(fd, &msg, 0);
     if (nread < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-        error("%s: timeout", __func__);
+        // Callers retransmit or repeat WND, or report giving up.
+        debug("%s: timeout", __func__);
         current_error = ERRTIMEOUT;
         return false;
     }
@@ -328,15 +521,73 @@ bool udp_recvfrom(int fd,
     }
     *n = (size_t)nread;
 
+    // Keep all segments but the first for the next calls.
+    size_t segment_size = udp_segment_size(&msg);
+    if (segment_size > 0 && *n > segment_size) {
+        if (gro.buf == NULL) ASSERT_MALLOC_OK(gro.buf = malloc(BUFFER_SIZE));
+        gro.fd           = fd;
+        gro.start        = 0;
+        gro.end          = *n - segment_size;
+        gro.segment_size = segment_size;
+        gro.address      = *client_address;
+        memcpy(gro.buf, (char*)buf + segment_size, gro.end);
+        *n = segment_size;
+    }
+
     return true;
 }
 
+bool udp_sendv(int fd,
+               const struct iovec* iov,
+               int iovcnt,
+               struct sockaddr_in* client_address) {
+    size_t n = 0;
+    for (int i = 0; i < iovcnt; i++) n += iov[i].iov_len;
+
+    struct msghdr msg = {
+        .msg_name    = client_address,
+        .msg_namelen = sizeof(*client_address),
+        .msg_iov     = (struct iovec*)iov,
+        .msg_iovlen  = (size_t)iovcnt,
+    };
+    stats.syscalls++;
+    ssize_t nwritten = sendmsg(fd, &msg, 0);
+    if (nwritten < 0) {
+        error("%s: failed", __func__);
+        current_error = ERRIO;
+        return false;
+    }
+    else if ((size_t)nwritten != n) {
+        error("%s: incomplete write", __func__);
+        current_error = ERRIO;
+        return false;
+    }
+
+    return true;
+}
+
+// Get the size of segments of a datagram coalesced by UDP GRO, 0 if it was
+// received as sent.
+size_t udp_segment_size(struct msghdr* msg) {
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+    while (cmsg != NULL) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int segment_size;
+            memcpy(&segment_size, CMSG_DATA(cmsg), sizeof(segment_size));
+            return segment_size > 0 ? (size_t)segment_size : 0;
+        }
+        cmsg = CMSG_NXTHDR(msg, cmsg);
+    }
+    return 0;
+}
+
 bool udp_sendto(int fd,
                 const void* buf,
                 size_t n,
                 struct sockaddr_in* client_address) {
     ssize_t nwritten;
 
+    stats.syscalls++;
     nwritten = sendto(fd,
                       buf,
                       n,
@@ -4,29 +4,57 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #define BUFFER_SIZE 65536
 
+#define NS_PER_MS  1000000ull
+#define NS_PER_SEC 1000000000ull
+
+// Socket buffer size requested for UDP, enough for a full udpw window.
+#define UDP_SOCKET_BUFFER (4 << 20)
+
+// Largest UDP payload over IPv4, also the limit of a GSO or GRO datagram.
+#define UDP_PAYLOAD_MAX 65507
+
+// Room for the UDP_SEGMENT or UDP_GRO control message of a datagram.
+typedef union {
+    char buf[CMSG_SPACE(sizeof(int))];
+    size_t align; // of struct cmsghdr
+} udp_control_t;
+
 void srand_init(void);
 
 void read_data_from_stdin(char** buf, uint64_t* length);
 uint16_t read_port(char const* string);
+uint64_t read_number(char const* string, uint64_t min, uint64_t max);
 struct sockaddr_in get_server_address(char const* host, uint16_t port);
 bool tcp_readn(int fd, void* vptr, size_t n);
 bool tcp_writen(int fd, const void* vptr, size_t n);
+bool tcp_writev(int fd, struct iovec* iov, int iovcnt);
+void iov_advance(struct iovec** iov, int* iovcnt, size_t n);
 
-void print_packet(char* packet, uint32_t packet_count);
+void print_packet(const char* packet, uint32_t packet_count);
+void print_flush(void);
 
 void socket_set_timeout(int socket_fd);
+void socket_set_timeout_ms(int socket_fd, int timeout_ms);
 void socket_clear_timeout(int socket_fd);
+void socket_set_buffers(int socket_fd, int size);
+bool socket_set_pacing_rate(int socket_fd, uint64_t rate);
+void socket_set_nonblocking(int socket_fd);
+bool socket_wait(int socket_fd, int timeout_ms);
+
+uint64_t monotonic_ns(void);
 
-int tcp_listen(struct sockaddr_in* server_address);
+int tcp_listen(struct sockaddr_in* server_address, bool reuse_port);
 int tcp_accept(int socket_fd, struct sockaddr_in* client_address);
 int tcp_connect_to_server(struct sockaddr_in* server_address);
 void tcp_disconnect(int socket_fd, struct sockaddr_in* address);
 
 int udp_connect_to_server(struct sockaddr_in* server_address);
-int udp_listen(struct sockaddr_in* server_address);
+int udp_listen(struct sockaddr_in* server_address, bool reuse_port);
 
 bool udp_recvfrom(int fd,
                   void* vptr,
@@ -36,4 +64,9 @@ bool udp_sendto(int fd,
                 const void* vptr,
                 size_t n,
                 struct sockaddr_in* client_address);
+bool udp_sendv(int fd,
+               const struct iovec* iov,
+               int iovcnt,
+               struct sockaddr_in* client_address);
+size_t udp_segment_size(struct msghdr* msg);
 #endif
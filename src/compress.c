@@ -0,0 +1,203 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "affinity.h"
+#include "compress.h"
+#include "err.h"
+#include "lz.h"
+
+// Payloads queued past the next one, per thread compressing them.
+#define COMPRESS_AHEAD_PER_THREAD 4
+
+typedef struct {
+    const char* raw; // slice of the input
+    uint32_t raw_count;
+    uint64_t end; // stream offset right after the payload
+    char* frame;  // MAX_PACKET_COUNT bytes, allocated when first needed
+    uint32_t frame_count;
+    bool done;
+} job_t;
+
+struct compressor {
+    input_t* input;
+    const sizing_t* sizing;
+    uint64_t left;   // bytes of the stream not queued yet
+    uint64_t offset; // of the next payload to be queued
+    bool eof;        // the end of the input was queued
+
+    // Job j lives in slot j % COMPRESS_SLOTS.
+    job_t jobs[COMPRESS_SLOTS];
+    uint64_t freed;  // oldest job the sender still holds
+    uint64_t next;   // next job returned to the sender
+    uint64_t queued; // jobs queued so far
+    uint64_t taken;  // jobs taken to be compressed so far
+    uint64_t ahead;  // most jobs queued past the next one
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond_queued;
+    pthread_cond_t cond_done;
+    pthread_t workers[COMPRESS_WORKERS_MAX];
+    int worker_count;
+    bool closing;
+};
+
+static void compress_job(job_t* job) {
+    if (job->frame == NULL) {
+        ASSERT_MALLOC_OK(job->frame = malloc(MAX_PACKET_COUNT));
+    }
+    job->frame_count = lz_frame_encode(job->raw, job->raw_count, job->frame);
+}
+
+// Compress queued jobs in order until the compressor is closed.
+static void* worker(void* arg) {
+    compressor_t* compressor = arg;
+
+    ASSERT_ZERO(pthread_mutex_lock(&compressor->lock));
+    while (true) {
+        while (!compressor->closing &&
+               compressor->taken == compressor->queued)
+        {
+            ASSERT_ZERO(pthread_cond_wait(&compressor->cond_queued,
+                                          &compressor->lock));
+        }
+        if (compressor->closing) break;
+        job_t* job = &compressor->jobs[compressor->taken++ % COMPRESS_SLOTS];
+        ASSERT_ZERO(pthread_mutex_unlock(&compressor->lock));
+
+        compress_job(job);
+
+        ASSERT_ZERO(pthread_mutex_lock(&compressor->lock));
+        job->done = true;
+        ASSERT_ZERO(pthread_cond_broadcast(&compressor->cond_done));
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&compressor->lock));
+    return NULL;
+}
+
+// Queue the next payload, waiting for the input if needed. Return false
+// past the end of the stream.
+static bool queue(compressor_t* compressor) {
+    if (compressor->eof || compressor->left == 0) return false;
+    if (compressor->queued - compressor->freed == COMPRESS_SLOTS) {
+        fatal("all compressed frames held by the sender");
+    }
+
+    // Leave room for the frame header in the packet.
+    uint32_t size = sizing_next(compressor->sizing, compressor->left);
+    size = size > sizeof(frame_t) ? size - sizeof(frame_t) : 1;
+    if (size > LZ_RAW_MAX) size = LZ_RAW_MAX;
+
+    job_t* job     = &compressor->jobs[compressor->queued % COMPRESS_SLOTS];
+    job->raw_count = input_acquire(
+        compressor->input, compressor->offset, size, &job->raw);
+    job->end  = compressor->offset + job->raw_count;
+    job->done = false;
+    compressor->offset = job->end;
+    compressor->left -= job->raw_count;
+    compressor->eof = job->raw_count == 0;
+
+    ASSERT_ZERO(pthread_mutex_lock(&compressor->lock));
+    compressor->queued++;
+    ASSERT_ZERO(pthread_cond_signal(&compressor->cond_queued));
+    ASSERT_ZERO(pthread_mutex_unlock(&compressor->lock));
+    return true;
+}
+
+compressor_t* compressor_open(input_t* input,
+                              const sizing_t* sizing,
+                              uint64_t offset,
+                              uint64_t count) {
+    compressor_t* compressor;
+    ASSERT_MALLOC_OK(compressor = calloc(1, sizeof(*compressor)));
+    compressor->input  = input;
+    compressor->sizing = sizing;
+    compressor->left   = count;
+    compressor->offset = offset;
+
+    int cpus[MAX_CPUS];
+    int cpu_count            = allowed_cpus(cpus, MAX_CPUS);
+    compressor->worker_count = cpu_count > 1 ? cpu_count - 1 : 0;
+    if (compressor->worker_count > COMPRESS_WORKERS_MAX) {
+        compressor->worker_count = COMPRESS_WORKERS_MAX;
+    }
+    compressor->ahead =
+        COMPRESS_AHEAD_PER_THREAD * (uint64_t)(compressor->worker_count + 1);
+
+    ASSERT_ZERO(pthread_mutex_init(&compressor->lock, NULL));
+    ASSERT_ZERO(pthread_cond_init(&compressor->cond_queued, NULL));
+    ASSERT_ZERO(pthread_cond_init(&compressor->cond_done, NULL));
+    for (int i = 0; i < compressor->worker_count; i++) {
+        ASSERT_ZERO(pthread_create(
+            &compressor->workers[i], NULL, worker, compressor));
+    }
+    debug("compressing on %d worker threads", compressor->worker_count);
+    return compressor;
+}
+
+void compressor_next(compressor_t* compressor,
+                     const char** frame,
+                     uint32_t* frame_count,
+                     const char** stream,
+                     uint32_t* stream_count) {
+    // Only the payload needed now is waited for.
+    if (compressor->next == compressor->queued && !queue(compressor)) {
+        *frame        = NULL;
+        *frame_count  = 0;
+        *stream       = NULL;
+        *stream_count = 0;
+        return;
+    }
+    while (compressor->queued - compressor->next <= compressor->ahead &&
+           input_ready(compressor->input, compressor->offset) &&
+           queue(compressor))
+        ;
+
+    job_t* job = &compressor->jobs[compressor->next % COMPRESS_SLOTS];
+    ASSERT_ZERO(pthread_mutex_lock(&compressor->lock));
+    // Compress it here rather than wait for a worker to take it.
+    if (compressor->taken == compressor->next) {
+        compressor->taken++;
+        ASSERT_ZERO(pthread_mutex_unlock(&compressor->lock));
+        compress_job(job);
+        ASSERT_ZERO(pthread_mutex_lock(&compressor->lock));
+        job->done = true;
+    }
+    while (!job->done) {
+        ASSERT_ZERO(
+            pthread_cond_wait(&compressor->cond_done, &compressor->lock));
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&compressor->lock));
+
+    compressor->next++;
+    *frame        = job->frame;
+    *frame_count  = job->frame_count;
+    *stream       = job->raw;
+    *stream_count = job->raw_count;
+}
+
+void compressor_release(compressor_t* compressor, uint64_t offset) {
+    while (compressor->freed < compressor->next &&
+           compressor->jobs[compressor->freed % COMPRESS_SLOTS].end <= offset)
+    {
+        compressor->freed++;
+    }
+}
+
+void compressor_close(compressor_t* compressor) {
+    if (compressor == NULL) return;
+
+    ASSERT_ZERO(pthread_mutex_lock(&compressor->lock));
+    compressor->closing = true;
+    ASSERT_ZERO(pthread_cond_broadcast(&compressor->cond_queued));
+    ASSERT_ZERO(pthread_mutex_unlock(&compressor->lock));
+    for (int i = 0; i < compressor->worker_count; i++) {
+        ASSERT_ZERO(pthread_join(compressor->workers[i], NULL));
+    }
+
+    for (int i = 0; i < COMPRESS_SLOTS; i++) free(compressor->jobs[i].frame);
+    ASSERT_ZERO(pthread_mutex_destroy(&compressor->lock));
+    ASSERT_ZERO(pthread_cond_destroy(&compressor->cond_queued));
+    ASSERT_ZERO(pthread_cond_destroy(&compressor->cond_done));
+    free(compressor);
+}
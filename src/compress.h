@@ -0,0 +1,51 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "batch.h"
+#include "input.h"
+#include "protocol.h"
+#include "sizing.h"
+
+// Most threads compressing for the client, besides the sending one.
+#define COMPRESS_WORKERS_MAX 4
+
+// Frames held at once: those the sender has not released yet, at most a
+// full batch queued for sending and the window, and those compressed
+// ahead of it.
+#define COMPRESS_SLOTS (2 * BATCH_MAX)
+
+/*
+    Frames of the DATA payloads of a session with FEATURE_LZ, compressed
+    ahead of the sender. Payloads are taken from the input in order and
+    sized by the sizing policy, so that a frame fits the packet the policy
+    chooses. Idle workers compress those queued, and the sending thread
+    compresses the next payload itself if no worker got to it yet. Input
+    which is not there yet is not waited for until the sender needs it.
+*/
+typedef struct compressor compressor_t;
+
+// Start compressing count bytes of the input from offset on, on one thread
+// less than the CPUs the client may run on, up to COMPRESS_WORKERS_MAX.
+compressor_t* compressor_open(input_t* input,
+                              const sizing_t* sizing,
+                              uint64_t offset,
+                              uint64_t count);
+
+// Get the frame of the next payload, and the bytes of the stream it
+// carries; the counts are 0 at the end of the input. Both stay valid until
+// compressor_release() is called with an offset past the payload.
+void compressor_next(compressor_t* compressor,
+                     const char** frame,
+                     uint32_t* frame_count,
+                     const char** stream,
+                     uint32_t* stream_count);
+
+// Allow the frames of the stream before offset to be reused.
+void compressor_release(compressor_t* compressor, uint64_t offset);
+
+void compressor_close(compressor_t* compressor);
+
+#endif
@@ -0,0 +1,63 @@
+#include "common.h"
+#include "congestion.h"
+
+#define QUEUE_DELAY_MIN_NS ((uint64_t)QUEUE_DELAY_MIN_US * 1000)
+
+static int half(int cwnd) {
+    return cwnd / 2 > CWND_MIN ? cwnd / 2 : CWND_MIN;
+}
+
+void congestion_init(congestion_t* cc, int max_cwnd) {
+    cc->max_cwnd     = max_cwnd;
+    cc->cwnd         = CWND_INITIAL < max_cwnd ? CWND_INITIAL : max_cwnd;
+    cc->ssthresh     = max_cwnd;
+    cc->acked        = 0;
+    cc->recovery_end = 0;
+    cc->min_rtt_ns   = 0;
+}
+
+bool congestion_slow_start(const congestion_t* cc) {
+    return cc->cwnd < cc->ssthresh;
+}
+
+void congestion_on_ack(congestion_t* cc, int acked, uint64_t rtt_ns) {
+    if (rtt_ns > 0) {
+        if (cc->min_rtt_ns == 0 || rtt_ns < cc->min_rtt_ns) {
+            cc->min_rtt_ns = rtt_ns;
+        }
+        uint64_t threshold = cc->min_rtt_ns / 8 > QUEUE_DELAY_MIN_NS
+                                 ? cc->min_rtt_ns / 8
+                                 : QUEUE_DELAY_MIN_NS;
+        if (congestion_slow_start(cc) && rtt_ns > cc->min_rtt_ns + threshold) {
+            cc->ssthresh = cc->cwnd;
+        }
+    }
+
+    if (congestion_slow_start(cc)) {
+        cc->cwnd += acked;
+    }
+    else {
+        cc->acked += acked;
+        if (cc->acked >= cc->cwnd) {
+            cc->acked -= cc->cwnd;
+            cc->cwnd++;
+        }
+    }
+    if (cc->cwnd > cc->max_cwnd) cc->cwnd = cc->max_cwnd;
+}
+
+void congestion_on_loss(congestion_t* cc, uint64_t packet_no, uint64_t next) {
+    // Packets sent before the last reaction were lost to the same congestion.
+    if (packet_no < cc->recovery_end) return;
+    cc->recovery_end = next;
+    cc->ssthresh     = half(cc->cwnd);
+    cc->cwnd         = cc->ssthresh;
+    cc->acked        = 0;
+}
+
+void congestion_on_timeout(congestion_t* cc, uint64_t next) {
+    cc->recovery_end = next;
+    cc->ssthresh     = half(cc->cwnd);
+    cc->cwnd         = CWND_MIN;
+    cc->acked        = 0;
+}
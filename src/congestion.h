@@ -0,0 +1,44 @@
+#ifndef CONGESTION_H
+#define CONGESTION_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Packets in flight when a session starts and after a timeout.
+#define CWND_INITIAL 4
+#define CWND_MIN     1
+
+// Slow start ends early once an RTT sample exceeds the smallest one by an
+// eighth of it, and at least by this much.
+#define QUEUE_DELAY_MIN_US 1000
+
+/*
+    Congestion window of the udpw mode, counted in DATA packets, in the
+    manner of TCP Reno. The window doubles every round trip in slow start
+    and grows by one packet per window in congestion avoidance. A loss
+    detected from SACKs halves it, at most once per window of packets in
+    flight; a timeout shrinks it to CWND_MIN. Slow start also ends when the
+    RTT starts to grow, as the path queues up before it drops packets.
+*/
+typedef struct {
+    int cwnd;
+    int ssthresh;
+    int max_cwnd;          // window set by the user
+    int acked;             // packets acknowledged since cwnd last grew
+    uint64_t recovery_end; // losses before this packet were reacted to
+    uint64_t min_rtt_ns;   // 0 until the first sample
+} congestion_t;
+
+void congestion_init(congestion_t* cc, int max_cwnd);
+
+// Account for newly acknowledged packets and an RTT sample, 0 if none.
+void congestion_on_ack(congestion_t* cc, int acked, uint64_t rtt_ns);
+
+// React to the loss of a packet, next being the first packet not sent yet.
+void congestion_on_loss(congestion_t* cc, uint64_t packet_no, uint64_t next);
+
+void congestion_on_timeout(congestion_t* cc, uint64_t next);
+
+bool congestion_slow_start(const congestion_t* cc);
+
+#endif
@@ -0,0 +1,119 @@
+#include <endian.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "crc32c.h"
+#include "err.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+// CRC-32C polynomial, bit-reflected.
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+// Bytes of each of the three streams run at once by the crc32 instruction,
+// which takes three cycles but can start every cycle.
+#define STRIDE 256
+
+static struct {
+    pthread_once_t once;
+    uint32_t table[8][256]; // CRC of a byte followed by 0 to 7 zero bytes
+    uint32_t shift[4][256]; // appends STRIDE zero bytes to a register
+    bool sse42;
+} crc_tables = {.once = PTHREAD_ONCE_INIT};
+
+static void crc_init(void) {
+    for (uint32_t b = 0; b < 256; b++) {
+        uint32_t r = b;
+        for (int k = 0; k < 8; k++) {
+            r = r >> 1 ^ (r & 1 ? CRC32C_POLYNOMIAL : 0);
+        }
+        crc_tables.table[0][b] = r;
+    }
+    for (int b = 0; b < 256; b++) {
+        for (int k = 1; k < 8; k++) {
+            uint32_t r             = crc_tables.table[k - 1][b];
+            crc_tables.table[k][b] = r >> 8 ^ crc_tables.table[0][r & 0xff];
+        }
+    }
+
+    // Appending zeros is linear in the register, so it is the sum of
+    // appending them to each of its bits.
+    uint32_t basis[32];
+    for (int i = 0; i < 32; i++) {
+        uint32_t r = (uint32_t)1 << i;
+        for (int k = 0; k < STRIDE; k++) {
+            r = r >> 8 ^ crc_tables.table[0][r & 0xff];
+        }
+        basis[i] = r;
+    }
+    for (int k = 0; k < 4; k++) {
+        for (int b = 0; b < 256; b++) {
+            uint32_t r = 0;
+            for (int j = 0; j < 8; j++) {
+                if (b >> j & 1) r ^= basis[8 * k + j];
+            }
+            crc_tables.shift[k][b] = r;
+        }
+    }
+#if defined(__x86_64__)
+    crc_tables.sse42 = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static uint64_t load64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return le64toh(v);
+}
+
+// Extend a register by STRIDE zero bytes.
+static uint32_t shift(uint32_t r) {
+    return crc_tables.shift[0][r & 0xff] ^ crc_tables.shift[1][r >> 8 & 0xff] ^
+           crc_tables.shift[2][r >> 16 & 0xff] ^ crc_tables.shift[3][r >> 24];
+}
+
+static uint32_t crc_software(uint32_t r, const uint8_t* p, size_t n) {
+    uint32_t(*t)[256] = crc_tables.table;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t v = load64(p) ^ r;
+        r = t[7][v & 0xff] ^ t[6][v >> 8 & 0xff] ^ t[5][v >> 16 & 0xff] ^
+            t[4][v >> 24 & 0xff] ^ t[3][v >> 32 & 0xff] ^
+            t[2][v >> 40 & 0xff] ^ t[1][v >> 48 & 0xff] ^ t[0][v >> 56];
+    }
+    for (; n > 0; n--, p++) r = r >> 8 ^ t[0][(r ^ *p) & 0xff];
+    return r;
+}
+
+#if defined(__x86_64__)
+// Run three streams of STRIDE bytes at once, then append the later ones to
+// the first as the register is linear: CRC(a || b) = shift(CRC(a)) ^ CRC(b)
+// with the second started from zero.
+__attribute__((target("sse4.2"))) static uint32_t
+crc_sse42(uint32_t r, const uint8_t* p, size_t n) {
+    for (; n >= 3 * STRIDE; n -= 3 * STRIDE, p += 3 * STRIDE) {
+        uint64_t a = r, b = 0, c = 0;
+        for (size_t i = 0; i < STRIDE; i += 8) {
+            a = _mm_crc32_u64(a, load64(p + i));
+            b = _mm_crc32_u64(b, load64(p + STRIDE + i));
+            c = _mm_crc32_u64(c, load64(p + 2 * STRIDE + i));
+        }
+        r = shift(shift((uint32_t)a) ^ (uint32_t)b) ^ (uint32_t)c;
+    }
+    uint64_t a = r;
+    for (; n >= 8; n -= 8, p += 8) a = _mm_crc32_u64(a, load64(p));
+    r = (uint32_t)a;
+    for (; n > 0; n--, p++) r = _mm_crc32_u8(r, *p);
+    return r;
+}
+#endif
+
+uint32_t crc32c(uint32_t crc, const void* data, size_t n) {
+    ASSERT_ZERO(pthread_once(&crc_tables.once, crc_init));
+#if defined(__x86_64__)
+    if (crc_tables.sse42) return ~crc_sse42(~crc, data, n);
+#endif
+    return ~crc_software(~crc, data, n);
+}
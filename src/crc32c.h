@@ -0,0 +1,17 @@
+#ifndef CRC32C_H
+#define CRC32C_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+/*
+    CRC-32C (Castagnoli), as in iSCSI and ext4, with the polynomial the
+    SSE4.2 crc32 instruction computes. Where the CPU has it, 8 bytes are
+    done per instruction on three independent streams at once, otherwise
+    8 bytes per step through tables.
+*/
+
+// Extend the CRC of the bytes before data, 0 for none, by n more bytes.
+uint32_t crc32c(uint32_t crc, const void* data, size_t n);
+
+#endif
@@ -8,7 +8,7 @@
 
 #include "err.h"
 
-error_t current_error;
+_Thread_local error_t current_error;
 
 noreturn void syserr(const char* fmt, ...) {
     va_list fmt_args;
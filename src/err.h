@@ -1,6 +1,7 @@
 #ifndef ERR_H
 #define ERR_H
 
+#include <errno.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -41,6 +42,24 @@
         }                                                                      \
     } while (0)
 
+/*
+    Assert that expression evaluates to zero (otherwise use the result as
+    errno, as pthread functions do).
+*/
+#define ASSERT_ZERO(expr)                                                      \
+    do {                                                                       \
+        int const _errno = (expr);                                             \
+        if (_errno != 0) {                                                     \
+            errno = _errno;                                                    \
+            syserr("system command failed: %s, in function %s() in %s line "   \
+                   "%d, errno: ",                                              \
+                   #expr,                                                      \
+                   __func__,                                                   \
+                   __FILE__,                                                   \
+                   __LINE__);                                                  \
+        }                                                                      \
+    } while (0)
+
 // Custom error codes.
 typedef enum {
     ERRCONN,
@@ -53,10 +72,11 @@ typedef enum {
     ERRIO,
     ERROLD,
     ERRTIMEOUT,
+    ERRCHECKSUM,
     NOERR
 } error_t;
 
-extern error_t current_error;
+extern _Thread_local error_t current_error;
 
 // Printf information about a system error and quit.
 noreturn void syserr(const char* fmt, ...);
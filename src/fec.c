@@ -0,0 +1,379 @@
+#include <endian.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "fec.h"
+
+#if defined(__x86_64__)
+#include <tmmintrin.h>
+#endif
+
+// Reduction polynomial of GF(256), x^8 + x^4 + x^3 + x^2 + 1.
+#define GF_POLYNOMIAL 0x11d
+
+static struct {
+    pthread_once_t once;
+    uint8_t exp[2 * 255]; // doubled, so a sum of two logarithms needs no mod
+    uint8_t log[256];
+    bool ssse3;
+} gf = {.once = PTHREAD_ONCE_INIT};
+
+static void gf_init(void) {
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++) {
+        gf.exp[i] = gf.exp[i + 255] = (uint8_t)x;
+        gf.log[x]                   = (uint8_t)i;
+        x <<= 1;
+        if (x & 0x100) x ^= GF_POLYNOMIAL;
+    }
+#if defined(__x86_64__)
+    gf.ssse3 = __builtin_cpu_supports("ssse3");
+#endif
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) return 0;
+    return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+static uint8_t gf_inv(uint8_t a) {
+    return gf.exp[255 - gf.log[a]];
+}
+
+#if defined(__x86_64__)
+// Multiply 16 bytes at a time, looking both nibbles of each up with PSHUFB.
+// Return how many bytes were done.
+__attribute__((target("ssse3"))) static size_t
+mul_add_ssse3(uint8_t* dst,
+              const uint8_t* src,
+              const uint8_t* low,
+              const uint8_t* high,
+              size_t n) {
+    __m128i low_table  = _mm_loadu_si128((const __m128i*)low);
+    __m128i high_table = _mm_loadu_si128((const __m128i*)high);
+    __m128i mask       = _mm_set1_epi8(0x0f);
+    size_t i           = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i l = _mm_shuffle_epi8(low_table, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(
+            high_table, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i),
+                         _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    return i;
+}
+#endif
+
+// Add coef times src to dst. The product is linear, so it is the sum of the
+// products of the low and the high nibble, each taken from a 16-byte table.
+static void mul_add(uint8_t* dst, const uint8_t* src, uint8_t coef, size_t n) {
+    if (coef == 0) return;
+    if (coef == 1) {
+        for (size_t i = 0; i < n; i++) dst[i] ^= src[i];
+        return;
+    }
+
+    uint8_t low[16], high[16];
+    for (int x = 0; x < 16; x++) {
+        low[x]  = gf_mul(coef, (uint8_t)x);
+        high[x] = gf_mul(coef, (uint8_t)(x << 4));
+    }
+    size_t i = 0;
+#if defined(__x86_64__)
+    if (gf.ssse3) i = mul_add_ssse3(dst, src, low, high, n);
+#endif
+    for (; i < n; i++) dst[i] ^= low[src[i] & 0x0f] ^ high[src[i] >> 4];
+}
+
+// Entry of the Cauchy matrix, 1 / (x_j + y_i) with x_j = FEC_DATA_MAX + j
+// and y_i = i, all distinct.
+static uint8_t coefficient(int parity_no, int data_no) {
+    return gf_inv((uint8_t)((FEC_DATA_MAX + parity_no) ^ data_no));
+}
+
+static uint32_t symbol_length(const char* symbol) {
+    uint32_t length;
+    memcpy(&length, symbol, sizeof(length));
+    return be32toh(length);
+}
+
+bool fec_parse_params(const char* string, fec_params_t* params) {
+    int data_count, parity_count, end = 0;
+    if (sscanf(string, "%d:%d%n", &data_count, &parity_count, &end) != 2 ||
+        string[end] != '\0' || data_count < 1 || data_count > FEC_DATA_MAX ||
+        parity_count < 1 || parity_count > FEC_PARITY_MAX)
+    {
+        return false;
+    }
+    params->data_count   = data_count;
+    params->parity_count = parity_count;
+    return true;
+}
+
+void fec_encode(char* parity,
+                int parity_no,
+                int data_no,
+                const char* payload,
+                uint32_t payload_count) {
+    ASSERT_ZERO(pthread_once(&gf.once, gf_init));
+    uint8_t coef    = coefficient(parity_no, data_no);
+    uint32_t length = htobe32(payload_count);
+    mul_add((uint8_t*)parity, (const uint8_t*)&length, coef, sizeof(length));
+    mul_add((uint8_t*)parity + sizeof(length),
+            (const uint8_t*)payload,
+            coef,
+            payload_count);
+}
+
+bool fec_decode(int data_count,
+                char* const* symbols,
+                const bool* present,
+                char* const* parities,
+                size_t symbol_size) {
+    int missing[FEC_PARITY_MAX], rows[FEC_PARITY_MAX];
+    int missing_count = 0, row_count = 0;
+
+    ASSERT_ZERO(pthread_once(&gf.once, gf_init));
+    for (int i = 0; i < data_count; i++) {
+        if (present[i]) continue;
+        if (missing_count == FEC_PARITY_MAX) return false;
+        missing[missing_count++] = i;
+    }
+    for (int j = 0; j < FEC_PARITY_MAX && row_count < missing_count; j++) {
+        if (parities[j] != NULL) rows[row_count++] = j;
+    }
+    if (row_count < missing_count) return false;
+    if (missing_count == 0) return true;
+
+    // Leave only the missing symbols in the parity used.
+    for (int a = 0; a < missing_count; a++) {
+        for (int i = 0; i < data_count; i++) {
+            if (!present[i]) continue;
+            mul_add((uint8_t*)parities[rows[a]],
+                    (const uint8_t*)symbols[i],
+                    coefficient(rows[a], i),
+                    sizeof(uint32_t) + symbol_length(symbols[i]));
+        }
+    }
+
+    // Invert the matrix of the missing symbols in the parity used, by
+    // Gauss-Jordan elimination next to an identity matrix.
+    uint8_t m[FEC_PARITY_MAX][2 * FEC_PARITY_MAX];
+    int n = missing_count;
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            m[a][b]     = coefficient(rows[a], missing[b]);
+            m[a][n + b] = a == b;
+        }
+    }
+    for (int c = 0; c < n; c++) {
+        // A Cauchy matrix has no singular submatrix, a pivot exists.
+        int p = c;
+        while (m[p][c] == 0) p++;
+        for (int k = 0; k < 2 * n; k++) {
+            uint8_t t = m[c][k];
+            m[c][k]   = m[p][k];
+            m[p][k]   = t;
+        }
+        uint8_t scale = gf_inv(m[c][c]);
+        for (int k = 0; k < 2 * n; k++) m[c][k] = gf_mul(m[c][k], scale);
+        for (int a = 0; a < n; a++) {
+            uint8_t factor = m[a][c];
+            if (a == c || factor == 0) continue;
+            for (int k = 0; k < 2 * n; k++) {
+                m[a][k] ^= gf_mul(factor, m[c][k]);
+            }
+        }
+    }
+
+    for (int b = 0; b < n; b++) {
+        uint8_t* symbol = (uint8_t*)symbols[missing[b]];
+        memset(symbol, 0, symbol_size);
+        for (int a = 0; a < n; a++) {
+            mul_add(symbol,
+                    (const uint8_t*)parities[rows[a]],
+                    m[b][n + a],
+                    symbol_size);
+        }
+    }
+    return true;
+}
+
+static char* slot(char** slot) {
+    if (*slot == NULL) ASSERT_MALLOC_OK(*slot = malloc(FEC_SYMBOL_MAX));
+    return *slot;
+}
+
+static bool held(const fec_window_t* window, uint64_t packet_no) {
+    return window->numbers[packet_no % FEC_WINDOW] == packet_no;
+}
+
+// Get the first packet which may share a block with the next expected one.
+static uint64_t window_base(const fec_window_t* window) {
+    uint64_t next = window->next_packet_no;
+    if (window->data_count > 0) return next - next % window->data_count;
+    return next < FEC_DATA_MAX ? START_NO : next - (FEC_DATA_MAX - 1);
+}
+
+void fec_window_reset(fec_window_t* window) {
+    window->next_packet_no = START_NO;
+    window->data_count     = 0;
+    for (int i = 0; i < FEC_WINDOW; i++) window->numbers[i] = UINT64_MAX;
+    for (int b = 0; b < 2; b++) {
+        window->parity[b].first_packet_no = UINT64_MAX;
+    }
+}
+
+void fec_window_free(fec_window_t* window) {
+    for (int i = 0; i < FEC_WINDOW; i++) {
+        free(window->slots[i]);
+        window->slots[i] = NULL;
+    }
+    for (int b = 0; b < 2; b++) {
+        for (int j = 0; j < FEC_PARITY_MAX; j++) {
+            free(window->parity[b].symbols[j]);
+            window->parity[b].symbols[j] = NULL;
+        }
+    }
+}
+
+bool fec_window_store(fec_window_t* window,
+                      uint64_t packet_no,
+                      const char* packet,
+                      uint32_t packet_count) {
+    if (packet_no >= window_base(window) + FEC_WINDOW) return false;
+    if (packet_no < window->next_packet_no || held(window, packet_no)) {
+        return true; // duplicate
+    }
+
+    char* symbol    = slot(&window->slots[packet_no % FEC_WINDOW]);
+    uint32_t length = htobe32(packet_count);
+    memcpy(symbol, &length, sizeof(length));
+    memcpy(symbol + sizeof(length), packet, packet_count);
+    window->numbers[packet_no % FEC_WINDOW] = packet_no;
+    return true;
+}
+
+bool fec_window_store_parity(fec_window_t* window,
+                             uint64_t first_packet_no,
+                             int data_count,
+                             int parity_no,
+                             const char* parity,
+                             uint32_t parity_count) {
+    // Parity of a block released whole is of no use any more.
+    if (first_packet_no + (uint64_t)data_count <= window->next_packet_no) {
+        return true;
+    }
+    // Only the last block may be shorter than the others.
+    if (data_count > window->data_count) window->data_count = data_count;
+
+    int b = -1;
+    for (int i = 0; i < 2; i++) {
+        if (window->parity[i].first_packet_no == first_packet_no) b = i;
+    }
+    if (b >= 0 && (window->parity[b].data_count != data_count ||
+                   window->parity[b].symbol_size != parity_count))
+    {
+        return false;
+    }
+    for (int i = 0; i < 2 && b < 0; i++) {
+        if (window->parity[i].first_packet_no != UINT64_MAX) continue;
+        b                                 = i;
+        window->parity[b].first_packet_no = first_packet_no;
+        window->parity[b].data_count      = data_count;
+        window->parity[b].symbol_size     = parity_count;
+        memset(window->parity[b].present,
+               0,
+               sizeof(window->parity[b].present));
+    }
+    if (b < 0) return false; // two blocks ahead, this one is lost
+
+    if (!window->parity[b].present[parity_no]) {
+        memcpy(slot(&window->parity[b].symbols[parity_no]),
+               parity,
+               parity_count);
+        window->parity[b].present[parity_no] = true;
+    }
+    return true;
+}
+
+int fec_window_rebuild(fec_window_t* window) {
+    uint64_t next = window->next_packet_no;
+    if (held(window, next)) return 0;
+
+    int b = -1;
+    for (int i = 0; i < 2; i++) {
+        uint64_t first = window->parity[i].first_packet_no;
+        if (first != UINT64_MAX && first <= next &&
+            next - first < (uint64_t)window->parity[i].data_count)
+            b = i;
+    }
+    if (b < 0) return 0;
+
+    uint64_t first       = window->parity[b].first_packet_no;
+    int data_count       = window->parity[b].data_count;
+    uint32_t symbol_size = window->parity[b].symbol_size;
+    char* symbols[FEC_DATA_MAX];
+    bool present[FEC_DATA_MAX];
+    char* parities[FEC_PARITY_MAX];
+
+    for (int i = 0; i < data_count; i++) {
+        uint64_t packet_no = first + (uint64_t)i;
+        present[i]         = held(window, packet_no);
+        symbols[i]         = slot(&window->slots[packet_no % FEC_WINDOW]);
+        if (present[i] &&
+            sizeof(uint32_t) + symbol_length(symbols[i]) > symbol_size)
+            return -1;
+    }
+    for (int j = 0; j < FEC_PARITY_MAX; j++) {
+        parities[j] = window->parity[b].present[j]
+                          ? window->parity[b].symbols[j]
+                          : NULL;
+    }
+    if (!fec_decode(data_count, symbols, present, parities, symbol_size)) {
+        return 0;
+    }
+
+    // The parity was used up, later copies of it are not needed.
+    int rebuilt = 0;
+    for (int i = 0; i < data_count; i++) {
+        if (present[i]) continue;
+        uint32_t length = symbol_length(symbols[i]);
+        if (length > MAX_PACKET_COUNT ||
+            sizeof(uint32_t) + length > symbol_size)
+            return -1;
+        window->numbers[(first + (uint64_t)i) % FEC_WINDOW] = first + i;
+        rebuilt++;
+    }
+    return rebuilt;
+}
+
+bool fec_window_peek(fec_window_t* window,
+                     char** packet,
+                     uint32_t* packet_count) {
+    uint64_t next = window->next_packet_no;
+    if (!held(window, next)) return false;
+
+    char* symbol  = window->slots[next % FEC_WINDOW];
+    *packet       = symbol + sizeof(uint32_t);
+    *packet_count = symbol_length(symbol);
+    return true;
+}
+
+void fec_window_advance(fec_window_t* window) {
+    window->next_packet_no++;
+    for (int b = 0; b < 2; b++) {
+        uint64_t first = window->parity[b].first_packet_no;
+        if (first != UINT64_MAX &&
+            first + (uint64_t)window->parity[b].data_count <=
+                window->next_packet_no)
+        {
+            window->parity[b].first_packet_no = UINT64_MAX;
+        }
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef FEC_H
+#define FEC_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+// Largest block of DATA packets, and most parity packets per block.
+#define FEC_DATA_MAX   64
+#define FEC_PARITY_MAX 16
+
+// A symbol is a DATA payload prefixed with its 32-bit length, so that a
+// rebuilt packet knows its size. Shorter symbols of a block are padded
+// with zeros to the longest one, which is the length of its parity.
+#define FEC_SYMBOL_MAX (sizeof(uint32_t) + MAX_PACKET_COUNT)
+
+// Packets a receiver holds: two blocks of the largest size.
+#define FEC_WINDOW (2 * FEC_DATA_MAX)
+
+// Block geometry chosen by the client for a session.
+typedef struct {
+    int data_count;   // DATA packets per block, the last one may have fewer
+    int parity_count; // parity packets sent after each block
+} fec_params_t;
+
+/*
+    Systematic erasure code of the udpf mode over GF(256). Parity symbol j
+    of a block is the sum of c(j, i) times data symbol i, where c is a
+    Cauchy matrix. Every square submatrix of it can be inverted, so any
+    data_count of the data and parity symbols of a block rebuild the rest:
+    up to parity_count lost packets per block.
+*/
+
+// Parse the block geometry as "data_count:parity_count".
+bool fec_parse_params(const char* string, fec_params_t* params);
+
+// Add data symbol data_no of a block, made of a payload, to parity symbol
+// parity_no. The parity must be zero up to the length of the symbol.
+void fec_encode(char* parity,
+                int parity_no,
+                int data_no,
+                const char* payload,
+                uint32_t payload_count);
+
+// Rebuild the missing data symbols of a block in place, from the parity
+// symbols which are not NULL. Parity symbols are overwritten. Return false
+// if there are too few of them.
+bool fec_decode(int data_count,
+                char* const* symbols,
+                const bool* present,
+                char* const* parities,
+                size_t symbol_size);
+
+/*
+    Receive side of the udpf mode. DATA packets are released in order, but
+    kept until the whole block is released, as a lost one is rebuilt from
+    all the others. The block size is learned from parity packets, until
+    then the packets of a block are assumed to be within FEC_DATA_MAX of
+    each other. Parity is kept for the block of the next expected packet
+    and the one after it.
+*/
+typedef struct {
+    uint64_t next_packet_no; // all packets before it were released
+    int data_count;          // of a full block, 0 until known
+
+    uint64_t numbers[FEC_WINDOW]; // of the packet in each slot
+    char* slots[FEC_WINDOW];      // symbols, allocated when first needed
+
+    struct {
+        uint64_t first_packet_no; // UINT64_MAX if the slot is free
+        int data_count;
+        uint32_t symbol_size;
+        bool present[FEC_PARITY_MAX];
+        char* symbols[FEC_PARITY_MAX];
+    } parity[2];
+} fec_window_t;
+
+void fec_window_reset(fec_window_t* window);
+void fec_window_free(fec_window_t* window);
+
+// Keep a DATA packet, return false if it is too far ahead to be held.
+bool fec_window_store(fec_window_t* window,
+                      uint64_t packet_no,
+                      const char* packet,
+                      uint32_t packet_count);
+
+// Keep a parity packet of the block starting at first_packet_no. Return
+// false if it does not fit the blocks seen so far or is too far ahead.
+bool fec_window_store_parity(fec_window_t* window,
+                             uint64_t first_packet_no,
+                             int data_count,
+                             int parity_no,
+                             const char* parity,
+                             uint32_t parity_count);
+
+// Rebuild what is missing in the block of the next expected packet, if its
+// parity allows it. Return the number of packets rebuilt, -1 if they turn
+// out not to be valid.
+int fec_window_rebuild(fec_window_t* window);
+
+// Get the next expected packet if it is held, return false otherwise.
+bool fec_window_peek(fec_window_t* window,
+                     char** packet,
+                     uint32_t* packet_count);
+
+// Mark the next expected packet as released.
+void fec_window_advance(fec_window_t* window);
+
+#endif
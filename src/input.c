@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "input.h"
+
+typedef enum {
+    INPUT_BUFFERED,
+    INPUT_STREAM,
+    INPUT_MAPPED,
+} input_kind_t;
+
+struct input {
+    input_kind_t kind;
+    bool length_known;
+    uint64_t length;
+
+    // INPUT_BUFFERED, INPUT_MAPPED: the whole stream.
+    char* data;
+
+    // INPUT_MAPPED: the mapping, which starts at a page boundary before data.
+    char* map;
+    size_t map_length;
+    size_t page_size;
+    size_t readahead;
+    uint64_t advised; // bytes already hinted to be read ahead
+    uint64_t dropped; // bytes already dropped, up to a page boundary
+
+    // INPUT_STREAM: ring of chunks, chunk c lives in slot c % chunk_count.
+    int fd;
+    char* ring;
+    size_t chunk_size;
+    size_t chunk_count;
+    uint64_t filled;   // bytes read so far
+    uint64_t released; // bytes the sender no longer needs
+    bool eof;
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond_filled;
+    pthread_cond_t cond_released;
+};
+
+input_t* input_open_buffered(void) {
+    input_t* in;
+    ASSERT_MALLOC_OK(in = calloc(1, sizeof(*in)));
+    in->kind         = INPUT_BUFFERED;
+    in->length_known = true;
+    read_data_from_stdin(&in->data, &in->length);
+    debug("read %" PRIu64 " bytes from stdin", in->length);
+    return in;
+}
+
+// Release the lock of a reader cancelled while waiting for room in the ring.
+static void unlock(void* lock) {
+    ASSERT_ZERO(pthread_mutex_unlock(lock));
+}
+
+// Wait until the chunk's slot in the ring holds only released data.
+static void wait_for_slot(input_t* in, uint64_t chunk) {
+    ASSERT_ZERO(pthread_mutex_lock(&in->lock));
+    pthread_cleanup_push(unlock, &in->lock);
+    while (chunk >= in->released / in->chunk_size + in->chunk_count) {
+        ASSERT_ZERO(pthread_cond_wait(&in->cond_released, &in->lock));
+    }
+    pthread_cleanup_pop(1);
+}
+
+// Fill the ring with bulk reads, blocking while it holds only unreleased data.
+static void* stream_reader(void* arg) {
+    input_t* in  = arg;
+    bool eof     = false;
+    uint64_t pos = 0;
+
+    while (!eof) {
+        uint64_t chunk = pos / in->chunk_size;
+        size_t skip    = pos % in->chunk_size;
+
+        wait_for_slot(in, chunk);
+
+        char* dst     = in->ring + (chunk % in->chunk_count) * in->chunk_size;
+        ssize_t nread = read(in->fd, dst + skip, in->chunk_size - skip);
+        if (nread < 0 && errno == EINTR) continue;
+        ASSERT_SYS_OK(nread);
+
+        eof = nread == 0;
+        pos += nread;
+
+        // Publish every read, so sending starts before the chunk is full.
+        ASSERT_ZERO(pthread_mutex_lock(&in->lock));
+        in->filled = pos;
+        in->eof    = eof;
+        ASSERT_ZERO(pthread_cond_broadcast(&in->cond_filled));
+        ASSERT_ZERO(pthread_mutex_unlock(&in->lock));
+    }
+    debug("read %" PRIu64 " bytes from input stream", pos);
+    return NULL;
+}
+
+input_t* input_open_stream(int fd, size_t chunk_size, size_t chunk_count) {
+    input_t* in;
+    ASSERT_MALLOC_OK(in = calloc(1, sizeof(*in)));
+    in->kind        = INPUT_STREAM;
+    in->fd          = fd;
+    in->chunk_size  = chunk_size;
+    in->chunk_count = chunk_count;
+    ASSERT_MALLOC_OK(in->ring = malloc(chunk_size * chunk_count));
+
+    // The length of a regular file is known up front.
+    struct stat st;
+    ASSERT_SYS_OK(fstat(fd, &st));
+    if (S_ISREG(st.st_mode)) {
+        off_t pos;
+        ASSERT_SYS_OK(pos = lseek(fd, 0, SEEK_CUR));
+        in->length_known = true;
+        in->length       = st.st_size > pos ? (uint64_t)(st.st_size - pos) : 0;
+    }
+
+    ASSERT_ZERO(pthread_mutex_init(&in->lock, NULL));
+    ASSERT_ZERO(pthread_cond_init(&in->cond_filled, NULL));
+    ASSERT_ZERO(pthread_cond_init(&in->cond_released, NULL));
+    ASSERT_ZERO(pthread_create(&in->reader, NULL, stream_reader, in));
+
+    debug("streaming input in %zu chunks of %zu bytes",
+          chunk_count,
+          chunk_size);
+    return in;
+}
+
+bool input_mappable(int fd) {
+    struct stat st;
+    ASSERT_SYS_OK(fstat(fd, &st));
+    return S_ISREG(st.st_mode);
+}
+
+input_t* input_open_mapped(int fd, size_t readahead) {
+    input_t* in;
+    ASSERT_MALLOC_OK(in = calloc(1, sizeof(*in)));
+    in->kind         = INPUT_MAPPED;
+    in->length_known = true;
+    in->page_size    = (size_t)sysconf(_SC_PAGESIZE);
+    in->readahead    = readahead;
+
+    // Start from the current position, the descriptor may have been read.
+    struct stat st;
+    off_t pos;
+    ASSERT_SYS_OK(fstat(fd, &st));
+    ASSERT_SYS_OK(pos = lseek(fd, 0, SEEK_CUR));
+    if (st.st_size <= pos) {
+        debug("mapped empty input");
+        return in;
+    }
+
+    off_t map_start = pos - pos % (off_t)in->page_size;
+    in->length      = (uint64_t)(st.st_size - pos);
+    in->map_length  = (size_t)(st.st_size - map_start);
+
+    // Nothing is read here, pages are faulted in while sending.
+    void* map =
+        mmap(NULL, in->map_length, PROT_READ, MAP_PRIVATE, fd, map_start);
+    if (map == MAP_FAILED) {
+        syserr("mmap failed");
+    }
+    in->map  = map;
+    in->data = in->map + (pos - map_start);
+    ASSERT_SYS_OK(madvise(in->map, in->map_length, MADV_SEQUENTIAL));
+
+    debug("mapped %" PRIu64 " bytes of input", in->length);
+    return in;
+}
+
+// Page-aligned part of the mapping covering [from, to) of the stream.
+static void mapped_range(input_t* in,
+                         uint64_t from,
+                         uint64_t to,
+                         char** start,
+                         size_t* length) {
+    size_t first = (size_t)(in->data - in->map) + from;
+    size_t last  = (size_t)(in->data - in->map) + to;
+    first -= first % in->page_size;
+    *start  = in->map + first;
+    *length = last - first;
+}
+
+// Keep the kernel reading ahead of the sender.
+static void mapped_advise(input_t* in, uint64_t offset) {
+    if (in->advised >= in->length ||
+        offset + in->readahead / 2 < in->advised)
+        return;
+
+    uint64_t from = in->advised > offset ? in->advised : offset;
+    uint64_t to   = offset + in->readahead;
+    to            = to < in->length ? to : in->length;
+
+    char* start;
+    size_t length;
+    mapped_range(in, from, to, &start, &length);
+    ASSERT_SYS_OK(madvise(start, length, MADV_WILLNEED));
+    in->advised = to;
+}
+
+// Unmap pages the sender is done with, so resident memory stays flat. Only
+// those released since the last call are visited.
+static void mapped_drop(input_t* in, uint64_t offset) {
+    if (offset < in->dropped + in->readahead) return;
+
+    char* start;
+    size_t length;
+    mapped_range(in, in->dropped, offset, &start, &length);
+    length -= length % in->page_size;
+    if (length == 0) return;
+    ASSERT_SYS_OK(madvise(start, length, MADV_DONTNEED));
+    in->dropped = (uint64_t)(start + length - in->data);
+}
+
+bool input_length(input_t* in, uint64_t* length) {
+    if (in->length_known) *length = in->length;
+    return in->length_known;
+}
+
+size_t input_acquire(input_t* in,
+                     uint64_t offset,
+                     size_t max,
+                     const char** ptr) {
+    size_t got;
+
+    if (in->kind == INPUT_MAPPED) {
+        mapped_advise(in, offset);
+    }
+
+    if (in->kind == INPUT_BUFFERED || in->kind == INPUT_MAPPED) {
+        got  = offset < in->length ? in->length - offset : 0;
+        got  = got < max ? got : max;
+        *ptr = in->data + offset;
+        return got;
+    }
+
+    ASSERT_ZERO(pthread_mutex_lock(&in->lock));
+    while (!in->eof && in->filled <= offset) {
+        ASSERT_ZERO(pthread_cond_wait(&in->cond_filled, &in->lock));
+    }
+    uint64_t avail = in->filled > offset ? in->filled - offset : 0;
+    ASSERT_ZERO(pthread_mutex_unlock(&in->lock));
+
+    // A slice never wraps around the end of a chunk.
+    size_t skip = offset % in->chunk_size;
+    got         = in->chunk_size - skip;
+    got         = got < max ? got : max;
+    got         = got < avail ? got : avail;
+    size_t slot = offset / in->chunk_size % in->chunk_count;
+    *ptr        = in->ring + slot * in->chunk_size + skip;
+    return got;
+}
+
+bool input_ready(input_t* in, uint64_t offset) {
+    if (in->kind == INPUT_BUFFERED || in->kind == INPUT_MAPPED) return true;
+
+    ASSERT_ZERO(pthread_mutex_lock(&in->lock));
+    bool ready = in->eof || in->filled > offset;
+    ASSERT_ZERO(pthread_mutex_unlock(&in->lock));
+    return ready;
+}
+
+void input_release(input_t* in, uint64_t offset) {
+    if (in->kind == INPUT_BUFFERED) return;
+    if (in->kind == INPUT_MAPPED) {
+        if (in->map != NULL) mapped_drop(in, offset);
+        return;
+    }
+
+    ASSERT_ZERO(pthread_mutex_lock(&in->lock));
+    if (offset > in->released) {
+        in->released = offset;
+        ASSERT_ZERO(pthread_cond_signal(&in->cond_released));
+    }
+    ASSERT_ZERO(pthread_mutex_unlock(&in->lock));
+}
+
+void input_close(input_t* in) {
+    if (in->kind == INPUT_STREAM) {
+        // The reader may still be blocked on a full ring or in read(), where
+        // only cancelling it gets it out. It leaves the lock released.
+        ASSERT_ZERO(pthread_cancel(in->reader));
+        ASSERT_ZERO(pthread_join(in->reader, NULL));
+        ASSERT_ZERO(pthread_mutex_destroy(&in->lock));
+        ASSERT_ZERO(pthread_cond_destroy(&in->cond_filled));
+        ASSERT_ZERO(pthread_cond_destroy(&in->cond_released));
+        free(in->ring);
+    }
+    if (in->kind == INPUT_MAPPED) {
+        if (in->map != NULL) ASSERT_SYS_OK(munmap(in->map, in->map_length));
+    }
+    else {
+        free(in->data);
+    }
+    free(in);
+}
@@ -0,0 +1,51 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define STREAM_CHUNK_SIZE  (1 << 20)
+#define STREAM_CHUNK_COUNT 8
+
+/*
+    Source of the byte stream sent by the client.
+
+    Bytes are addressed by their absolute offset in the stream. A slice
+    returned by input_acquire() stays valid until input_release() is called
+    with an offset past its end, so the sender can keep unacknowledged data
+    around for retransmission.
+*/
+typedef struct input input_t;
+
+// Read the whole stdin into memory before anything is sent.
+input_t* input_open_buffered(void);
+
+// Read the descriptor in the background into a bounded ring of chunks.
+input_t* input_open_stream(int fd, size_t chunk_size, size_t chunk_count);
+
+// Map a regular file into memory, hinting the kernel to read ahead the
+// given number of bytes in front of the sender.
+input_t* input_open_mapped(int fd, size_t readahead);
+
+// Check if the descriptor can be memory-mapped.
+bool input_mappable(int fd);
+
+// Get the stream length, return false if it is not known in advance.
+bool input_length(input_t* in, uint64_t* length);
+
+// Get a slice of at most max bytes starting at offset, return 0 at EOF.
+size_t input_acquire(input_t* in,
+                     uint64_t offset,
+                     size_t max,
+                     const char** ptr);
+
+// Check if input_acquire() at offset returns without waiting for input.
+bool input_ready(input_t* in, uint64_t offset);
+
+// Allow all bytes before offset to be discarded.
+void input_release(input_t* in, uint64_t offset);
+
+void input_close(input_t* in);
+
+#endif
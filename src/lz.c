@@ -0,0 +1,220 @@
+#include <endian.h>
+#include <string.h>
+
+#include "lz.h"
+
+#define HASH_BITS  13
+#define MIN_MATCH  4
+#define MAX_OFFSET 65535
+
+// Bytes of a payload sampled to estimate its entropy.
+#define ENTROPY_SAMPLE 4096
+
+static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Write the rest of a length which did not fit its nibble.
+static uint8_t* put_length(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = (uint8_t)length;
+    return out;
+}
+
+// Read the rest of a length which did not fit its nibble.
+static bool get_length(const uint8_t** in,
+                       const uint8_t* in_end,
+                       size_t* length) {
+    uint8_t b;
+    do {
+        if (*in == in_end) return false;
+        b = *(*in)++;
+        *length += b;
+    } while (b == 255);
+    return true;
+}
+
+// Write a sequence, the last one if it has no match. Return NULL if it does
+// not fit.
+static uint8_t* put_sequence(uint8_t* out,
+                             const uint8_t* end,
+                             const uint8_t* literals,
+                             size_t literal_count,
+                             size_t offset,
+                             size_t match_count) {
+    size_t extra = match_count > 0 ? match_count - MIN_MATCH : 0;
+    size_t need  = 1 + literal_count / 255 + 1 + literal_count + 2 +
+                  extra / 255 + 1;
+    if ((size_t)(end - out) < need) return NULL;
+
+    *out++ = (uint8_t)((literal_count < 15 ? literal_count : 15) << 4 |
+                       (extra < 15 ? extra : 15));
+    if (literal_count >= 15) out = put_length(out, literal_count - 15);
+    memcpy(out, literals, literal_count);
+    out += literal_count;
+    if (match_count == 0) return out;
+
+    *out++ = (uint8_t)(offset & 0xff);
+    *out++ = (uint8_t)(offset >> 8);
+    if (extra >= 15) out = put_length(out, extra - 15);
+    return out;
+}
+
+size_t lz_compress(const char* src, size_t n, char* dst, size_t capacity) {
+    // Position + 1 of the last 4-byte string with a hash, 0 if none.
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t* in  = (const uint8_t*)src;
+    uint8_t* out       = (uint8_t*)dst;
+    const uint8_t* end = out + capacity;
+    size_t anchor      = 0; // first literal not written yet
+    size_t i           = 0;
+
+    while (n >= MIN_MATCH && i <= n - MIN_MATCH) {
+        uint32_t v       = read32(in + i);
+        uint32_t h       = hash(v);
+        size_t candidate = table[h];
+        table[h]         = (uint32_t)i + 1;
+        if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET ||
+            read32(in + candidate - 1) != v)
+        {
+            // Skip faster through data which does not match.
+            i += 1 + ((i - anchor) >> 6);
+            continue;
+        }
+
+        size_t match  = candidate - 1;
+        size_t length = MIN_MATCH;
+        while (i + length < n && in[match + length] == in[i + length]) {
+            length++;
+        }
+        out = put_sequence(
+            out, end, in + anchor, i - anchor, i - match, length);
+        if (out == NULL) return 0;
+        i += length;
+        anchor = i;
+    }
+
+    out = put_sequence(out, end, in + anchor, n - anchor, 0, 0);
+    return out == NULL ? 0 : (size_t)(out - (uint8_t*)dst);
+}
+
+bool lz_decompress(const char* src, size_t n, char* dst, size_t raw_count) {
+    const uint8_t* in     = (const uint8_t*)src;
+    const uint8_t* in_end = in + n;
+    uint8_t* out          = (uint8_t*)dst;
+    uint8_t* out_end      = out + raw_count;
+
+    while (in < in_end) {
+        uint8_t token        = *in++;
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !get_length(&in, in_end, &literal_count)) {
+            return false;
+        }
+        if (literal_count > (size_t)(in_end - in) ||
+            literal_count > (size_t)(out_end - out))
+            return false;
+        memcpy(out, in, literal_count);
+        in += literal_count;
+        out += literal_count;
+        if (in == in_end) break; // the last sequence has no match
+
+        if (in_end - in < 2) return false;
+        size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t match_count = token & 0x0f;
+        if (match_count == 15 && !get_length(&in, in_end, &match_count)) {
+            return false;
+        }
+        match_count += MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(out - (uint8_t*)dst) ||
+            match_count > (size_t)(out_end - out))
+            return false;
+
+        // An overlapping match repeats the bytes it copies.
+        const uint8_t* from = out - offset;
+        if (offset >= match_count) {
+            memcpy(out, from, match_count);
+        }
+        else {
+            for (size_t k = 0; k < match_count; k++) out[k] = from[k];
+        }
+        out += match_count;
+    }
+    return out == out_end;
+}
+
+// Estimate from a sample if a payload is worth compressing. Its collision
+// entropy, -log2 of the sum of squared byte frequencies, is a lower bound
+// on the Shannon entropy; above 7 bits per byte, as in compressed or
+// encrypted data, there is too little to gain.
+static bool worth_compressing(const uint8_t* raw, uint32_t raw_count) {
+    uint32_t counts[256] = {0};
+    uint32_t step        = raw_count / ENTROPY_SAMPLE + 1;
+    uint64_t sample      = 0;
+    for (uint32_t i = 0; i < raw_count; i += step) {
+        counts[raw[i]]++;
+        sample++;
+    }
+    uint64_t collisions = 0;
+    for (int b = 0; b < 256; b++) {
+        collisions += (uint64_t)counts[b] * counts[b];
+    }
+    return collisions * 128 > sample * sample;
+}
+
+uint32_t lz_frame_encode(const char* raw, uint32_t raw_count, char* frame) {
+    if (raw_count == 0) return 0;
+
+    frame_t header = {.method = FRAME_STORED, .raw_count = htobe32(raw_count)};
+    size_t count   = 0;
+    if (worth_compressing((const uint8_t*)raw, raw_count)) {
+        count = lz_compress(
+            raw, raw_count, frame + sizeof(header), raw_count - 1);
+    }
+    if (count > 0) {
+        header.method = FRAME_LZ;
+    }
+    else {
+        memcpy(frame + sizeof(header), raw, raw_count);
+        count = raw_count;
+    }
+    memcpy(frame, &header, sizeof(header));
+    return (uint32_t)(sizeof(header) + count);
+}
+
+bool lz_frame_decode(const char* frame,
+                     uint32_t frame_count,
+                     char* raw,
+                     uint32_t* raw_count) {
+    frame_t header;
+    if (frame_count < sizeof(header)) return false;
+    memcpy(&header, frame, sizeof(header));
+
+    uint32_t count      = be32toh(header.raw_count);
+    const char* data    = frame + sizeof(header);
+    uint32_t data_count = frame_count - sizeof(header);
+    if (count == 0 || count > MAX_PACKET_COUNT) return false;
+
+    if (header.method == FRAME_STORED) {
+        if (data_count != count) return false;
+        memcpy(raw, data, count);
+    }
+    else if (header.method != FRAME_LZ ||
+             !lz_decompress(data, data_count, raw, count))
+    {
+        return false;
+    }
+    *raw_count = count;
+    return true;
+}
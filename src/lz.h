@@ -0,0 +1,44 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+// Largest payload a frame carries, so that a stored one fits a DATA packet.
+#define LZ_RAW_MAX (MAX_PACKET_COUNT - sizeof(frame_t))
+
+/*
+    Byte-oriented LZ77 codec of compressed sessions, in the manner of LZ4.
+    The compressed data is a sequence of literal runs, each followed by a
+    match copied from up to 65535 bytes back, except the last one. A
+    sequence starts with a byte holding the literal length in its high
+    nibble and the match length minus 4 in the low one; a nibble of 15 is
+    continued by bytes added to it up to the first which is not 255. The
+    literals follow, then the match offset in 16 bits little endian.
+*/
+
+// Compress n bytes into at most capacity bytes, return the compressed
+// length, 0 if it does not fit.
+size_t lz_compress(const char* src, size_t n, char* dst, size_t capacity);
+
+// Decompress n bytes into exactly raw_count bytes, return false if the
+// data is not valid.
+bool lz_decompress(const char* src, size_t n, char* dst, size_t raw_count);
+
+// Encode a payload of at most LZ_RAW_MAX bytes as a frame, stored if an
+// entropy estimate or the result shows that compression does not pay off.
+// An empty payload stays empty. Return the frame length, at most
+// sizeof(frame_t) + raw_count.
+uint32_t lz_frame_encode(const char* raw, uint32_t raw_count, char* frame);
+
+// Decode a frame into the payload it carries, of at most MAX_PACKET_COUNT
+// bytes. Return false if the frame is not valid.
+bool lz_frame_decode(const char* frame,
+                     uint32_t frame_count,
+                     char* raw,
+                     uint32_t* raw_count);
+
+#endif
@@ -0,0 +1,65 @@
+#include <errno.h>
+#include <stdlib.h>
+
+#include "common.h"
+#include "pacer.h"
+
+static int64_t burst(const pacer_t* pacer) {
+    return (int64_t)(pacer->rate * PACING_BURST_US / 1000000);
+}
+
+// Add tokens for the time since the last update.
+static void refill(pacer_t* pacer, uint64_t now) {
+    if (now <= pacer->updated) return;
+    uint64_t elapsed = now - pacer->updated;
+    pacer->updated   = now;
+    if (pacer->rate == 0) return;
+
+    // Past the time to fill the bucket, the amount does not matter.
+    uint64_t fill_ns = (uint64_t)(burst(pacer) - pacer->tokens) * NS_PER_SEC /
+                       pacer->rate;
+    if (elapsed >= fill_ns) pacer->tokens = burst(pacer);
+    else pacer->tokens += (int64_t)(elapsed * pacer->rate / NS_PER_SEC);
+}
+
+void pacer_init(pacer_t* pacer, uint64_t rate, uint64_t now) {
+    pacer->rate    = rate;
+    pacer->tokens  = burst(pacer);
+    pacer->updated = now;
+}
+
+void pacer_set_rate(pacer_t* pacer, uint64_t rate, uint64_t now) {
+    refill(pacer, now);
+    pacer->rate = rate;
+    if (pacer->tokens > burst(pacer)) pacer->tokens = burst(pacer);
+}
+
+void pacer_consume(pacer_t* pacer, uint64_t bytes, uint64_t now) {
+    refill(pacer, now);
+    if (pacer->rate > 0) pacer->tokens -= (int64_t)bytes;
+}
+
+uint64_t pacer_ready_at(const pacer_t* pacer) {
+    if (pacer->rate == 0 || pacer->tokens > 0) return 0;
+    uint64_t debt = (uint64_t)(1 - pacer->tokens);
+    return pacer->updated + (debt * NS_PER_SEC + pacer->rate - 1) / pacer->rate;
+}
+
+uint64_t pacer_parse_rate(const char* string) {
+    char* end;
+    errno                   = 0;
+    unsigned long long bits = strtoull(string, &end, 10);
+    uint64_t unit           = 1;
+    switch (*end) {
+        case 'k': unit = 1000; end++; break;
+        case 'M': unit = 1000000; end++; break;
+        case 'G': unit = 1000000000; end++; break;
+    }
+    if (errno != 0 || end == string || *end != '\0' || bits == 0 ||
+        bits > UINT64_MAX / unit / 1000)
+    {
+        errno = 0;
+        return 0;
+    }
+    return (uint64_t)bits * unit / 8;
+}
@@ -0,0 +1,38 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Bytes a pacer lets through at once after being idle, in microseconds of
+// its rate. Waits are rounded to milliseconds, so this must cover one.
+#define PACING_BURST_US 2000
+
+/*
+    Token bucket spreading sends evenly over time at a given rate in bytes
+    per second. A send is allowed while the bucket is not empty and may
+    overdraw it; the next one waits until the debt is paid off. After an
+    idle period, at most PACING_BURST_US worth of bytes go out at once.
+*/
+typedef struct {
+    uint64_t rate;    // bytes per second, 0 if unlimited
+    int64_t tokens;   // bytes that may be sent, negative if overdrawn
+    uint64_t updated; // time tokens were last added
+} pacer_t;
+
+void pacer_init(pacer_t* pacer, uint64_t rate, uint64_t now);
+
+// Change the rate, 0 for unlimited.
+void pacer_set_rate(pacer_t* pacer, uint64_t rate, uint64_t now);
+
+// Account for bytes sent now.
+void pacer_consume(pacer_t* pacer, uint64_t bytes, uint64_t now);
+
+// Get the earliest time of the next send.
+uint64_t pacer_ready_at(const pacer_t* pacer);
+
+// Parse a rate in bits per second with an optional k, M or G suffix, return
+// it in bytes per second or 0 if it is not valid.
+uint64_t pacer_parse_rate(const char* string);
+
+#endif
@@ -1,37 +1,462 @@
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <linux/sockios.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <time.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "compress.h"
+#include "crc32c.h"
 #include "err.h"
+#include "input.h"
+#include "pacer.h"
 #include "protconst.h"
 #include "protocol.h"
+#include "sender.h"
+#include "sizing.h"
+#include "zerocopy.h"
+
+// Bytes of a mapped input to read ahead, in packets of the largest size.
+#define READAHEAD_PACKETS 32
+
+// Default number of DATA packets in flight in udpw mode.
+#define WINDOW_DEFAULT 32
+
+// Default block of the udpf mode: DATA packets, and parity packets after them.
+#define FEC_DATA_DEFAULT   16
+#define FEC_PARITY_DEFAULT 2
+
+// Most bytes sent with MSG_ZEROCOPY the kernel may still read from the input,
+// half of what a stream input holds.
+#define ZEROCOPY_PENDING_MAX (STREAM_CHUNK_COUNT / 2 * STREAM_CHUNK_SIZE)
+
+// DATA packets queued to be sent with one system call in udp and udpw modes.
+static batch_t* data_batch;
+
+// TCP connection of the session, one of several in a striped session.
+typedef struct {
+    int fd;
+    batch_t* batch;
+    uint64_t oldest; // stream offset of the first DATA queued, if any
+    int backlog;     // bytes in the socket send queue at the last flush
+} stripe_t;
+
+// The first connection is the one CONN was sent on, with data_batch.
+static stripe_t stripes[STRIPES_MAX];
+static int stripe_count;
+
+// DATA packets queued on all connections since they were last flushed.
+static int stripes_queued;
+
+// Client side of the session in UDP modes.
+static sender_t sender;
+
+// Policy choosing the size of DATA payloads.
+static sizing_t sizing = {.kind = SIZING_RANDOM};
+
+// Completions of zero-copy sends, NULL unless enabled with -z.
+static zerocopy_t* zerocopy;
+
+// Offset before which the sender no longer needs the input.
+static uint64_t releasable;
+
+// Frames of the payloads once the server agreed to compression, else NULL.
+static compressor_t* compressor;
+
+// CRC32C of the byte stream sent so far, once the server agreed to
+// checksums.
+static bool checksumming;
+static uint32_t stream_crc;
+
+static void usage(const char* name) {
+    fatal("usage: %s [-s] [-g] [-z] [-c] [-i] [-p random|fixed[:size]|pmtu] "
+          "[-f path] [-l length] [-w window] [-r rate] [-e data:parity] "
+          "[-n connections] [-t transfer] <protocol> <host> <port>",
+          name);
+}
+
+// Get the next DATA payload, carrying stream_count bytes of the stream. The
+// end of an open-ended stream is marked by an empty payload, otherwise the
+// input must not end before 'left' reaches zero.
+static bool next_packet(input_t* input,
+                        uint64_t sent,
+                        uint64_t left,
+                        bool open_ended,
+                        const char** packet,
+                        uint32_t* packet_count,
+                        uint32_t* stream_count) {
+    const char* stream;
+    if (compressor != NULL) {
+        compressor_next(
+            compressor, packet, packet_count, &stream, stream_count);
+    }
+    else {
+        uint32_t size = sizing_next(&sizing, left);
+        *packet_count = input_acquire(input, sent, size, packet);
+        *stream_count = *packet_count;
+        stream        = *packet;
+    }
+    if (*stream_count == 0 && !open_ended) {
+        error("input ended after %" PRIu64 " bytes, %" PRIu64 " missing",
+              sent,
+              left);
+        return false;
+    }
+    if (checksumming) stream_crc = crc32c(stream_crc, stream, *stream_count);
+    return true;
+}
+
+// Set up sending count bytes from offset on, with the features the server
+// agreed to in CONACC. The input before the offset the server resumes the
+// transfer at is skipped.
+static void use_features(input_t* input,
+                         uint64_t offset,
+                         uint64_t count,
+                         bool compressed,
+                         bool checked) {
+    // The checksum makes DATA headers longer.
+    if (checked) sizing_reserve(&sizing, sizeof(uint32_t));
+    checksumming = checked;
+    if (compressed) {
+        compressor = compressor_open(input, &sizing, offset, count);
+    }
+    if (offset > 0) {
+        debug("resuming the transfer at offset %" PRIu64, offset);
+        releasable = offset;
+        input_release(input, offset);
+    }
+}
+
+// Compare the checksum of the byte stream the server output, from RCVD,
+// with the one of the stream sent.
+static bool check_stream(uint32_t output_crc) {
+    if (!checksumming || output_crc == stream_crc) return true;
+    error("byte stream checksum mismatch (sent %08" PRIx32
+          ", server output %08" PRIx32 ")",
+          stream_crc,
+          output_crc);
+    return false;
+}
+
+// Release the input before offset, but not the part zero-copy sends may still
+// be reading.
+static void release_input(input_t* input, uint64_t offset) {
+    if (offset > releasable) releasable = offset;
+    if (compressor != NULL) compressor_release(compressor, releasable);
+    if (zerocopy == NULL) {
+        input_release(input, releasable);
+        return;
+    }
+    uint64_t done = zerocopy_reap(zerocopy, ZEROCOPY_PENDING_MAX);
+    input_release(input, done < releasable ? done : releasable);
+}
+
+// Send the queued DATA packets, with the stream sent up to offset end.
+static bool flush_input(int socket_fd, uint8_t protocol_id, uint64_t end) {
+    if (!flush_DATA(socket_fd, protocol_id, data_batch)) return false;
+    if (zerocopy != NULL) {
+        zerocopy_sent(zerocopy, batch_zerocopy_sends(data_batch), end);
+        zerocopy_wait(zerocopy, batch_zerocopy_reuse(data_batch));
+    }
+    return true;
+}
+
+// Open the other connections of a striped session and join them to it.
+static bool open_stripes(int count,
+                         const tcp_session_t* session,
+                         struct sockaddr_in* server_address) {
+    while (stripe_count < count) {
+        stripe_t* stripe = &stripes[stripe_count++];
+        stripe->fd       = tcp_connect_to_server(server_address);
+        stripe->oldest   = UINT64_MAX;
+        stripe->backlog  = 0;
+        ASSERT_MALLOC_OK(stripe->batch = batch_new(0));
+        tcp_session_t joined = *session;
+        if (!send_CONN_stripe(stripe->fd, &joined) ||
+            !recv_CONACC(stripe->fd, &joined))
+            return false;
+    }
+    debug("sending over %d connections", stripe_count);
+    return true;
+}
+
+static void close_stripes(struct sockaddr_in* server_address) {
+    for (int i = 1; i < stripe_count; i++) {
+        tcp_disconnect(stripes[i].fd, server_address);
+        batch_free(stripes[i].batch);
+    }
+}
+
+// Get the connection with the fewest bytes waiting to be delivered.
+static stripe_t* least_backlogged(void) {
+    stripe_t* best     = &stripes[0];
+    uint64_t best_wait = (uint64_t)best->backlog + batch_bytes(best->batch);
+    for (int i = 1; i < stripe_count; i++) {
+        uint64_t wait =
+            (uint64_t)stripes[i].backlog + batch_bytes(stripes[i].batch);
+        if (wait < best_wait) {
+            best      = &stripes[i];
+            best_wait = wait;
+        }
+    }
+    return best;
+}
+
+// Check if the DATA queued on the connections must be sent. Their total is
+// bounded as well, by what the compressor lets the sender hold.
+static bool must_flush_stripes(const stripe_t* stripe) {
+    return must_flush_DATA(stripe->batch) || stripes_queued == BATCH_MAX;
+}
+
+// Send the DATA queued on all connections, with the stream sent up to
+// offset end. The connection queued on first goes first: the server does
+// not read a connection too far ahead of the stream it released, so it
+// must not wait for data still queued here while this waits for it.
+static bool flush_stripes(uint64_t end) {
+    stripes_queued = 0;
+    if (stripe_count == 1) {
+        stripes[0].oldest = UINT64_MAX;
+        return flush_input(stripes[0].fd, TCP_ID, end);
+    }
+    while (true) {
+        stripe_t* first = NULL;
+        for (int i = 0; i < stripe_count; i++) {
+            if (stripes[i].oldest != UINT64_MAX &&
+                (first == NULL || stripes[i].oldest < first->oldest))
+                first = &stripes[i];
+        }
+        if (first == NULL) break;
+        if (!flush_DATA(first->fd, TCP_ID, first->batch)) return false;
+        first->oldest = UINT64_MAX;
+    }
+    for (int i = 0; i < stripe_count; i++) {
+        ASSERT_SYS_OK(ioctl(stripes[i].fd, SIOCOUTQ, &stripes[i].backlog));
+    }
+    return true;
+}
+
+// Enable zero-copy sends on a connected socket if they were asked for.
+static void open_zerocopy(int socket_fd, bool enable) {
+    if (!enable) return;
+    zerocopy = zerocopy_open(socket_fd);
+    if (zerocopy == NULL) {
+        error("zero-copy sends not supported, copying instead");
+    }
+    if (!batch_set_zerocopy(data_batch, zerocopy != NULL)) {
+        fatal("memory allocation failed");
+    }
+}
+
+// Send what the sender emitted. DATA and PAR are queued, CONN is sent at
+// once.
+static bool emit(int socket_fd,
+                 send_t* sends,
+                 int send_count,
+                 struct sockaddr_in* server_address) {
+    for (int i = 0; i < send_count; i++) {
+        send_t* send    = &sends[i];
+        uint8_t type_id = send->header.data.type_id;
+        if (type_id != DATA_ID && type_id != PAR_ID) {
+            if (!udp_sendto(
+                    socket_fd, &send->header, send->length, server_address))
+                return false;
+            continue;
+        }
+        if (must_flush_DATA(data_batch) &&
+            !flush_input(
+                socket_fd, sender.protocol_id, sender.offset + sender.pushed))
+            return false;
+        batch_add(data_batch,
+                  &send->header,
+                  send->length,
+                  send->payload,
+                  send->payload_count,
+                  server_address);
+    }
+    // The parity buffers are reused by the next block.
+    if (send_count > 0 && sends[send_count - 1].header.par.type_id == PAR_ID) {
+        return flush_input(
+            socket_fd, sender.protocol_id, sender.offset + sender.pushed);
+    }
+    return true;
+}
+
+// Send the byte stream over UDP. The sender decides what to send, this loop
+// feeds it the input, packets from the server and expired deadlines.
+static bool send_stream(int socket_fd,
+                        input_t* input,
+                        uint8_t protocol_id,
+                        uint64_t input_size,
+                        bool open_ended,
+                        uint8_t features,
+                        uint64_t transfer_id,
+                        int window_size,
+                        uint64_t rate_limit,
+                        fec_params_t fec,
+                        struct sockaddr_in* server_address) {
+    send_t sends[MAX_SENDS];
+    int send_count;
+    // One byte more than the longest packet, so longer ones get noticed.
+    char buf[sizeof(sack_t) + 1];
+    struct sockaddr_in address;
+
+    const char* packet;
+    uint32_t packet_count;
+    uint32_t stream_count;
+    bool agreed = false;
+
+    sender_open(&sender,
+                protocol_id,
+                features,
+                generate_random_uint64(),
+                transfer_id,
+                input_size,
+                window_size,
+                rate_limit,
+                fec,
+                monotonic_ns(),
+                sends,
+                &send_count);
+    if (!emit(socket_fd, sends, send_count, server_address))
+        return false;
+
+    while (sender.state != SENDER_DONE && sender.state != SENDER_FAILED) {
+        if (!agreed && sender.state != SENDER_CONNECTING) {
+            agreed = true;
+            use_features(input,
+                         sender.offset,
+                         sender.left,
+                         sender.features & FEATURE_LZ,
+                         sender.features & FEATURE_CRC);
+        }
+        while (sender_can_push(&sender, monotonic_ns())) {
+            if (!next_packet(input,
+                             sender.offset + sender.pushed,
+                             sender.left,
+                             open_ended,
+                             &packet,
+                             &packet_count,
+                             &stream_count))
+                return false;
+            sender_push(&sender,
+                        packet,
+                        packet_count,
+                        stream_count,
+                        monotonic_ns(),
+                        sends,
+                        &send_count);
+            if (!emit(socket_fd, sends, send_count, server_address))
+                return false;
+            // Handle what the server sent between batches, so that its first
+            // window is heard even if an earlier WND got lost.
+            if (must_flush_DATA(data_batch)) break;
+        }
+        if (!flush_input(
+                socket_fd, sender.protocol_id, sender.offset + sender.pushed))
+            return false;
+        release_input(input, sender.offset + sender.released);
+
+        uint64_t now      = monotonic_ns();
+        uint64_t deadline = sender_deadline(&sender);
+        int wait_ms       = deadline == UINT64_MAX ? -1
+                            : deadline > now
+                                ? (int)((deadline - now + 999999) / 1000000)
+                                : 0;
+        if (!socket_wait(socket_fd, wait_ms)) {
+            sender_on_timer(&sender, monotonic_ns(), sends, &send_count);
+        }
+        else {
+            size_t length = sizeof(buf);
+            if (!udp_recvfrom(socket_fd, buf, &length, &address)) return false;
+            sender_on_packet(
+                &sender, buf, length, monotonic_ns(), sends, &send_count);
+        }
+        if (!emit(socket_fd, sends, send_count, server_address))
+            return false;
+    }
+    return sender.state == SENDER_DONE && check_stream(sender.stream_crc);
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 4) {
-        fatal("usage: %s <protocol> <host> <port>", argv[0]);
+    bool stream            = false;
+    bool declared          = false;
+    uint64_t declared_size = 0;
+    const char* path       = NULL;
+    int window_size        = WINDOW_DEFAULT;
+    bool segment           = false;
+    bool sized             = false;
+    bool zerocopy_enabled  = false;
+    bool compress          = false;
+    bool checksum          = false;
+    int stripes_asked      = 1;
+    bool resume            = false;
+    uint64_t transfer_id   = 0;
+    uint64_t rate_limit    = 0;
+    fec_params_t fec       = {FEC_DATA_DEFAULT, FEC_PARITY_DEFAULT};
+
+    int opt;
+    while ((opt = getopt(argc, argv, "sgzcip:f:l:w:r:e:n:t:")) != -1) {
+        switch (opt) {
+            case 'g': segment = true; break;
+            case 'z': zerocopy_enabled = true; break;
+            case 'c': compress = true; break;
+            case 'i': checksum = true; break;
+            case 'p':
+                sized = true;
+                if (!sizing_parse(optarg, &sizing)) usage(argv[0]);
+                break;
+            case 'w': window_size = read_number(optarg, 1, WINDOW_MAX); break;
+            case 'r':
+                rate_limit = pacer_parse_rate(optarg);
+                if (rate_limit == 0) usage(argv[0]);
+                break;
+            case 'e':
+                if (!fec_parse_params(optarg, &fec)) usage(argv[0]);
+                break;
+            case 'n':
+                stripes_asked = (int)read_number(optarg, 1, STRIPES_MAX);
+                break;
+            case 't':
+                resume      = true;
+                transfer_id = read_number(optarg, 0, UINT64_MAX);
+                break;
+            case 's': stream = true; break;
+            case 'f': path = optarg; break;
+            case 'l':
+                declared      = true;
+                declared_size = read_number(optarg, 0, UNKNOWN_COUNT - 1);
+                break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 3) {
+        usage(argv[0]);
     }
 
     int socket_fd;
-    struct sockaddr_in server_address, old_server_address;
+    struct sockaddr_in server_address;
 
-    char* input;
+    input_t* input;
     uint64_t input_size;
+    bool open_ended;
     bool success = false;
     bool stop    = false;
 
-    uint16_t generated_count;
+    const char* packet;
+    uint32_t packet_count;
+    uint32_t stream_count;
     uint64_t left;
     uint64_t sent;
     uint64_t current_packet_no;
-
-    time_t start;
+    uint32_t output_crc;
+    stripe_t* stripe;
 
     // Ignore the SIGPIPE signal (handled in write).
     signal(SIGPIPE, SIG_IGN);
@@ -39,130 +464,184 @@ int main(int argc, char* argv[]) {
     // Initialize the random number generator.
     srand_init();
 
-    // Read data from standard input (of arbitrary length).
-    read_data_from_stdin(&input, &input_size);
+    // Read the file in place of standard input.
+    if (path != NULL) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) syserr("cannot open %s", path);
+        ASSERT_SYS_OK(dup2(fd, STDIN_FILENO));
+        ASSERT_SYS_OK(close(fd));
+    }
+
+    // Map a regular file, otherwise read data from standard input, either
+    // whole up front or in the background while sending.
+    if (input_mappable(STDIN_FILENO)) {
+        input = input_open_mapped(STDIN_FILENO,
+                                  READAHEAD_PACKETS * MAX_PACKET_COUNT);
+    }
+    else if (stream) {
+        input = input_open_stream(
+            STDIN_FILENO, STREAM_CHUNK_SIZE, STREAM_CHUNK_COUNT);
+    }
+    else {
+        input = input_open_buffered();
+    }
+
+    // Declared length takes precedence over the one known from the input.
+    if (declared) {
+        input_size = declared_size;
+    }
+    else if (!input_length(input, &input_size)) {
+        input_size = UNKNOWN_COUNT;
+    }
+    open_ended = input_size == UNKNOWN_COUNT;
+
+    // Only equal-sized packets can be segmented by the kernel.
+    if (segment && !sized) sizing_parse("fixed", &sizing);
 
     // Parse the arguments
-    uint8_t protocol_id = parse_protocol(argv[1]);
-    const char* host    = argv[2];
-    uint16_t port       = read_port(argv[3]);
+    uint8_t protocol_id = parse_protocol(argv[optind]);
+    const char* host    = argv[optind + 1];
+    uint16_t port       = read_port(argv[optind + 2]);
 
     // Prepare the server address structure.
     server_address = get_server_address(host, port);
 
+    if (stripes_asked > 1 && protocol_id != TCP_ID) {
+        error("striping supported in tcp mode only, using one connection");
+        stripes_asked = 1;
+    }
+    uint8_t features = (compress ? FEATURE_LZ : 0) |
+                       (checksum ? FEATURE_CRC : 0) |
+                       (stripes_asked > 1 ? FEATURE_STRIPE : 0) |
+                       (resume ? FEATURE_RESUME : 0);
+
+    // Frames are sent from buffers reused once the server got them.
+    if (compress && zerocopy_enabled) {
+        error("zero-copy sends not supported with compression, copying "
+              "instead");
+        zerocopy_enabled = false;
+    }
+
+    // Completions of zero-copy sends are tracked for one socket.
+    if (stripes_asked > 1 && zerocopy_enabled) {
+        error("zero-copy sends not supported over several connections, "
+              "copying instead");
+        zerocopy_enabled = false;
+    }
+
+    ASSERT_MALLOC_OK(data_batch = batch_new(0));
+    batch_set_segmentation(data_batch, segment);
+
     if (protocol_id == TCP_ID) {
-        socket_fd = tcp_connect_to_server(&server_address);
+        socket_fd    = tcp_connect_to_server(&server_address);
+        stripes[0]   = (stripe_t){socket_fd, data_batch, UINT64_MAX, 0};
+        stripe_count = 1;
+        sizing_prepare(&sizing, socket_fd, false);
+        open_zerocopy(socket_fd, zerocopy_enabled);
+
+        tcp_session_t session = {
+            .transfer_id    = transfer_id,
+            .total_count    = input_size,
+            .asked_features = features & FEATURE_MASK,
+        };
 
         // Dummy loop, "break" will prematurely close the connection.
         do {
-            if (!send_CONN(socket_fd, input_size, NULL)) break;
-            if (!recv_CONACC(socket_fd, NULL)) break;
+            if (!send_CONN(socket_fd, &session)) break;
+            if (!recv_CONACC(socket_fd, &session)) break;
+            if (!open_ended && session.offset > input_size) {
+                error("server resumes past the end (offset=%" PRIu64 ")",
+                      session.offset);
+                break;
+            }
+            left = open_ended ? input_size : input_size - session.offset;
+            sent = session.offset;
+            use_features(input,
+                         sent,
+                         left,
+                         session.features & FEATURE_LZ,
+                         session.features & FEATURE_CRC);
+            bool striped = session.features & FEATURE_STRIPE;
+            if (striped &&
+                !open_stripes(stripes_asked, &session, &server_address))
+                break;
 
-            left              = input_size;
-            sent              = 0;
             current_packet_no = START_NO;
             while (left > 0) {
-                generated_count = generate_packet_count(left);
-                if (!send_DATA(socket_fd,
-                               current_packet_no,
-                               generated_count,
-                               input + sent,
-                               NULL))
+                if (!next_packet(input,
+                                 sent,
+                                 left,
+                                 open_ended,
+                                 &packet,
+                                 &packet_count,
+                                 &stream_count))
+                    break;
+                // Frames are coalesced and released once they are written.
+                // DATA of a striped session is numbered by stream offset.
+                stripe = least_backlogged();
+                if (!queue_DATA(stripe->fd,
+                                &session,
+                                stripe->batch,
+                                striped ? sent : current_packet_no,
+                                packet_count,
+                                packet))
                     break;
-                left -= generated_count;
-                sent += generated_count;
+                if (stripe->oldest == UINT64_MAX) stripe->oldest = sent;
+                stripes_queued++;
+                left = packet_count == 0 ? 0 : left - stream_count;
+                sent += stream_count;
                 current_packet_no++;
+                if (left == 0 || must_flush_stripes(stripe)) {
+                    stop = !flush_stripes(sent);
+                    if (stop) break;
+                    release_input(input, sent);
+                }
             }
-            if (left > 0) break; // sending loop failed
-            debug("sent %" PRIu64 " bytes", input_size);
-            if (!recv_RCVD(socket_fd, NULL)) break;
+            if (stop || left > 0) break; // sending loop failed
+            debug("sent %" PRIu64 " bytes", sent);
+            if (!recv_RCVD(socket_fd, &session, &output_crc)) break;
+            if (!check_stream(output_crc)) break;
             success = true;
         } while (0);
+        close_stripes(&server_address);
+        zerocopy_close(zerocopy);
         tcp_disconnect(socket_fd, &server_address);
     }
-    else if (protocol_id == UDP_ID || protocol_id == UDPR_ID) {
-        do {
-            socket_fd = udp_connect_to_server(&server_address);
-
-            old_server_address = server_address;
-
-            if (!send_CONN(socket_fd, input_size, &server_address)) break;
-            start = time(NULL);
-            while (!stop && !recv_CONACC(socket_fd, &server_address)) {
-                if (time(NULL) - start >= MAX_WAIT) current_error = ERRTIMEOUT;
-                // in case of foreign server
-                server_address = old_server_address;
-                if (current_error == ERRTIMEOUT) {
-                    if (udpr &&
-                        retransmit_CONN(socket_fd, input_size, &server_address))
-                        break;
-                    else stop = true;
-                }
-                else if (current_error != ERRSESSION) {
-                    stop = true;
-                }
-            }
-            if (stop) break;
+    else if (protocol_id == UDP_ID || protocol_id == UDPR_ID ||
+             protocol_id == UDPW_ID || protocol_id == UDPF_ID)
+    {
+        // Parity is sent from buffers rewritten for every block.
+        if (protocol_id == UDPF_ID && zerocopy_enabled) {
+            error("zero-copy sends not supported in udpf mode, copying "
+                  "instead");
+            zerocopy_enabled = false;
+        }
+        socket_fd = udp_connect_to_server(&server_address);
+        sizing_prepare(&sizing, socket_fd, true);
+        open_zerocopy(socket_fd, zerocopy_enabled);
+        if (rate_limit > 0) socket_set_pacing_rate(socket_fd, rate_limit);
 
-            left              = input_size;
-            sent              = 0;
-            current_packet_no = START_NO;
-            while (left > 0) {
-                generated_count = generate_packet_count(left);
-                if (!send_DATA(socket_fd,
-                               current_packet_no,
-                               generated_count,
-                               input + sent,
-                               &server_address))
-                    break;
-                start = time(NULL);
-                while (udpr && !stop &&
-                       !recv_ACC(socket_fd, current_packet_no, &server_address))
-                {
-                    if (time(NULL) - start >= MAX_WAIT)
-                        current_error = ERRTIMEOUT;
-                    // in case of foreign server
-                    server_address = old_server_address;
-                    if (current_error == ERRTIMEOUT) {
-                        if (udpr && retransmit_DATA(socket_fd,
-                                                    current_packet_no,
-                                                    generated_count,
-                                                    input + sent,
-                                                    &server_address))
-                            break;
-                        else stop = true;
-                    }
-                    else if (current_error != ERRSESSION &&
-                             current_error != ERROLD)
-                    {
-                        stop = true;
-                    }
-                }
-                if (stop) break;
-                left -= generated_count;
-                sent += generated_count;
-                current_packet_no++;
-            }
-            if (stop || left > 0) break; // sending loop failed
-            debug("sent %" PRIu64 " bytes", input_size);
-            start = time(NULL);
-            while (!stop && !recv_RCVD(socket_fd, &server_address)) {
-                if (time(NULL) - start >= MAX_WAIT) current_error = ERRTIMEOUT;
-                // in case of foreign server
-                server_address = old_server_address;
-                if (current_error != ERRSESSION && current_error != ERROLD) {
-                    stop = true;
-                }
-            }
-            if (stop) break;
-            success = true;
-        } while (0);
+        success = send_stream(socket_fd,
+                              input,
+                              protocol_id,
+                              input_size,
+                              open_ended,
+                              features,
+                              transfer_id,
+                              window_size,
+                              rate_limit,
+                              fec,
+                              &server_address);
+        sender_close(&sender);
+        zerocopy_close(zerocopy);
     }
     else {
-        error("invalid client protocol: %s", argv[1]);
+        error("invalid client protocol: %s", argv[optind]);
     }
 
-    free(input);
+    compressor_close(compressor);
+    batch_free(data_batch);
+    input_close(input);
 
     return success ? 0 : 1;
 }
@@ -1,34 +1,70 @@
 #include <arpa/inet.h>
-#include <errno.h>
-#include <inttypes.h>
 #include <signal.h>
 #include <stdbool.h>
-#include <string.h>
-#include <time.h>
 #include <unistd.h>
 
 #include "common.h"
 #include "err.h"
 #include "protconst.h"
 #include "protocol.h"
+#include "server.h"
+#include "splice_output.h"
+#include "uring.h"
+#include "writer.h"
+
+// Default acknowledgment policy of the udpw mode: acknowledge every second
+// DATA packet received in order, or the first one after ACK_DELAY_DEFAULT
+// milliseconds without another.
+#define ACK_EVERY_DEFAULT 2
+#define ACK_DELAY_DEFAULT 2
+
+// Upper bound on the worker threads of a sharded server.
+#define MAX_WORKERS 1024
+
+static uint64_t ack_every = ACK_EVERY_DEFAULT;
+static uint64_t ack_delay = ACK_DELAY_DEFAULT;
+
+static void usage(const char* name) {
+    fatal("usage: %s [-k packets] [-d delay_ms] "
+          "[-o dir [-j workers] | -u | -a ring_kb] [-v] <protocol> <port>",
+          name);
+}
 
 int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fatal("usage: %s <protocol> <port>", argv[0]);
+    bool verbose           = false;
+    const char* output_dir = NULL;
+    int worker_count       = 1;
+    bool use_uring         = false;
+    size_t ring_kb         = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "k:d:o:j:ua:v")) != -1) {
+        switch (opt) {
+            case 'k': ack_every = read_number(optarg, 1, WINDOW_MAX); break;
+            case 'd':
+                ack_delay = read_number(optarg, 0, MAX_WAIT * 1000);
+                break;
+            case 'o': output_dir = optarg; break;
+            case 'j':
+                worker_count = (int)read_number(optarg, 1, MAX_WORKERS);
+                break;
+            case 'u': use_uring = true; break;
+            case 'a':
+                ring_kb = read_number(
+                    optarg, WRITER_RING_MIN_KB, WRITER_RING_MAX_KB);
+                break;
+            case 'v': verbose = true; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (argc - optind != 2 || (worker_count > 1 && output_dir == NULL) ||
+        (use_uring && output_dir != NULL) ||
+        (ring_kb > 0 && (use_uring || output_dir != NULL)))
+    {
+        usage(argv[0]);
     }
 
-    uint64_t current_total_count;
-
-    struct sockaddr_in server_address, client_address, old_client_address;
-    int socket_fd, client_fd;
-
-    bool stop;
-    uint64_t left;
-    uint64_t expected_packet_no;
-    uint32_t recv_packet_count;
-    char* packet;
-
-    time_t start;
+    struct sockaddr_in server_address;
 
     // Ignore the SIGPIPE signal (handled in write).
     signal(SIGPIPE, SIG_IGN);
@@ -37,155 +73,66 @@ int main(int argc, char* argv[]) {
     srand_init();
 
     // Parse the arguments.
-    uint8_t protocol_id = parse_protocol(argv[1]);
-    uint16_t port       = read_port(argv[2]);
+    uint8_t protocol_id = parse_protocol(argv[optind]);
+    uint16_t port       = read_port(argv[optind + 1]);
+
+    if (protocol_id != TCP_ID && protocol_id != UDP_ID) {
+        fatal("invalid server protocol: %s", argv[optind]);
+    }
 
     // Prepare the server address structure.
     server_address.sin_family      = AF_INET;           // IPv4
     server_address.sin_addr.s_addr = htonl(INADDR_ANY); // all interfaces
     server_address.sin_port        = htons(port);       // port provided
 
-    if (protocol_id == TCP_ID) {
-        socket_fd = tcp_listen(&server_address);
-        while (1) {
-            client_fd = tcp_accept(socket_fd, &client_address);
-
-            // Dummy loop, "break" will prematurely close the connection.
-            do {
-                if (!recv_CONN(client_fd, &current_total_count, NULL)) break;
-                if (!send_CONACC(client_fd, NULL)) break;
-
-                left               = current_total_count;
-                expected_packet_no = START_NO;
-                while (left > 0) {
-                    if (!recv_DATA(client_fd,
-                                   expected_packet_no,
-                                   &recv_packet_count,
-                                   &packet,
-                                   NULL))
-                    {
-                        if (current_error != ERRTIMEOUT &&
-                            current_error != ERRIO)
-                            send_RJT(client_fd, expected_packet_no, NULL);
-                        break;
-                    }
-                    print_packet(packet, recv_packet_count);
-                    left -= recv_packet_count;
-                    expected_packet_no++;
-                }
-                if (left > 0) break; // receiving loop failed
-                if (!send_RCVD(client_fd, NULL)) break;
-                debug("received %" PRIu64 " bytes", current_total_count);
-            } while (0);
-            tcp_disconnect(client_fd, &client_address);
-        }
-        ASSERT_SYS_OK(close(socket_fd));
-        debug("stopped listening on port %" PRIu16,
-              ntohs(server_address.sin_port));
+    // Fall back to plain system calls if io_uring is not available.
+    if (use_uring && !uring_init()) {
+        error("io_uring unavailable, using the default I/O path");
     }
-    else if (protocol_id == UDP_ID) {
-        socket_fd = udp_listen(&server_address);
-        while (1) {
-            // Dummy loop, "break" will prematurely stop serving the client.
-            do {
-                if (!recv_CONN(socket_fd,
-                               &current_total_count,
-                               &client_address))
-                    break;
-                socket_set_timeout(socket_fd);
-                if (!send_CONACC(socket_fd, &client_address)) break;
-
-                old_client_address = client_address;
-                stop               = false;
-                left               = current_total_count;
-                expected_packet_no = START_NO;
-
-                while (left > 0) {
-                    start = time(NULL);
-                    while (!stop && !recv_DATA(socket_fd,
-                                               expected_packet_no,
-                                               &recv_packet_count,
-                                               &packet,
-                                               &client_address))
-                    {
-                        if (time(NULL) - start >= MAX_WAIT)
-                            current_error = ERRTIMEOUT;
-                        if (current_error == ERRTIMEOUT) {
-                            if (expected_packet_no == START_NO) {
-                                if (udpr &&
-                                    retransmit_CONACC(socket_fd,
-                                                      &client_address,
-                                                      expected_packet_no,
-                                                      &recv_packet_count,
-                                                      &packet))
-                                    break;
-                                else stop = true;
-                            }
-                            else {
-                                if (udpr &&
-                                    retransmit_ACC(socket_fd,
-                                                   expected_packet_no - 1,
-                                                   &client_address,
-                                                   expected_packet_no,
-                                                   &recv_packet_count,
-                                                   &packet))
-                                    break;
-                                else stop = true;
-                            }
-                        }
-                        else if (current_error == ERRCONN) {
-                            // foreign client sent CONN
-                            send_CONRJT(socket_fd, &client_address);
-                        }
-                        else if (current_error == ERRIO) {
-                            // syscall error
-                            stop = true;
-                        }
-                        else if (current_error != ERROLD) {
-                            // stop serving the current client, if it came from him
-                            if (current_error != ERRSESSION) stop = true;
-                            send_RJT(socket_fd,
-                                     expected_packet_no,
-                                     &client_address);
-                        }
-                        client_address = old_client_address;
-                    }
-                    if (stop) break;
-                    if (recv_packet_count > left) {
-                        error("received too many bytes");
-                        send_RJT(socket_fd,
-                                 expected_packet_no,
-                                 &client_address);
-                        stop = true;
-                        break;
-                    }
-                    if (udpr && !send_ACC(socket_fd,
-                                          expected_packet_no,
-                                          &client_address))
-                    {
-                        stop = true;
-                        break;
-                    }
-                    print_packet(packet, recv_packet_count);
-                    left -= recv_packet_count;
-                    expected_packet_no++;
-                }
-                if (stop) break; // receiving loop failed
-                if (!send_RCVD(socket_fd, &client_address)) break;
-                debug("received %" PRIu64 " bytes", current_total_count);
-            } while (0);
-            debug("stopped serving %s:%" PRIu16,
-                  inet_ntoa(client_address.sin_addr),
-                  ntohs(client_address.sin_port));
-            socket_clear_timeout(socket_fd);
-        }
-        ASSERT_SYS_OK(close(socket_fd));
-        debug("stopped listening on port %" PRIu16,
-              ntohs(server_address.sin_port));
+
+    // Write stdout from a thread of its own, so a slow consumer does not
+    // keep the server from receiving.
+    if (ring_kb > 0) writer_start(STDOUT_FILENO, ring_kb << 10);
+
+    // Move TCP payloads to stdout without copying them, unless stdout
+    // cannot be spliced into. Output goes through the writer if there is one.
+    if (protocol_id == TCP_ID && output_dir == NULL && !uring_active() &&
+        !writer_active() && !splice_output_init(STDOUT_FILENO))
+    {
+        debug("stdout cannot be spliced into, copying payloads");
     }
-    else {
-        fatal("invalid server protocol: %s", argv[1]);
+
+    server_config_t config = {
+        .output_dir = output_dir,
+        .session    = {
+            .ack_policy = {.every    = ack_every,
+                           .delay_ns = ack_delay * NS_PER_MS},
+            .features   = FEATURE_LZ | FEATURE_CRC,
+        },
+        .verbose = verbose,
+    };
+
+    if (output_dir != NULL) {
+        // Serve many clients at once, each stream goes to its own file,
+        // which a client may ask to resume. The connections of a striped
+        // session would be served by different sessions.
+        config.session.features |= FEATURE_RESUME;
+        if (worker_count > 1) {
+            serve_sharded(protocol_id, &server_address, worker_count, &config);
+        }
+        if (protocol_id == TCP_ID) {
+            tcp_serve(tcp_listen(&server_address, false), &config);
+        }
+        udp_serve(udp_listen(&server_address, false), &config);
     }
 
-    return 0;
+    // Serve one client at a time, writing to stdout. Only TCP sessions are
+    // striped, and the ring reads one socket at a time.
+    if (protocol_id == TCP_ID && !uring_active()) {
+        config.session.features |= FEATURE_STRIPE;
+    }
+    if (protocol_id == TCP_ID) {
+        tcp_serve_serial(tcp_listen(&server_address, false), &config);
+    }
+    udp_serve_serial(udp_listen(&server_address, false), &config);
 }
@@ -2,8 +2,11 @@
 #define PROTOCOL_H
 
 #include <inttypes.h>
+#include <netinet/in.h>
 #include <stdbool.h>
 
+#include "batch.h"
+
 #define CONN_ID   1
 #define CONACC_ID 2
 #define CONRJT_ID 3
@@ -11,16 +14,50 @@
 #define ACC_ID    5
 #define RJT_ID    6
 #define RCVD_ID   7
+#define SACK_ID   8
+#define WND_ID    9
+#define PAR_ID    10
+#define NAK_ID    11
 
 #define TCP_ID  1
 #define UDP_ID  2
 #define UDPR_ID 3
+#define UDPW_ID 4
+#define UDPF_ID 5
 
 #define INVAL_ID 0
 
+// Features a client may ask for in the high bits of the protocol ID of
+// CONN. The server answers with a CONACC carrying those it agreed to.
+#define FEATURE_MASK   0xf0
+#define FEATURE_LZ     0x80 // DATA payloads are frames, maybe compressed
+#define FEATURE_CRC    0x40 // DATA and RCVD carry CRC32C checksums
+#define FEATURE_STRIPE 0x20 // TCP DATA over several connections, by offset
+#define FEATURE_RESUME 0x10 // stream continues a transfer from an offset
+
+// Methods of a DATA frame.
+#define FRAME_STORED 0
+#define FRAME_LZ     1
+
 #define START_NO         0
 #define MAX_PACKET_COUNT 64000
 
+// 1451 (data payload) + 21 (data header) + 8 (UDP header) + 20 (IP header) = 1500 (MTU)
+#define MAX_NO_FRAGMENTS 1451
+
+// Queued DATA is flushed once it reaches that many bytes.
+#define COALESCE_BYTES (256 << 10)
+
+// Maximum number of DATA packets in flight in udpw mode.
+#define WINDOW_MAX 64
+
+// Maximum number of TCP connections of a session with FEATURE_STRIPE.
+#define STRIPES_MAX 16
+
+// Total count of a byte stream whose length is not known in advance. Such a
+// stream is terminated by a DATA packet with zero packet count.
+#define UNKNOWN_COUNT UINT64_MAX
+
 typedef struct __attribute__((__packed__)) {
     uint8_t type_id;
     uint64_t session_id;
@@ -28,11 +65,36 @@ typedef struct __attribute__((__packed__)) {
     uint64_t total_count;
 } conn_t;
 
+// CONN asking for FEATURE_RESUME, naming the transfer to be continued.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint8_t protocol_id;
+    uint64_t total_count; // of the whole transfer
+    uint64_t transfer_id; // chosen by the client
+} conn_resume_t;
+
 typedef struct __attribute__((__packed__)) {
     uint8_t type_id;
     uint64_t session_id;
 } conacc_t;
 
+// CONACC answering a CONN which asked for features.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint8_t features; // agreed to by the server
+} conacc_ext_t;
+
+// CONACC answering a CONN which asked for FEATURE_RESUME. DATA carries the
+// stream from the offset on, numbered from START_NO as usual.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint8_t features;
+    uint64_t offset; // confirmed by the server, 0 if it declined
+} conacc_resume_t;
+
 typedef struct __attribute__((__packed__)) {
     uint8_t type_id;
     uint64_t session_id;
@@ -45,6 +107,15 @@ typedef struct __attribute__((__packed__)) {
     uint32_t packet_count;
 } data_t;
 
+// DATA of a session with FEATURE_CRC.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint64_t packet_no;
+    uint32_t packet_count;
+    uint32_t crc; // CRC32C of the header before it and the data after it
+} data_ext_t;
+
 typedef struct __attribute__((__packed__)) {
     uint8_t type_id;
     uint64_t session_id;
@@ -57,67 +128,86 @@ typedef struct __attribute__((__packed__)) {
     uint64_t packet_no;
 } rjt_t;
 
+// Request to retransmit a DATA packet which arrived corrupted.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint64_t packet_no;
+} nak_t;
+
 typedef struct __attribute__((__packed__)) {
     uint8_t type_id;
     uint64_t session_id;
 } rcvd_t;
 
-extern bool udpr;
+// RCVD of a session with FEATURE_CRC.
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint32_t crc; // CRC32C of the whole byte stream output
+} rcvd_ext_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint64_t packet_no; // all packets before it were received
+    uint64_t bitmap;    // bit i set if packet_no + 1 + i was received
+} sack_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint64_t limit; // stream offset the server has room for data up to
+} wnd_t;
+
+typedef struct __attribute__((__packed__)) {
+    uint8_t type_id;
+    uint64_t session_id;
+    uint64_t packet_no;    // first DATA packet of the block
+    uint8_t data_count;    // DATA packets in the block
+    uint8_t parity_count;  // PAR packets sent after the block
+    uint8_t parity_no;     // of this one
+    uint32_t packet_count; // length of the parity
+} par_t;
+
+// Header of the DATA payload of a session with FEATURE_LZ.
+typedef struct __attribute__((__packed__)) {
+    uint8_t method;
+    uint32_t raw_count; // of the payload the frame carries
+} frame_t;
+
+/*
+    Client side of a TCP session, the counterpart of sender_t over UDP: what
+    the client asked for in CONN and what the server agreed to in CONACC.
+    Each connection of a striped session is opened with the same one.
+*/
+typedef struct {
+    uint64_t session_id;
+    uint64_t transfer_id; // to be resumed, with FEATURE_RESUME
+    uint64_t total_count;
+    uint8_t asked_features; // in CONN
+    uint8_t features;       // agreed to by the server in CONACC
+    uint64_t offset; // of the transfer the stream starts at, from CONACC
+} tcp_session_t;
 
 uint64_t generate_random_uint64(void);
 uint16_t generate_packet_count(uint64_t left);
 uint8_t parse_protocol(const char* protocol);
 
-bool send_CONN(int socket_fd,
-               uint64_t total_count,
-               struct sockaddr_in* client_address);
-bool send_CONACC(int socket_fd, struct sockaddr_in* client_address);
-bool send_CONRJT(int socket_fd, struct sockaddr_in* client_address);
-bool send_DATA(int socket_fd,
-               uint64_t packet_no,
-               uint32_t packet_count,
-               const char* buffer,
-               struct sockaddr_in* client_address);
-bool send_ACC(int socket_fd,
-              uint64_t packet_no,
-              struct sockaddr_in* client_address);
-bool send_RJT(int socket_fd,
-              uint64_t packet_no,
-              struct sockaddr_in* client_address);
-bool send_RCVD(int socket_fd, struct sockaddr_in* client_address);
-
-bool recv_CONN(int socket_fd,
-               uint64_t* current_total_count,
-               struct sockaddr_in* client_address);
-bool recv_CONACC(int socket_fd, struct sockaddr_in* client_address);
-bool recv_DATA(int socket_fd,
-               uint64_t expected_packet_no,
-               uint32_t* recv_packet_count,
-               char** packet,
-               struct sockaddr_in* client_address);
-bool recv_ACC(int socket_fd,
-              uint64_t expected_packet_no,
-              struct sockaddr_in* client_address);
-bool recv_RCVD(int socket_fd, struct sockaddr_in* client_address);
-
-bool retransmit_CONN(int socket_fd,
-                     uint64_t total_count,
-                     struct sockaddr_in* client_address);
-bool retransmit_DATA(int socket_fd,
-                     uint64_t packet_no,
-                     uint32_t packet_count,
-                     const char* packet,
-                     struct sockaddr_in* client_address);
-bool retransmit_ACC(int socket_fd,
-                    uint64_t packet_no,
-                    struct sockaddr_in* client_address,
-                    uint64_t expected_packet_no,
-                    uint32_t* recv_packet_count,
-                    char** packet);
-bool retransmit_CONACC(int socket_fd,
-                       struct sockaddr_in* client_address,
-                       uint64_t expected_packet_no,
-                       uint32_t* recv_packet_count,
-                       char** packet);
+bool send_CONN(int socket_fd, tcp_session_t* session);
+bool send_CONN_stripe(int socket_fd, const tcp_session_t* session);
+bool queue_DATA(int socket_fd,
+                const tcp_session_t* session,
+                batch_t* batch,
+                uint64_t packet_no,
+                uint32_t packet_count,
+                const char* packet);
+bool must_flush_DATA(const batch_t* batch);
+bool flush_DATA(int socket_fd, uint8_t protocol_id, batch_t* batch);
+
+bool recv_CONACC(int socket_fd, tcp_session_t* session);
+bool recv_RCVD(int socket_fd,
+               const tcp_session_t* session,
+               uint32_t* output_crc);
 
 #endif
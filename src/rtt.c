@@ -0,0 +1,43 @@
+#include "common.h"
+#include "protconst.h"
+#include "rtt.h"
+
+#define RTO_MIN_NS ((uint64_t)RTO_MIN_MS * NS_PER_MS)
+#define RTO_MAX_NS ((uint64_t)MAX_WAIT * NS_PER_SEC)
+
+static uint64_t clamp(uint64_t rto_ns) {
+    if (rto_ns < RTO_MIN_NS) return RTO_MIN_NS;
+    if (rto_ns > RTO_MAX_NS) return RTO_MAX_NS;
+    return rto_ns;
+}
+
+void rtt_init(rtt_t* rtt) {
+    rtt->sampled   = false;
+    rtt->srtt_ns   = 0;
+    rtt->rttvar_ns = 0;
+    rtt->rto_ns    = clamp((uint64_t)RTO_INITIAL_MS * NS_PER_MS);
+}
+
+void rtt_sample(rtt_t* rtt, uint64_t sample_ns) {
+    if (!rtt->sampled) {
+        rtt->sampled   = true;
+        rtt->srtt_ns   = sample_ns;
+        rtt->rttvar_ns = sample_ns / 2;
+    }
+    else {
+        uint64_t delta = rtt->srtt_ns > sample_ns ? rtt->srtt_ns - sample_ns
+                                                  : sample_ns - rtt->srtt_ns;
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R
+        rtt->rttvar_ns = (3 * rtt->rttvar_ns + delta) / 4;
+        rtt->srtt_ns   = (7 * rtt->srtt_ns + sample_ns) / 8;
+    }
+    rtt->rto_ns = clamp(rtt->srtt_ns + 4 * rtt->rttvar_ns);
+}
+
+void rtt_backoff(rtt_t* rtt) {
+    rtt->rto_ns = clamp(2 * rtt->rto_ns);
+}
+
+uint64_t rtt_timeout(const rtt_t* rtt) {
+    return rtt->rto_ns;
+}
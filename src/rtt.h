@@ -0,0 +1,39 @@
+#ifndef RTT_H
+#define RTT_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Retransmission timeout before the first RTT sample.
+#define RTO_INITIAL_MS 1000
+
+// Lower bound on the retransmission timeout, so delayed acknowledgments and
+// scheduling hiccups do not trigger spurious retransmissions. The upper
+// bound is MAX_WAIT.
+#define RTO_MIN_MS 10
+
+/*
+    Retransmission timeout estimated from round-trip time samples as in
+    RFC 6298: RTO = SRTT + 4 * RTTVAR, clamped to [RTO_MIN_MS, MAX_WAIT].
+    Every timeout doubles RTO until the next sample. Samples must come only
+    from packets which were not retransmitted (Karn's algorithm), since the
+    acknowledgment of a retransmitted one may answer any of its copies.
+*/
+typedef struct {
+    bool sampled;
+    uint64_t srtt_ns;   // smoothed round-trip time
+    uint64_t rttvar_ns; // round-trip time variation
+    uint64_t rto_ns;
+} rtt_t;
+
+void rtt_init(rtt_t* rtt);
+
+// Update the estimate with a measured round-trip time.
+void rtt_sample(rtt_t* rtt, uint64_t sample_ns);
+
+// Double the timeout after it expired.
+void rtt_backoff(rtt_t* rtt);
+
+uint64_t rtt_timeout(const rtt_t* rtt);
+
+#endif
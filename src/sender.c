@@ -0,0 +1,688 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "crc32c.h"
+#include "err.h"
+#include "protconst.h"
+#include "sender.h"
+
+#define MAX_WAIT_NS ((uint64_t)MAX_WAIT * NS_PER_SEC)
+
+// Number of acknowledgments of later packets after which a missing packet
+// is retransmitted without waiting for the timeout.
+#define FAST_RETRANSMIT_SKIPS 3
+
+static bool reliable(const sender_t* sender) {
+    return sender->protocol_id == UDPR_ID || sender->protocol_id == UDPW_ID;
+}
+
+// Get how many DATA packets may be in flight.
+static uint64_t window(const sender_t* sender) {
+    int size = sender->window_size;
+    if (sender->protocol_id == UDPW_ID && sender->cc.cwnd < size) {
+        size = sender->cc.cwnd;
+    }
+    return (uint64_t)size;
+}
+
+// Check if the next payload, whatever its size, fits the receive window.
+static bool window_advertised(const sender_t* sender) {
+    if (sender->limit == UINT64_MAX) return true;
+    uint64_t size = sender->left < MAX_PACKET_COUNT ? sender->left
+                                                    : MAX_PACKET_COUNT;
+    return sender->pushed + size <= sender->limit;
+}
+
+// Pace udpw at the congestion window per round trip, faster in slow start
+// for the window to keep growing, and never above the rate limit.
+static void update_pacing(sender_t* sender, uint64_t now) {
+    uint64_t rate = sender->rate_limit;
+    if (sender->protocol_id == UDPW_ID && sender->rtt.sampled &&
+        sender->rtt.srtt_ns > 0)
+    {
+        uint64_t window_bytes = (uint64_t)sender->cc.cwnd * sender->packet_bytes;
+        uint64_t cc_rate      = window_bytes * NS_PER_SEC / sender->rtt.srtt_ns;
+        cc_rate = congestion_slow_start(&sender->cc) ? 2 * cc_rate
+                                                      : cc_rate * 5 / 4;
+        if (rate == 0 || cc_rate < rate) rate = cc_rate;
+    }
+    pacer_set_rate(&sender->pacer, rate, now);
+}
+
+static send_t* add_send(send_t* sends, int* send_count) {
+    send_t* send = &sends[(*send_count)++];
+    memset(send, 0, sizeof(*send));
+    return send;
+}
+
+static void emit_CONN(sender_t* sender, send_t* sends, int* send_count) {
+    send_t* send             = add_send(sends, send_count);
+    send->length             = sender->asked_features & FEATURE_RESUME
+                                   ? sizeof(conn_resume_t)
+                                   : sizeof(conn_t);
+    send->header.conn_resume = (conn_resume_t){
+        .type_id     = CONN_ID,
+        .session_id  = htobe64(sender->session_id),
+        .protocol_id = sender->protocol_id | sender->asked_features,
+        .total_count = htobe64(sender->total_count),
+        .transfer_id = htobe64(sender->transfer_id),
+    };
+    debug("session %" PRIu64 ": sending CONN", sender->session_id);
+}
+
+static void emit_DATA(sender_t* sender,
+                      uint64_t packet_no,
+                      sender_flight_t* flight,
+                      uint64_t now,
+                      send_t* sends,
+                      int* send_count) {
+    send_t* send      = add_send(sends, send_count);
+    send->length      = sizeof(data_t);
+    send->header.data = (data_t){
+        .type_id      = DATA_ID,
+        .session_id   = htobe64(sender->session_id),
+        .packet_no    = htobe64(packet_no),
+        .packet_count = htobe32(flight->payload_count),
+    };
+    if (sender->features & FEATURE_CRC) {
+        uint32_t crc = crc32c(crc32c(0, &send->header, sizeof(data_t)),
+                              flight->payload,
+                              flight->payload_count);
+        send->header.data_ext.crc = htobe32(crc);
+        send->length              = sizeof(data_ext_t);
+    }
+    send->payload       = flight->payload;
+    send->payload_count = flight->payload_count;
+    flight->tx          = sender->tx_count++;
+    flight->sent_at     = now;
+
+    uint64_t bytes = send->length + flight->payload_count;
+    pacer_consume(&sender->pacer, bytes, now);
+    sender->packet_bytes = sender->packet_bytes == 0
+                               ? bytes
+                               : (7 * sender->packet_bytes + bytes) / 8;
+    debug("session %" PRIu64 ": sending DATA (packet_no=%" PRIu64
+          ", packet_size=%u)",
+          sender->session_id,
+          packet_no,
+          flight->payload_count);
+}
+
+static void emit_PAR(sender_t* sender,
+                     int parity_no,
+                     uint64_t now,
+                     send_t* sends,
+                     int* send_count) {
+    send_t* send     = add_send(sends, send_count);
+    send->length     = sizeof(par_t);
+    send->header.par = (par_t){
+        .type_id      = PAR_ID,
+        .session_id   = htobe64(sender->session_id),
+        .packet_no    = htobe64(sender->block_first),
+        .data_count   = (uint8_t)sender->block_count,
+        .parity_count = (uint8_t)sender->fec.parity_count,
+        .parity_no    = (uint8_t)parity_no,
+        .packet_count = htobe32(sender->symbol_size),
+    };
+    send->payload       = sender->parity + (size_t)parity_no * FEC_SYMBOL_MAX;
+    send->payload_count = sender->symbol_size;
+    pacer_consume(&sender->pacer, sizeof(par_t) + sender->symbol_size, now);
+    debug("session %" PRIu64 ": sending PAR (packet_no=%" PRIu64
+          ", parity_no=%d)",
+          sender->session_id,
+          sender->block_first,
+          parity_no);
+}
+
+// Add a DATA packet to the parity of its block, and emit the parity once
+// the block is complete or the stream ends.
+static void protect(sender_t* sender,
+                    uint64_t packet_no,
+                    const char* payload,
+                    uint32_t payload_count,
+                    uint64_t now,
+                    send_t* sends,
+                    int* send_count) {
+    if (sender->block_count == 0) {
+        sender->block_first = packet_no;
+        sender->symbol_size = 0;
+    }
+    // Shorter symbols are padded with zeros, which add nothing.
+    uint32_t size = sizeof(uint32_t) + payload_count;
+    for (int j = 0; j < sender->fec.parity_count; j++) {
+        char* parity = sender->parity + (size_t)j * FEC_SYMBOL_MAX;
+        if (size > sender->symbol_size) {
+            memset(parity + sender->symbol_size, 0, size - sender->symbol_size);
+        }
+        fec_encode(parity, j, sender->block_count, payload, payload_count);
+    }
+    if (size > sender->symbol_size) sender->symbol_size = size;
+    sender->block_count++;
+
+    if (sender->block_count < sender->fec.data_count && sender->left > 0) {
+        return;
+    }
+    for (int j = 0; j < sender->fec.parity_count; j++) {
+        emit_PAR(sender, j, now, sends, send_count);
+    }
+    sender->block_count = 0;
+}
+
+static void fail(sender_t* sender) {
+    sender->state    = SENDER_FAILED;
+    sender->deadline = UINT64_MAX;
+}
+
+// Retransmit a DATA packet, fail if it was retransmitted too many times.
+static bool resend(sender_t* sender,
+                   uint64_t packet_no,
+                   uint64_t now,
+                   send_t* sends,
+                   int* send_count) {
+    sender_flight_t* flight = &sender->flights[packet_no % WINDOW_MAX];
+    if (++flight->retransmits > MAX_RETRANSMITS) {
+        error("session %" PRIu64
+              ": failed to retransmit DATA (packet_no=%" PRIu64 ")",
+              sender->session_id,
+              packet_no);
+        fail(sender);
+        return false;
+    }
+    flight->skipped = 0;
+    debug("session %" PRIu64 ": attempt %d to retransmit DATA",
+          sender->session_id,
+          flight->retransmits);
+    emit_DATA(sender, packet_no, flight, now, sends, send_count);
+    return true;
+}
+
+// Get how long to wait for acknowledgments of the packets in flight. The
+// last retransmission of a packet gets the full MAX_WAIT before the sender
+// gives up, and so does RCVD once nothing is in flight.
+static uint64_t retransmit_timeout(const sender_t* sender) {
+    if (sender->base == sender->next) return MAX_WAIT_NS;
+    for (uint64_t p = sender->base; p < sender->next; p++) {
+        const sender_flight_t* flight = &sender->flights[p % WINDOW_MAX];
+        if (!flight->acked && flight->retransmits == MAX_RETRANSMITS) {
+            return MAX_WAIT_NS;
+        }
+    }
+    return rtt_timeout(&sender->rtt);
+}
+
+// The stream is sent once all of it was pushed and, in reliable modes,
+// acknowledged; only RCVD is awaited then.
+static void check_finished(sender_t* sender, uint64_t now) {
+    if (sender->state != SENDER_SENDING || sender->left > 0) return;
+    sender->state = SENDER_FINISHING;
+    if (!reliable(sender) || sender->base == sender->next) {
+        sender->deadline = now + MAX_WAIT_NS;
+    }
+    debug("session %" PRIu64 ": sent %" PRIu64 " bytes",
+          sender->session_id,
+          sender->pushed);
+}
+
+// Give the server MAX_WAIT to open its receive window once the sender has
+// nothing else to wait for.
+static void wait_for_window(sender_t* sender, uint64_t now) {
+    if (sender->state == SENDER_SENDING && sender->left > 0 &&
+        sender->deadline == UINT64_MAX && !window_advertised(sender))
+    {
+        sender->deadline = now + MAX_WAIT_NS;
+    }
+}
+
+// Mark packets acknowledged by a cumulative ACC (bitmap 0) or a SACK. The
+// oldest unacknowledged packet moves to ack_no at least.
+static void acknowledge(sender_t* sender,
+                        uint64_t ack_no,
+                        uint64_t bitmap,
+                        uint64_t now,
+                        send_t* sends,
+                        int* send_count) {
+    int newly_acked         = 0;
+    uint64_t latest_tx      = 0;
+    uint64_t rtt_ns         = 0;
+    sender_flight_t* latest = NULL;
+
+    if (ack_no > sender->next) {
+        error("session %" PRIu64 ": acknowledgment of unsent packet "
+              "(packet_no=%" PRIu64 ")",
+              sender->session_id,
+              ack_no);
+        fail(sender);
+        return;
+    }
+    if (ack_no < sender->base) {
+        debug("session %" PRIu64 ": old acknowledgment (packet_no=%" PRIu64 ")",
+              sender->session_id,
+              ack_no);
+        return;
+    }
+
+    // Find the latest transmission this acknowledgment newly covers.
+    for (uint64_t p = sender->base; p < sender->next; p++) {
+        sender_flight_t* flight = &sender->flights[p % WINDOW_MAX];
+        bool acked = p < ack_no || (p > ack_no && p - ack_no - 1 < 64 &&
+                                    ((bitmap >> (p - ack_no - 1)) & 1));
+        if (acked && !flight->acked) {
+            flight->acked = true;
+            newly_acked++;
+            if (latest == NULL || flight->tx > latest_tx) {
+                latest_tx = flight->tx;
+                latest    = flight;
+            }
+        }
+    }
+
+    // The acknowledgment of a retransmitted packet may answer any copy.
+    if (latest != NULL && latest->retransmits == 0) {
+        rtt_ns = now - latest->sent_at;
+        rtt_sample(&sender->rtt, rtt_ns);
+    }
+    if (newly_acked > 0 && sender->protocol_id == UDPW_ID) {
+        congestion_on_ack(&sender->cc, newly_acked, rtt_ns);
+    }
+
+    // Everything before ack_no was received, the stream can be reused.
+    if (ack_no > sender->base) {
+        sender->base     = ack_no;
+        sender->released = sender->flights[(ack_no - 1) % WINDOW_MAX].end;
+    }
+
+    // Retransmit packets repeatedly overtaken by later transmissions, which
+    // are then most likely lost rather than delayed.
+    for (uint64_t p = sender->base; newly_acked > 0 && p < sender->next; p++) {
+        sender_flight_t* flight = &sender->flights[p % WINDOW_MAX];
+        if (flight->acked || flight->tx > latest_tx ||
+            ++flight->skipped < FAST_RETRANSMIT_SKIPS)
+            continue;
+        if (sender->protocol_id == UDPW_ID) {
+            congestion_on_loss(&sender->cc, p, sender->next);
+            debug("session %" PRIu64 ": congestion window %d after a loss",
+                  sender->session_id,
+                  sender->cc.cwnd);
+        }
+        if (!resend(sender, p, now, sends, send_count)) return;
+    }
+    update_pacing(sender, now);
+
+    // Only progress postpones the timeout, repeated acknowledgments do not.
+    // With nothing in flight, the sender waits for the application or RCVD.
+    if (newly_acked > 0) sender->deadline = now + retransmit_timeout(sender);
+    if (sender->base == sender->next && sender->state == SENDER_SENDING) {
+        sender->deadline = UINT64_MAX;
+    }
+    wait_for_window(sender, now);
+}
+
+// Continue the transfer from the offset the server confirmed.
+static bool resume(sender_t* sender, const char* offset) {
+    memcpy(&sender->offset, offset, sizeof(sender->offset));
+    sender->offset = be64toh(sender->offset);
+    if (sender->total_count == UNKNOWN_COUNT) return true;
+
+    if (sender->offset > sender->total_count) {
+        error("session %" PRIu64 ": resuming past the end (offset=%" PRIu64
+              ")",
+              sender->session_id,
+              sender->offset);
+        fail(sender);
+        return false;
+    }
+    sender->left = sender->total_count - sender->offset;
+    return true;
+}
+
+void sender_open(sender_t* sender,
+                 uint8_t protocol_id,
+                 uint8_t features,
+                 uint64_t session_id,
+                 uint64_t transfer_id,
+                 uint64_t total_count,
+                 int window_size,
+                 uint64_t rate_limit,
+                 fec_params_t fec,
+                 uint64_t now,
+                 send_t* sends,
+                 int* send_count) {
+    *send_count = 0;
+
+    memset(sender, 0, sizeof(*sender));
+    sender->session_id     = session_id;
+    sender->transfer_id    = transfer_id;
+    sender->protocol_id    = protocol_id;
+    sender->asked_features = features & FEATURE_MASK;
+    sender->state          = SENDER_CONNECTING;
+    sender->total_count    = total_count;
+    sender->left           = total_count;
+    sender->base           = START_NO;
+    sender->next           = START_NO;
+    sender->limit          = UINT64_MAX;
+    sender->opened_at      = now;
+    rtt_init(&sender->rtt);
+    // Only reliable modes retransmit CONN.
+    sender->deadline =
+        now + (reliable(sender) ? rtt_timeout(&sender->rtt) : MAX_WAIT_NS);
+
+    // Unreliable modes send the whole stream without waiting.
+    sender->window_size = protocol_id == UDPW_ID   ? window_size
+                          : protocol_id == UDPR_ID ? 1
+                                                   : WINDOW_MAX;
+    congestion_init(&sender->cc, sender->window_size);
+    sender->rate_limit = rate_limit;
+    pacer_init(&sender->pacer, rate_limit, now);
+
+    if (protocol_id == UDPF_ID) {
+        sender->fec = fec;
+        ASSERT_MALLOC_OK(sender->parity = malloc((size_t)fec.parity_count *
+                                                 FEC_SYMBOL_MAX));
+    }
+
+    emit_CONN(sender, sends, send_count);
+}
+
+void sender_close(sender_t* sender) {
+    free(sender->parity);
+    sender->parity = NULL;
+}
+
+// Check if the window has room for another packet.
+static bool window_open(const sender_t* sender) {
+    if (sender->state != SENDER_SENDING || sender->left == 0) return false;
+    if (!window_advertised(sender)) return false;
+    return !reliable(sender) || sender->next - sender->base < window(sender);
+}
+
+bool sender_can_push(const sender_t* sender, uint64_t now) {
+    return window_open(sender) && pacer_ready_at(&sender->pacer) <= now;
+}
+
+void sender_push(sender_t* sender,
+                 const char* payload,
+                 uint32_t payload_count,
+                 uint32_t stream_count,
+                 uint64_t now,
+                 send_t* sends,
+                 int* send_count) {
+    *send_count = 0;
+
+    uint64_t packet_no      = sender->next;
+    sender_flight_t* flight = &sender->flights[packet_no % WINDOW_MAX];
+    sender->pushed += stream_count;
+    // Empty DATA terminates a stream of unknown length.
+    sender->left = payload_count == 0 ? 0 : sender->left - stream_count;
+    *flight      = (sender_flight_t){
+        .payload       = payload,
+        .payload_count = payload_count,
+        .end           = sender->pushed,
+    };
+    emit_DATA(sender, packet_no, flight, now, sends, send_count);
+
+    if (reliable(sender)) {
+        if (sender->base == sender->next) {
+            sender->deadline = now + rtt_timeout(&sender->rtt);
+        }
+        sender->next++;
+    }
+    else {
+        // Nothing is retransmitted, so nothing is kept.
+        sender->next++;
+        sender->base     = sender->next;
+        sender->released = sender->pushed;
+    }
+    if (sender->protocol_id == UDPF_ID) {
+        protect(sender, packet_no, payload, payload_count, now, sends, send_count);
+    }
+    check_finished(sender, now);
+    wait_for_window(sender, now);
+}
+
+void sender_on_packet(sender_t* sender,
+                      const char* buf,
+                      size_t length,
+                      uint64_t now,
+                      send_t* sends,
+                      int* send_count) {
+    *send_count = 0;
+    uint64_t session_id, packet_no, limit;
+    sack_t sack;
+
+    if (sender->state == SENDER_DONE || sender->state == SENDER_FAILED) return;
+
+    if (length < sizeof(uint8_t) + sizeof(uint64_t)) {
+        error("session %" PRIu64 ": packet too short (size=%zu)",
+              sender->session_id,
+              length);
+        return;
+    }
+    memcpy(&session_id, buf + sizeof(uint8_t), sizeof(session_id));
+    if (be64toh(session_id) != sender->session_id) {
+        error("unexpected session ID: %" PRIu64, be64toh(session_id));
+        error("expected: %" PRIu64, sender->session_id);
+        return;
+    }
+
+    uint8_t type_id = (uint8_t)buf[0];
+    size_t expected;
+    switch (type_id) {
+        case CONACC_ID:
+            expected = sender->asked_features & FEATURE_RESUME
+                           ? sizeof(conacc_resume_t)
+                       : sender->asked_features ? sizeof(conacc_ext_t)
+                                                : sizeof(conacc_t);
+            break;
+        case CONRJT_ID: expected = sizeof(conrjt_t); break;
+        case RCVD_ID:
+            expected = sender->features & FEATURE_CRC ? sizeof(rcvd_ext_t)
+                                                      : sizeof(rcvd_t);
+            break;
+        case ACC_ID:
+        case RJT_ID:
+        case NAK_ID: expected = sizeof(acc_t); break;
+        case SACK_ID: expected = sizeof(sack_t); break;
+        case WND_ID: expected = sizeof(wnd_t); break;
+        default:
+            error("session %" PRIu64 ": unexpected type ID: %u",
+                  sender->session_id,
+                  type_id);
+            fail(sender);
+            return;
+    }
+    if (length != expected) {
+        error("session %" PRIu64 ": unexpected size %zu of packet type %u",
+              sender->session_id,
+              length,
+              type_id);
+        return;
+    }
+
+    switch (type_id) {
+        case CONACC_ID:
+            if (sender->state != SENDER_CONNECTING) {
+                debug("session %" PRIu64 ": old CONACC", sender->session_id);
+                return;
+            }
+            if (sender->asked_features) {
+                sender->features = sender->asked_features &
+                                   (uint8_t)buf[offsetof(conacc_ext_t,
+                                                         features)];
+            }
+            if (sender->features & FEATURE_RESUME &&
+                !resume(sender, buf + offsetof(conacc_resume_t, offset)))
+                return;
+            debug("session %" PRIu64 ": received CONACC (features=%#x)",
+                  sender->session_id,
+                  sender->features);
+            if (sender->retransmits == 0) {
+                rtt_sample(&sender->rtt, now - sender->opened_at);
+            }
+            sender->state       = SENDER_SENDING;
+            sender->retransmits = 0;
+            sender->deadline    = UINT64_MAX;
+            check_finished(sender, now);
+            return;
+
+        case CONRJT_ID:
+            error("session %" PRIu64 ": connection rejected",
+                  sender->session_id);
+            fail(sender);
+            return;
+
+        case ACC_ID:
+        case SACK_ID:
+            if (!reliable(sender) || sender->state == SENDER_CONNECTING) break;
+            if (type_id == ACC_ID) {
+                // Cumulative ACC, nothing received after the packet.
+                memcpy(&packet_no,
+                       buf + offsetof(acc_t, packet_no),
+                       sizeof(packet_no));
+                acknowledge(
+                    sender, be64toh(packet_no) + 1, 0, now, sends, send_count);
+            }
+            else {
+                memcpy(&sack, buf, sizeof(sack));
+                acknowledge(sender,
+                            be64toh(sack.packet_no),
+                            be64toh(sack.bitmap),
+                            now,
+                            sends,
+                            send_count);
+            }
+            return;
+
+        case WND_ID:
+            memcpy(&limit, buf + offsetof(wnd_t, limit), sizeof(limit));
+            limit = be64toh(limit);
+            // The window never shrinks, a reordered update is stale.
+            if (sender->limit == UINT64_MAX || limit > sender->limit) {
+                sender->limit = limit;
+            }
+            debug("session %" PRIu64 ": received WND (limit=%" PRIu64 ")",
+                  sender->session_id,
+                  limit);
+            // The server is alive, so the wait for room starts over.
+            if (sender->state == SENDER_SENDING &&
+                sender->base == sender->next)
+            {
+                sender->deadline = UINT64_MAX;
+            }
+            wait_for_window(sender, now);
+            return;
+
+        case RCVD_ID:
+            if (sender->state == SENDER_CONNECTING || sender->left > 0) {
+                error("session %" PRIu64 ": RCVD before sending all data",
+                      sender->session_id);
+                fail(sender);
+                return;
+            }
+            if (sender->features & FEATURE_CRC) {
+                memcpy(&sender->stream_crc,
+                       buf + offsetof(rcvd_ext_t, crc),
+                       sizeof(sender->stream_crc));
+                sender->stream_crc = be32toh(sender->stream_crc);
+            }
+            debug("session %" PRIu64 ": received RCVD", sender->session_id);
+            sender->state    = SENDER_DONE;
+            sender->base     = sender->next;
+            sender->released = sender->pushed;
+            sender->deadline = UINT64_MAX;
+            return;
+
+        case NAK_ID:
+            memcpy(&packet_no,
+                   buf + offsetof(nak_t, packet_no),
+                   sizeof(packet_no));
+            packet_no = be64toh(packet_no);
+            debug("session %" PRIu64 ": received NAK (packet_no=%" PRIu64 ")",
+                  sender->session_id,
+                  packet_no);
+            // Resend a corrupted packet at once, unless it got through since.
+            if (reliable(sender) && packet_no >= sender->base &&
+                packet_no < sender->next &&
+                !sender->flights[packet_no % WINDOW_MAX].acked)
+            {
+                resend(sender, packet_no, now, sends, send_count);
+            }
+            return;
+
+        case RJT_ID:
+            memcpy(&packet_no,
+                   buf + offsetof(rjt_t, packet_no),
+                   sizeof(packet_no));
+            error("session %" PRIu64 ": DATA rejected (packet_no=%" PRIu64 ")",
+                  sender->session_id,
+                  be64toh(packet_no));
+            fail(sender);
+            return;
+    }
+
+    error("session %" PRIu64 ": unexpected type ID: %u",
+          sender->session_id,
+          type_id);
+    fail(sender);
+}
+
+void sender_on_timer(sender_t* sender,
+                     uint64_t now,
+                     send_t* sends,
+                     int* send_count) {
+    *send_count = 0;
+
+    if (sender->deadline > now) return;
+
+    if (sender->state == SENDER_CONNECTING) {
+        if (!reliable(sender) || ++sender->retransmits > MAX_RETRANSMITS) {
+            error("session %" PRIu64 ": no CONACC", sender->session_id);
+            fail(sender);
+            return;
+        }
+        debug("session %" PRIu64 ": attempt %d to retransmit CONN",
+              sender->session_id,
+              sender->retransmits);
+        emit_CONN(sender, sends, send_count);
+        rtt_backoff(&sender->rtt);
+        sender->deadline =
+            now + (sender->retransmits == MAX_RETRANSMITS
+                       ? MAX_WAIT_NS
+                       : rtt_timeout(&sender->rtt));
+        return;
+    }
+
+    // Resend all packets in the window which were not acknowledged yet.
+    if (reliable(sender) && sender->base < sender->next) {
+        if (sender->protocol_id == UDPW_ID) {
+            congestion_on_timeout(&sender->cc, sender->next);
+            update_pacing(sender, now);
+        }
+        for (uint64_t p = sender->base; p < sender->next; p++) {
+            if (!sender->flights[p % WINDOW_MAX].acked &&
+                !resend(sender, p, now, sends, send_count))
+                return;
+        }
+        rtt_backoff(&sender->rtt);
+        sender->deadline = now + retransmit_timeout(sender);
+        return;
+    }
+
+    if (sender->state == SENDER_SENDING && !window_advertised(sender)) {
+        error("session %" PRIu64 ": receive window stayed closed",
+              sender->session_id);
+    }
+    else {
+        error("session %" PRIu64 ": timeout", sender->session_id);
+    }
+    fail(sender);
+}
+
+uint64_t sender_deadline(const sender_t* sender) {
+    if (window_open(sender) &&
+        pacer_ready_at(&sender->pacer) < sender->deadline)
+    {
+        return pacer_ready_at(&sender->pacer);
+    }
+    return sender->deadline;
+}
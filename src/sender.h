@@ -0,0 +1,168 @@
+#ifndef SENDER_H
+#define SENDER_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "congestion.h"
+#include "fec.h"
+#include "pacer.h"
+#include "protocol.h"
+#include "rtt.h"
+
+// Maximum number of packets a sender emits in response to one event: the
+// whole udpw window when it is retransmitted. In udpf mode, a DATA packet
+// and the parity of the block it completes take at most FEC_PARITY_MAX + 1.
+#define MAX_SENDS WINDOW_MAX
+
+// Packet to be sent by the transport on behalf of a sender. DATA carries a
+// payload referenced from the application, PAR one referenced from the
+// sender, valid until the next block is complete.
+typedef struct {
+    size_t length; // of the header
+    union {
+        conn_t conn;
+        conn_resume_t conn_resume;
+        data_t data;
+        data_ext_t data_ext;
+        par_t par;
+    } header;
+    const char* payload;
+    uint32_t payload_count;
+} send_t;
+
+typedef enum {
+    SENDER_CONNECTING, // CONN sent, waiting for CONACC
+    SENDER_SENDING,
+    SENDER_FINISHING, // whole stream sent, waiting for acknowledgments
+    SENDER_DONE,      // server confirmed receiving the whole stream
+    SENDER_FAILED,
+} sender_state_t;
+
+// DATA packet in flight in udpr and udpw modes.
+typedef struct {
+    const char* payload;
+    uint32_t payload_count;
+    uint64_t end;     // stream offset right after the packet
+    uint64_t tx;      // order of the last transmission among all packets
+    uint64_t sent_at; // time of the last transmission
+    int retransmits;
+    int skipped; // acknowledgments of packets sent after this one
+    bool acked;
+} sender_flight_t;
+
+/*
+    Client side of a single session, the counterpart of session_t. The
+    sender does no I/O: the transport feeds it received packets, expired
+    deadlines and payloads the application wants to send, and sends the
+    packets it emits. All state is in the sender, so any number of them can
+    be driven from one thread.
+
+    In udpr and udpw modes, payloads stay referenced until acknowledged;
+    the application may reuse the stream before 'released'.
+
+    DATA is paced to the rate limit, and in udpw mode also to the
+    congestion window spread over a round trip, so the window does not
+    leave in one burst which overflows the queue of the bottleneck.
+
+    A server which advertises a receive window with WND is never sent data
+    past its limit. While the window is closed, the sender waits for an
+    update up to MAX_WAIT.
+
+    In udpf mode, each block of DATA packets is followed by PAR packets, from
+    which the server rebuilds lost ones. Parity is computed as payloads are
+    pushed, so they are not kept either.
+*/
+typedef struct {
+    uint64_t session_id;
+    uint64_t transfer_id; // to be resumed, with FEATURE_RESUME
+    uint8_t protocol_id;
+    uint8_t asked_features; // in CONN
+    uint8_t features;       // agreed to by the server in CONACC
+    uint32_t stream_crc;    // of the byte stream output, from RCVD
+    sender_state_t state;
+
+    uint64_t total_count;
+    uint64_t offset;   // of the transfer the stream starts at, from CONACC
+    uint64_t left;     // bytes not pushed yet
+    uint64_t pushed;   // bytes pushed so far
+    uint64_t released; // stream offset the sender no longer needs data before
+    uint64_t limit;    // advertised by the server, UINT64_MAX if none
+
+    int window_size;    // DATA packets in flight, 1 in udpr mode
+    uint64_t base;      // oldest unacknowledged packet
+    uint64_t next;      // next packet to be sent
+    uint64_t tx_count;  // transmissions so far, including retransmissions
+    uint64_t deadline;  // of the retransmission or timeout
+    uint64_t opened_at; // time CONN was first sent
+    int retransmits;    // of CONN
+    rtt_t rtt;
+
+    uint64_t rate_limit;   // bytes per second, 0 if unlimited
+    uint64_t packet_bytes; // average length of DATA packets sent
+    pacer_t pacer;
+    congestion_t cc; // of the udpw mode
+    sender_flight_t flights[WINDOW_MAX];
+
+    // Block being sent in udpf mode.
+    fec_params_t fec;
+    uint64_t block_first; // first DATA packet of it
+    int block_count;      // DATA packets in it so far
+    uint32_t symbol_size; // longest symbol so far
+    char* parity;         // fec.parity_count symbols of FEC_SYMBOL_MAX bytes
+} sender_t;
+
+// Start a session, emit CONN asking for features. transfer_id is only used
+// with FEATURE_RESUME, window_size in udpw mode, where it caps the
+// congestion window, and fec in udpf mode. rate_limit is in bytes per
+// second, 0 for none.
+void sender_open(sender_t* sender,
+                 uint8_t protocol_id,
+                 uint8_t features,
+                 uint64_t session_id,
+                 uint64_t transfer_id,
+                 uint64_t total_count,
+                 int window_size,
+                 uint64_t rate_limit,
+                 fec_params_t fec,
+                 uint64_t now,
+                 send_t* sends,
+                 int* send_count);
+
+// Free what the sender allocated, once its sends are no longer needed.
+void sender_close(sender_t* sender);
+
+// Check if the sender takes another payload now.
+bool sender_can_push(const sender_t* sender, uint64_t now);
+
+// Send the next payload of the stream, empty to end an open-ended stream.
+// It carries stream_count bytes of the stream, fewer than its own if it is
+// a compressed frame.
+void sender_push(sender_t* sender,
+                 const char* payload,
+                 uint32_t payload_count,
+                 uint32_t stream_count,
+                 uint64_t now,
+                 send_t* sends,
+                 int* send_count);
+
+// Handle a packet received from the server.
+void sender_on_packet(sender_t* sender,
+                      const char* buf,
+                      size_t length,
+                      uint64_t now,
+                      send_t* sends,
+                      int* send_count);
+
+// Handle an expired deadline.
+void sender_on_timer(sender_t* sender,
+                     uint64_t now,
+                     send_t* sends,
+                     int* send_count);
+
+// Get the deadline of the sender, or the time it takes another payload if
+// that is earlier; UINT64_MAX if none.
+uint64_t sender_deadline(const sender_t* sender);
+
+#endif
@@ -0,0 +1,481 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "protconst.h"
+#include "server.h"
+#include "splice_output.h"
+#include "writer.h"
+
+// Longest frame sent by a client: DATA with a checksum and the largest
+// payload.
+#define MAX_FRAME (sizeof(data_ext_t) + MAX_PACKET_COUNT)
+
+// The serial server writes every byte stream to stdout, through its output
+// path, so a transfer cannot be resumed.
+static const sink_t stdout_sink = {.fd = STDOUT_FILENO, .progress_fd = -1};
+
+// Connection of a striped TCP session.
+typedef struct {
+    int fd;
+    struct sockaddr_in address;
+    bool joined;  // sent CONN of the session
+    uint64_t end; // stream offset past the data read from it last
+} stripe_conn_t;
+
+// Connections of other clients accepted while a striped session was served,
+// which are served after it, in the order they came.
+static stripe_conn_t waiting[STRIPES_MAX];
+static int waiting_count;
+
+// Milliseconds to wait for a packet before the deadline of the session.
+static int wait_ms(const session_t* session, uint64_t now) {
+    uint64_t deadline = session_deadline(session);
+    if (deadline <= now) return 0;
+    return (int)((deadline - now + NS_PER_MS - 1) / NS_PER_MS);
+}
+
+// Print the counters of the session, with the I/O system calls made since it
+// was opened, all of them on its behalf.
+static void report(const server_config_t* config, session_t* session) {
+    if (!config->verbose) return;
+    session->stats.syscalls = stats.syscalls;
+    stats_report(session->session_id, &session->stats);
+}
+
+static bool write_replies(int fd, const reply_t* replies, int reply_count) {
+    for (int i = 0; i < reply_count; i++) {
+        if (!tcp_writen(fd, &replies[i].packet, replies[i].length)) {
+            error("failed to send reply (type_id=%u)",
+                  *(const uint8_t*)&replies[i].packet);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Read CONN from a TCP connection, with the transfer ID of one asking for
+// FEATURE_RESUME. Return false if the connection sent no valid CONN.
+static bool recv_conn(int fd, conn_t* conn, uint64_t* transfer_id) {
+    char buf[sizeof(conn_resume_t)];
+    size_t length = sizeof(conn_t);
+
+    if (!tcp_readn(fd, buf, length)) return false;
+    // CONN asking for resumption is longer.
+    if (buf[0] == CONN_ID &&
+        buf[offsetof(conn_t, protocol_id)] & FEATURE_RESUME)
+    {
+        length = sizeof(conn_resume_t);
+        if (!tcp_readn(fd, buf + sizeof(conn_t), length - sizeof(conn_t)))
+            return false;
+    }
+    return session_parse_conn(buf, length, conn, transfer_id);
+}
+
+// Look at the CONN header sent on a TCP connection without reading it.
+// Return false if the connection sent none in time.
+static bool peek_conn(int fd, conn_t* conn) {
+    ssize_t nrecv;
+
+    do {
+        stats.syscalls++;
+        nrecv = recv(fd, conn, sizeof(*conn), MSG_PEEK | MSG_WAITALL);
+    } while (nrecv < 0 && errno == EINTR);
+    if (nrecv != (ssize_t)sizeof(*conn)) {
+        error("failed to receive CONN");
+        return false;
+    }
+    return true;
+}
+
+// Move the payload of a DATA packet from the socket to stdout.
+static bool splice_payload(int fd, uint32_t packet_count) {
+    switch (splice_output(fd, packet_count)) {
+        case SPLICE_OK: return true;
+        case SPLICE_TIMEOUT: error("%s: timeout", __func__); return false;
+        case SPLICE_CLOSED:
+            error("%s: connection closed by peer", __func__);
+            return false;
+        case SPLICE_RECV_FAILED: error("%s: failed", __func__); return false;
+        case SPLICE_OUTPUT_FAILED: fatal("write to stdout failed");
+    }
+    return false;
+}
+
+// Read the next frame of the session from a TCP connection and hand it to
+// the session. The payload of DATA the session lets pass is spliced to
+// stdout without being read. Set data to the header read. Return false if
+// the connection failed.
+static bool recv_frame(int fd,
+                       session_t* session,
+                       data_t* data,
+                       reply_t* replies,
+                       int* reply_count) {
+    static char frame[MAX_FRAME];
+    *reply_count = 0;
+
+    if (!tcp_readn(fd, frame, sizeof(*data))) return false;
+    memcpy(data, frame, sizeof(*data));
+    uint32_t packet_count = be32toh(data->packet_count);
+
+    if (splice_output_active() && session_passes(session, data)) {
+        if (!splice_payload(fd, packet_count)) return false;
+        session_on_passed(session, data, monotonic_ns(), replies, reply_count);
+        return true;
+    }
+
+    // Anything but DATA of a valid size is passed on as it is, to be
+    // rejected.
+    size_t length = sizeof(*data);
+    if (data->type_id == DATA_ID && packet_count <= MAX_PACKET_COUNT) {
+        length = session_header_size(session) + packet_count;
+        if (!tcp_readn(fd, frame + sizeof(*data), length - sizeof(*data)))
+            return false;
+    }
+    session_on_packet(
+        session, frame, length, monotonic_ns(), replies, reply_count);
+    return true;
+}
+
+static void drop(stripe_conn_t* conn) {
+    tcp_disconnect(conn->fd, &conn->address);
+    conn->fd = -1;
+}
+
+// Serve a striped TCP session until it ends. More connections of the client
+// are accepted while it is served and join it with a CONN of the session.
+// The client opens them all before it sends DATA, so the listening socket is
+// left alone from the first DATA on. Connections of other clients accepted
+// before that wait, with their CONN unread, until the session ends. A
+// connection is read only while the data read from it last is less than
+// STRIPE_AHEAD_MAX past the stream written out, which bounds what the
+// session holds, as the data needed next is first on one of them. Replies go
+// to the first connection. Return false if a connection failed.
+static bool serve_striped(int listen_fd, int client_fd, session_t* session) {
+    stripe_conn_t conns[STRIPES_MAX] = {{.fd = client_fd, .joined = true}};
+    int conn_count = 1;
+    bool ok        = true;
+    bool sending   = false; // all connections of the client joined
+    reply_t replies[MAX_REPLIES];
+    int reply_count;
+    data_t data;
+    conn_t conn_packet;
+    uint64_t transfer_id;
+
+    // The listening socket is polled as index -1.
+    struct pollfd fds[STRIPES_MAX + 1];
+    int polled[STRIPES_MAX + 1];
+    int poll_count;
+    int ready;
+
+    while (ok && session->state == SESSION_ACTIVE) {
+        poll_count = 0;
+        if (!sending && conn_count + waiting_count < STRIPES_MAX) {
+            fds[poll_count]      = (struct pollfd){listen_fd, POLLIN, 0};
+            polled[poll_count++] = -1;
+        }
+        for (int i = 0; i < conn_count; i++) {
+            if (conns[i].joined &&
+                conns[i].end >= session->offset + STRIPE_AHEAD_MAX)
+                continue;
+            fds[poll_count]      = (struct pollfd){conns[i].fd, POLLIN, 0};
+            polled[poll_count++] = i;
+        }
+        do {
+            stats.syscalls++;
+            ready = poll(fds, poll_count, wait_ms(session, monotonic_ns()));
+        } while (ready < 0 && errno == EINTR);
+        ASSERT_SYS_OK(ready);
+        if (ready == 0) {
+            session_on_timer(session, monotonic_ns(), replies, &reply_count);
+            ok = write_replies(client_fd, replies, reply_count);
+            continue;
+        }
+
+        for (int j = 0; ok && session->state == SESSION_ACTIVE &&
+                        j < poll_count;
+             j++)
+        {
+            if (fds[j].revents == 0) continue;
+            if (polled[j] < 0) {
+                stripe_conn_t* conn = &conns[conn_count++];
+                conn->fd            = tcp_accept(listen_fd, &conn->address);
+                conn->joined        = false;
+                conn->end           = 0;
+                continue;
+            }
+            stripe_conn_t* conn = &conns[polled[j]];
+            if (conn->joined) {
+                ok = recv_frame(
+                         conn->fd, session, &data, replies, &reply_count) &&
+                     write_replies(client_fd, replies, reply_count);
+                if (ok) {
+                    conn->end = be64toh(data.packet_no) +
+                                be32toh(data.packet_count);
+                }
+                sending = true;
+                // Leave unread data to the TCP flow control.
+                writer_throttle();
+            }
+            else if (!peek_conn(conn->fd, &conn_packet)) {
+                drop(conn);
+            }
+            else if (conn_packet.type_id != CONN_ID ||
+                     be64toh(conn_packet.session_id) != session->session_id)
+            {
+                // A client of another session waits its turn.
+                waiting[waiting_count++] = *conn;
+                conn->fd                 = -1;
+            }
+            else if (!session_joins(session, &conn_packet)) {
+                error("CONN joining the session asks for protocol ID %u",
+                      conn_packet.protocol_id);
+                drop(conn);
+            }
+            else if (!recv_conn(conn->fd, &conn_packet, &transfer_id)) {
+                drop(conn);
+            }
+            else {
+                session_on_conn(
+                    session, monotonic_ns(), replies, &reply_count);
+                conn->joined = write_replies(conn->fd, replies, reply_count);
+                if (!conn->joined) drop(conn);
+            }
+        }
+
+        // Forget the connections closed or set aside.
+        int kept = 0;
+        for (int i = 0; i < conn_count; i++) {
+            if (conns[i].fd >= 0) conns[kept++] = conns[i];
+        }
+        conn_count = kept;
+    }
+
+    // The first connection is closed by the caller. One which sent no CONN
+    // yet may be of another client.
+    for (int i = 1; i < conn_count; i++) {
+        if (conns[i].joined) {
+            tcp_disconnect(conns[i].fd, &conns[i].address);
+        }
+        else {
+            waiting[waiting_count++] = conns[i];
+        }
+    }
+    return ok;
+}
+
+noreturn void tcp_serve_serial(int listen_fd, const server_config_t* config) {
+    reply_t replies[MAX_REPLIES];
+    int reply_count;
+    struct sockaddr_in address;
+    int client_fd;
+    conn_t conn;
+    uint64_t transfer_id;
+    data_t data;
+
+    while (1) {
+        // Clients which came during a striped session go first.
+        if (waiting_count > 0) {
+            client_fd = waiting[0].fd;
+            address   = waiting[0].address;
+            memmove(waiting, waiting + 1, --waiting_count * sizeof(waiting[0]));
+        }
+        else {
+            client_fd = tcp_accept(listen_fd, &address);
+        }
+
+        session_t* session = NULL;
+        if (!recv_conn(client_fd, &conn, &transfer_id)) {
+            error("failed to receive CONN");
+        }
+        else if (!session_accepts(&conn, TCP_ID)) {
+            error("received invalid CONN (protocol_id=%u)", conn.protocol_id);
+            if (session_reject((const char*)&conn, sizeof(conn), replies)) {
+                write_replies(client_fd, replies, 1);
+            }
+        }
+        else {
+            stats_reset();
+            session = session_open(&address,
+                                   &conn,
+                                   &stdout_sink,
+                                   &config->session,
+                                   monotonic_ns(),
+                                   replies,
+                                   &reply_count);
+            bool ok = write_replies(client_fd, replies, reply_count);
+            if (ok && session->stripes != NULL) {
+                ok = serve_striped(listen_fd, client_fd, session);
+            }
+            while (ok && session->state == SESSION_ACTIVE) {
+                ok = recv_frame(
+                         client_fd, session, &data, replies, &reply_count) &&
+                     write_replies(client_fd, replies, reply_count);
+                // Leave unread data to the TCP flow control.
+                writer_throttle();
+            }
+        }
+
+        tcp_disconnect(client_fd, &address);
+        if (session != NULL) {
+            report(config, session);
+            session_close(session);
+        }
+    }
+}
+
+// Serial UDP server, which serves one session at a time from its socket.
+typedef struct {
+    int socket_fd;
+    const server_config_t* config;
+    uint64_t socket_room; // bytes of DATA the socket buffer is trusted with
+    session_t* session;   // being served, if any
+    bool reported;        // the session received the whole stream
+} serial_server_t;
+
+static void close_session(serial_server_t* server) {
+    session_t* session = server->session;
+    if (!server->reported) report(server->config, session);
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &session->address.sin_addr, host, sizeof(host));
+    debug("stopped serving %s:%" PRIu16,
+          host,
+          ntohs(session->address.sin_port));
+    session_close(session);
+    server->session = NULL;
+}
+
+// Send the replies to the address, and close the session if it is over.
+static void settle(serial_server_t* server,
+                   const reply_t* replies,
+                   int reply_count,
+                   struct sockaddr_in address) {
+    session_t* session = server->session;
+
+    // The udpr client waits for ACC until the output catches up.
+    if (session != NULL && session->protocol_id == UDPR_ID) writer_throttle();
+    for (int i = 0; i < reply_count; i++) {
+        udp_sendto(server->socket_fd,
+                   &replies[i].packet,
+                   replies[i].length,
+                   &address);
+    }
+    if (session == NULL) return;
+    if (session->state == SESSION_CLOSED || session->state == SESSION_FAILED) {
+        close_session(server);
+    }
+    else if (session->state == SESSION_DONE && !server->reported) {
+        // Reported now rather than once the session stops lingering.
+        report(server->config, session);
+        server->reported = true;
+    }
+}
+
+// Handle a datagram from the given address. A finished session lingers only
+// until the next client comes, while CONN of any other client is rejected.
+static void handle_datagram(serial_server_t* server,
+                            const char* buf,
+                            size_t length,
+                            const struct sockaddr_in* address,
+                            uint64_t now) {
+    session_t* session = server->session;
+    reply_t replies[MAX_REPLIES];
+    int reply_count = 0;
+    uint64_t session_id;
+    uint64_t transfer_id;
+    conn_t conn;
+
+    if (length < sizeof(uint8_t) + sizeof(uint64_t)) {
+        error("received packet too short (size=%zu)", length);
+        return;
+    }
+    memcpy(&session_id, buf + sizeof(uint8_t), sizeof(session_id));
+    session_id = be64toh(session_id);
+
+    bool own = session != NULL && session->session_id == session_id &&
+               session->address.sin_addr.s_addr == address->sin_addr.s_addr &&
+               session->address.sin_port == address->sin_port;
+    if (own && buf[0] == CONN_ID) {
+        session_on_conn(session, now, replies, &reply_count);
+    }
+    else if (own) {
+        session_on_packet(session, buf, length, now, replies, &reply_count);
+    }
+    else if (buf[0] == CONN_ID) {
+        if (session != NULL && session->state == SESSION_DONE) {
+            close_session(server);
+        }
+        if (!session_parse_conn(buf, length, &conn, &transfer_id)) return;
+        bool accepted = session_accepts(&conn, UDP_ID);
+        if (!accepted) {
+            error("received invalid CONN (protocol_id=%u)", conn.protocol_id);
+        }
+        if (!accepted || server->session != NULL) {
+            // Not served, or another client is.
+            reply_count = session_reject(buf, length, replies) ? 1 : 0;
+        }
+        else {
+            session_config_t session_config = server->config->session;
+            // The output ring takes what the socket buffer would.
+            session_config.room = server->socket_room + writer_room();
+            stats_reset();
+            server->reported = false;
+            server->session  = session_open(address,
+                                            &conn,
+                                            &stdout_sink,
+                                            &session_config,
+                                            now,
+                                            replies,
+                                            &reply_count);
+            char host[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &address->sin_addr, host, sizeof(host));
+            debug("serving %s:%" PRIu16, host, ntohs(address->sin_port));
+        }
+    }
+    else {
+        // Packet of a session which is not served (any more).
+        error("received packet of unknown session %" PRIu64, session_id);
+        reply_count = session_reject(buf, length, replies) ? 1 : 0;
+    }
+    settle(server, replies, reply_count, *address);
+}
+
+noreturn void udp_serve_serial(int socket_fd, const server_config_t* config) {
+    static char buf[BUFFER_SIZE];
+    serial_server_t server = {
+        .socket_fd   = socket_fd,
+        .config      = config,
+        .socket_room = udp_window_room(socket_fd),
+    };
+    reply_t replies[MAX_REPLIES];
+    int reply_count;
+    struct sockaddr_in address;
+
+    while (1) {
+        uint64_t now       = monotonic_ns();
+        session_t* session = server.session;
+        int timeout_ms     = -1;
+        if (session != NULL) {
+            // The output ring takes what the socket buffer would, and while
+            // it lags behind, udpw acknowledgments are held back.
+            session->room       = server.socket_room + writer_room();
+            session->backlogged = writer_above_high_water();
+            if (session_deadline(session) <= now) {
+                session_on_timer(session, now, replies, &reply_count);
+                settle(&server, replies, reply_count, session->address);
+                continue;
+            }
+            timeout_ms = wait_ms(session, now);
+        }
+        if (!socket_wait(socket_fd, timeout_ms)) continue;
+
+        size_t length = sizeof(buf);
+        if (!udp_recvfrom(socket_fd, buf, &length, &address)) continue;
+        handle_datagram(&server, buf, length, &address, monotonic_ns());
+    }
+}
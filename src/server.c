@@ -0,0 +1,168 @@
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "affinity.h"
+#include "common.h"
+#include "err.h"
+#include "server.h"
+
+typedef struct {
+    uint8_t protocol_id;
+    int socket_fd;
+    int cpu;
+    const server_config_t* config;
+} worker_t;
+
+// Open the sink of a resumable transfer, dropping what it holds past the
+// offset in its progress file: those bytes may not have reached the disk.
+static bool open_transfer(const server_config_t* config,
+                          uint64_t total_count,
+                          uint64_t transfer_id,
+                          sink_t* sink) {
+    char path[PATH_MAX];
+    char progress_path[PATH_MAX];
+    snprintf(path,
+             sizeof(path),
+             "%s/transfer-%016" PRIx64,
+             config->output_dir,
+             transfer_id);
+    snprintf(progress_path,
+             sizeof(progress_path),
+             "%s/transfer-%016" PRIx64 ".progress",
+             config->output_dir,
+             transfer_id);
+
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (sink->fd < 0) {
+        error("cannot open %s", path);
+        return false;
+    }
+    // The session still writing the transfer holds it until it is closed.
+    if (flock(sink->fd, LOCK_EX | LOCK_NB) != 0) {
+        error("transfer %016" PRIx64 " is busy", transfer_id);
+        ASSERT_SYS_OK(close(sink->fd));
+        return false;
+    }
+    sink->progress_fd = open(progress_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (sink->progress_fd < 0) {
+        error("cannot open %s", progress_path);
+        ASSERT_SYS_OK(close(sink->fd));
+        return false;
+    }
+
+    // A transfer of another length, or a missing part of the sink, starts
+    // over.
+    progress_t progress;
+    struct stat st;
+    ssize_t nread = pread(sink->progress_fd, &progress, sizeof(progress), 0);
+    ASSERT_SYS_OK(fstat(sink->fd, &st));
+    if (nread == sizeof(progress) &&
+        be64toh(progress.total_count) == total_count &&
+        be64toh(progress.offset) <= total_count &&
+        be64toh(progress.offset) <= (uint64_t)st.st_size)
+    {
+        sink->offset = be64toh(progress.offset);
+    }
+    if (ftruncate(sink->fd, (off_t)sink->offset) != 0 ||
+        lseek(sink->fd, (off_t)sink->offset, SEEK_SET) < 0)
+    {
+        error("cannot truncate %s", path);
+        ASSERT_SYS_OK(close(sink->progress_fd));
+        ASSERT_SYS_OK(close(sink->fd));
+        return false;
+    }
+    sink->transfer_id = transfer_id;
+    debug("transfer %016" PRIx64 ": continuing at offset %" PRIu64,
+          transfer_id,
+          sink->offset);
+    return true;
+}
+
+bool server_open_sink(const server_config_t* config,
+                      const conn_t* conn,
+                      uint64_t transfer_id,
+                      sink_t* sink) {
+    *sink = (sink_t){.fd = -1, .progress_fd = -1, .offset = 0};
+    if (conn->protocol_id & FEATURE_RESUME) {
+        if (open_transfer(
+                config, be64toh(conn->total_count), transfer_id, sink))
+            return true;
+        *sink = (sink_t){.fd = -1, .progress_fd = -1, .offset = 0};
+        return false;
+    }
+
+    char path[PATH_MAX];
+    snprintf(path,
+             sizeof(path),
+             "%s/%016" PRIx64,
+             config->output_dir,
+             be64toh(conn->session_id));
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (sink->fd < 0) {
+        error("cannot open %s", path);
+    }
+    return sink->fd >= 0;
+}
+
+static noreturn void run_worker(const worker_t* worker) {
+    if (!pin_to_cpu(worker->cpu)) {
+        error("cannot pin worker to CPU %d", worker->cpu);
+    }
+    debug("worker on CPU %d serving socket %d", worker->cpu, worker->socket_fd);
+
+    if (worker->protocol_id == TCP_ID) {
+        tcp_serve(worker->socket_fd, worker->config);
+    }
+    udp_serve(worker->socket_fd, worker->config);
+}
+
+static void* worker_thread(void* arg) {
+    run_worker(arg);
+}
+
+noreturn void serve_sharded(uint8_t protocol_id,
+                            struct sockaddr_in* address,
+                            int worker_count,
+                            const server_config_t* config) {
+    worker_t* workers;
+    ASSERT_MALLOC_OK(workers = calloc(worker_count, sizeof(*workers)));
+
+    // Workers go round-robin over the CPUs the process may run on.
+    static int cpus[MAX_CPUS];
+    int cpu_count;
+    ASSERT_SYS_OK(cpu_count = allowed_cpus(cpus, MAX_CPUS));
+
+    // Bind all sockets before serving, the first one may pick the port.
+    for (int i = 0; i < worker_count; i++) {
+        worker_t* worker    = &workers[i];
+        worker->protocol_id = protocol_id;
+        worker->cpu         = cpus[i % cpu_count];
+        worker->config      = config;
+        worker->socket_fd   = protocol_id == TCP_ID ? tcp_listen(address, true)
+                                                    : udp_listen(address, true);
+
+        // Prefer the socket of the worker on the CPU handling the packet.
+        if (setsockopt(worker->socket_fd,
+                       SOL_SOCKET,
+                       SO_INCOMING_CPU,
+                       &worker->cpu,
+                       sizeof(worker->cpu)) < 0)
+        {
+            error("cannot set SO_INCOMING_CPU");
+        }
+    }
+
+    for (int i = 1; i < worker_count; i++) {
+        pthread_t thread;
+        ASSERT_ZERO(pthread_create(&thread, NULL, worker_thread, &workers[i]));
+        ASSERT_ZERO(pthread_detach(thread));
+    }
+    run_worker(&workers[0]);
+}
@@ -0,0 +1,49 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stdnoreturn.h>
+
+#include "session.h"
+
+// Settings of a server.
+typedef struct {
+    const char* output_dir; // each byte stream goes to its own file here,
+                            // NULL for the serial server
+    session_config_t session;
+    bool verbose;
+} server_config_t;
+
+// Open the file receiving the byte stream of a session. That of a CONN
+// asking for FEATURE_RESUME is named after the transfer, and continued from
+// the offset its progress file confirms.
+bool server_open_sink(const server_config_t* config,
+                      const conn_t* conn,
+                      uint64_t transfer_id,
+                      sink_t* sink);
+
+// Get the bytes of DATA a UDP socket is trusted to buffer for a session,
+// the room advertised to clients told how much they may send.
+uint64_t udp_window_room(int socket_fd);
+
+// Serve UDP sessions concurrently on one socket.
+noreturn void udp_serve(int socket_fd, const server_config_t* config);
+
+// Serve TCP connections concurrently from one event loop.
+noreturn void tcp_serve(int listen_fd, const server_config_t* config);
+
+// Serve one UDP session at a time, writing its byte stream to stdout.
+noreturn void udp_serve_serial(int socket_fd, const server_config_t* config);
+
+// Serve one TCP client at a time, writing its byte stream to stdout, or the
+// connections of one striped session.
+noreturn void tcp_serve_serial(int listen_fd, const server_config_t* config);
+
+// Serve from worker_count threads pinned to CPUs, each with its own socket
+// bound to the same port.
+noreturn void serve_sharded(uint8_t protocol_id,
+                            struct sockaddr_in* address,
+                            int worker_count,
+                            const server_config_t* config);
+
+#endif
@@ -0,0 +1,1087 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "crc32c.h"
+#include "err.h"
+#include "lz.h"
+#include "protconst.h"
+#include "session.h"
+
+#define MAX_WAIT_NS ((uint64_t)MAX_WAIT * NS_PER_SEC)
+
+// A finished session outlives the client's retransmission timeout, so a lost
+// RCVD is repeated when the client retransmits its last DATA.
+#define LINGER_NS (2 * MAX_WAIT_NS)
+
+// How long an acknowledgment held back while the output lags behind waits
+// before the output is checked again.
+#define ACK_HOLD_NS (1 * NS_PER_MS)
+
+// How long a session advertising its window waits for DATA before it
+// repeats WND, in case the client missed the last one and waits for room.
+#define WND_REPEAT_NS (20 * NS_PER_MS)
+
+// Payload of the frame decoded last. Sessions of a sharded server are
+// handled by several threads.
+static _Thread_local char payload[MAX_PACKET_COUNT];
+
+static reply_t* add_reply(reply_t* replies, int* reply_count, size_t length) {
+    reply_t* reply = &replies[(*reply_count)++];
+    reply->length  = length;
+    return reply;
+}
+
+// Check if the client is told how much it may send, as it gets no
+// acknowledgments to be held back.
+static bool flow_controlled(const session_t* session) {
+    return session->protocol_id == UDP_ID || session->protocol_id == UDPF_ID;
+}
+
+// Get the next expected packet number, or the stream offset in a striped
+// session.
+static uint64_t next_expected(const session_t* session) {
+    if (session->fec != NULL) return session->fec->next_packet_no;
+    if (session->stripes != NULL) return session->stripes->next_offset;
+    return session->window.next_packet_no;
+}
+
+// Check if DATA was received, so that the client got CONACC.
+static bool started(const session_t* session) {
+    return session->stats.data_packets > 0;
+}
+
+// Reply with CONACC, which agrees to the features asked for which the
+// transport supports. Resumption continues from the offset of the sink.
+static void reply_CONACC(session_t* session,
+                         reply_t* replies,
+                         int* reply_count) {
+    uint8_t asked = session->asked_features;
+    size_t length = asked & FEATURE_RESUME ? sizeof(conacc_resume_t)
+                    : asked                ? sizeof(conacc_ext_t)
+                                           : sizeof(conacc_t);
+    conacc_resume_t* conacc =
+        &add_reply(replies, reply_count, length)->packet.conacc_resume;
+    conacc->type_id    = CONACC_ID;
+    conacc->session_id = htobe64(session->session_id);
+    conacc->features   = session->features;
+    conacc->offset     = htobe64(session->sink.offset);
+    debug("session %" PRIu64 ": sending CONACC (features=%#x)",
+          session->session_id,
+          session->features);
+}
+
+static void reply_ACC(session_t* session,
+                      uint64_t packet_no,
+                      reply_t* replies,
+                      int* reply_count) {
+    acc_t* acc =
+        &add_reply(replies, reply_count, sizeof(acc_t))->packet.acc;
+    acc->type_id    = ACC_ID;
+    acc->session_id = htobe64(session->session_id);
+    acc->packet_no  = htobe64(packet_no);
+    session->stats.acks++;
+    debug("session %" PRIu64 ": sending ACC (packet_no=%" PRIu64 ")",
+          session->session_id,
+          packet_no);
+}
+
+static void reply_SACK(session_t* session,
+                       reply_t* replies,
+                       int* reply_count) {
+    sack_t* sack =
+        &add_reply(replies, reply_count, sizeof(sack_t))->packet.sack;
+    sack->type_id    = SACK_ID;
+    sack->session_id = htobe64(session->session_id);
+    sack->packet_no  = htobe64(session->window.next_packet_no);
+    sack->bitmap     = htobe64(recv_window_bitmap(&session->window));
+    session->stats.acks++;
+    debug("session %" PRIu64 ": sending SACK (packet_no=%" PRIu64 ")",
+          session->session_id,
+          session->window.next_packet_no);
+}
+
+static void reply_RJT(uint64_t session_id,
+                      uint64_t packet_no,
+                      reply_t* replies,
+                      int* reply_count) {
+    rjt_t* rjt =
+        &add_reply(replies, reply_count, sizeof(rjt_t))->packet.rjt;
+    rjt->type_id    = RJT_ID;
+    rjt->session_id = htobe64(session_id);
+    rjt->packet_no  = htobe64(packet_no);
+    debug("session %" PRIu64 ": sending RJT (packet_no=%" PRIu64 ")",
+          session_id,
+          packet_no);
+}
+
+static void reply_NAK(session_t* session,
+                      uint64_t packet_no,
+                      reply_t* replies,
+                      int* reply_count) {
+    nak_t* nak =
+        &add_reply(replies, reply_count, sizeof(nak_t))->packet.nak;
+    nak->type_id    = NAK_ID;
+    nak->session_id = htobe64(session->session_id);
+    nak->packet_no  = htobe64(packet_no);
+    debug("session %" PRIu64 ": sending NAK (packet_no=%" PRIu64 ")",
+          session->session_id,
+          packet_no);
+}
+
+// Reply with RCVD, with the checksum of the stream in a session with
+// checksums.
+static void reply_RCVD(session_t* session,
+                       reply_t* replies,
+                       int* reply_count) {
+    size_t length = session->features & FEATURE_CRC ? sizeof(rcvd_ext_t)
+                                                    : sizeof(rcvd_t);
+    rcvd_ext_t* rcvd =
+        &add_reply(replies, reply_count, length)->packet.rcvd_ext;
+    rcvd->type_id    = RCVD_ID;
+    rcvd->session_id = htobe64(session->session_id);
+    rcvd->crc        = htobe32(session->stream_crc);
+    debug("session %" PRIu64 ": sending RCVD", session->session_id);
+}
+
+// Advertise the room for DATA past the stream received so far. An update
+// goes out once the client used up half of the window or has no room left
+// for a packet of any size, and when forced. The window never shrinks.
+static void advertise(session_t* session,
+                      bool force,
+                      uint64_t now,
+                      reply_t* replies,
+                      int* reply_count) {
+    uint64_t received = session->offset - session->sink.offset;
+    uint64_t limit    = received + session->room;
+    uint64_t size     = session->left < MAX_PACKET_COUNT ? session->left
+                                                         : MAX_PACKET_COUNT;
+    if (limit <= session->limit) {
+        if (!force) return;
+        limit = session->limit;
+    }
+    else if (!force && session->limit - received >= session->room / 2 &&
+             received + size <= session->limit)
+    {
+        return;
+    }
+    session->limit        = limit;
+    session->wnd_deadline = now + WND_REPEAT_NS;
+
+    wnd_t* wnd = &add_reply(replies, reply_count, sizeof(wnd_t))->packet.wnd;
+    wnd->type_id    = WND_ID;
+    wnd->session_id = htobe64(session->session_id);
+    wnd->limit      = htobe64(limit);
+    debug("session %" PRIu64 ": sending WND (limit=%" PRIu64 ")",
+          session->session_id,
+          limit);
+}
+
+// Acknowledge all packets released from the window with cumulative ACC, or
+// with SACK if some packets after them are buffered (udpw mode).
+static void reply_window_ack(session_t* session,
+                             reply_t* replies,
+                             int* reply_count) {
+    recv_window_t* window = &session->window;
+    if (recv_window_bitmap(window) == 0 && window->next_packet_no > START_NO) {
+        reply_ACC(session, window->next_packet_no - 1, replies, reply_count);
+    }
+    else {
+        reply_SACK(session, replies, reply_count);
+    }
+    session->pending = 0;
+}
+
+// Repeat the latest acknowledgment after a timeout or a duplicate packet.
+static void reply_last_ack(session_t* session,
+                           reply_t* replies,
+                           int* reply_count) {
+    if (!started(session)) {
+        reply_CONACC(session, replies, reply_count);
+    }
+    else if (session->protocol_id == UDPW_ID) {
+        reply_window_ack(session, replies, reply_count);
+    }
+    else {
+        reply_ACC(session,
+                  session->window.next_packet_no - 1,
+                  replies,
+                  reply_count);
+    }
+}
+
+static void fail(session_t* session, reply_t* replies, int* reply_count) {
+    reply_RJT(session->session_id,
+              next_expected(session),
+              replies,
+              reply_count);
+    session->state = SESSION_FAILED;
+}
+
+// Record the offset of a resumable transfer in its progress file, once the
+// sink holds everything before it.
+static bool save_progress(session_t* session) {
+    if (session->sink.progress_fd < 0 || session->synced == session->offset)
+        return true;
+
+    progress_t progress = {
+        .total_count = htobe64(session->total_count),
+        .offset      = htobe64(session->offset),
+    };
+    if (fdatasync(session->sink.fd) != 0 ||
+        pwrite(session->sink.progress_fd, &progress, sizeof(progress), 0) !=
+            sizeof(progress))
+    {
+        error("session %" PRIu64 ": cannot save progress",
+              session->session_id);
+        return false;
+    }
+    session->synced = session->offset;
+    debug("session %" PRIu64 ": saved progress (offset=%" PRIu64 ")",
+          session->session_id,
+          session->offset);
+    return true;
+}
+
+// Count packet_count bytes of the stream as written to the sink.
+static bool advance(session_t* session, uint32_t packet_count) {
+    // Empty DATA terminates a stream of unknown length.
+    session->left = packet_count == 0 ? 0 : session->left - packet_count;
+    session->offset += packet_count;
+
+    // The whole transfer is confirmed before RCVD.
+    if (session->left == 0 ||
+        session->offset - session->synced >= RESUME_SYNC_BYTES)
+    {
+        return save_progress(session);
+    }
+    return true;
+}
+
+// Write the payload of the next part of the stream to the sink.
+static bool deliver(session_t* session,
+                    const char* packet,
+                    uint32_t packet_count) {
+    if (packet_count > session->left) {
+        error("session %" PRIu64 ": received too many bytes",
+              session->session_id);
+        return false;
+    }
+    if (session->sink.fd == STDOUT_FILENO) {
+        print_packet(packet, packet_count);
+    }
+    else if (!tcp_writen(session->sink.fd, packet, packet_count)) {
+        error("session %" PRIu64 ": write to sink failed",
+              session->session_id);
+        return false;
+    }
+    if (session->features & FEATURE_CRC) {
+        session->stream_crc =
+            crc32c(session->stream_crc, packet, packet_count);
+    }
+    return advance(session, packet_count);
+}
+
+// Replace a DATA frame of a session with FEATURE_LZ by the payload it
+// carries, valid until the next call. Empty DATA stays empty.
+static bool decode(session_t* session,
+                   const char** packet,
+                   uint32_t* packet_count) {
+    if (!(session->features & FEATURE_LZ) || *packet_count == 0) return true;
+
+    uint32_t frame_count = *packet_count;
+    if (!lz_frame_decode(*packet, frame_count, payload, packet_count)) {
+        error("session %" PRIu64 ": invalid DATA frame (packet_count=%u)",
+              session->session_id,
+              frame_count);
+        return false;
+    }
+    *packet = payload;
+    return true;
+}
+
+// The whole stream was received: reply with RCVD, once the output holds it.
+static void finish(session_t* session,
+                   uint64_t now,
+                   reply_t* replies,
+                   int* reply_count) {
+    debug("session %" PRIu64 ": received %" PRIu64 " bytes",
+          session->session_id,
+          session->offset - session->sink.offset);
+    if (session->sink.fd == STDOUT_FILENO) print_flush();
+    session->pending  = 0;
+    session->state    = SESSION_DONE;
+    session->deadline = now + LINGER_NS;
+    reply_RCVD(session, replies, reply_count);
+}
+
+// Handle DATA of a striped session, whose packet number is the stream
+// offset of the payload. Every connection carries DATA in stream order, but
+// ahead of or behind the others, so the payload is held until the stream
+// before it is released. An empty DATA sets the end of a stream of unknown
+// length.
+static void on_stripe_data(session_t* session,
+                           uint64_t offset,
+                           const char* packet,
+                           uint32_t packet_count,
+                           uint64_t now,
+                           reply_t* replies,
+                           int* reply_count) {
+    stripe_window_t* window = session->stripes;
+    char* held;
+    uint32_t held_count;
+
+    if (offset < window->next_offset ||
+        offset - window->next_offset + packet_count > session->left)
+    {
+        error("session %" PRIu64 ": DATA outside of the byte stream "
+              "(offset=%" PRIu64 ")",
+              session->session_id,
+              offset);
+        fail(session, replies, reply_count);
+        return;
+    }
+
+    bool ok = true;
+    if (packet_count == 0) {
+        session->left = offset - window->next_offset;
+    }
+    else if (offset == window->next_offset) {
+        ok = deliver(session, packet, packet_count);
+        stripe_window_advance(window, packet_count);
+    }
+    else {
+        stripe_window_store(window, offset, packet, packet_count);
+    }
+    // The data may have filled the gap before data held.
+    while (ok && session->left > 0 &&
+           stripe_window_peek(window, &held, &held_count))
+    {
+        ok = deliver(session, held, held_count);
+        stripe_window_advance(window, held_count);
+    }
+
+    if (!ok) fail(session, replies, reply_count);
+    else if (session->left == 0) finish(session, now, replies, reply_count);
+}
+
+// Rebuild what the parity of the udpf mode allows and release the packets
+// held in order. Nothing is acknowledged or retransmitted, so the stream
+// fails if a block loses more packets than it has parity for.
+static void release_fec(session_t* session,
+                        uint64_t now,
+                        reply_t* replies,
+                        int* reply_count) {
+    fec_window_t* window = session->fec;
+    char* held;
+    uint32_t held_count;
+
+    int rebuilt = fec_window_rebuild(window);
+    if (rebuilt < 0) {
+        error("session %" PRIu64 ": rebuilt invalid DATA", session->session_id);
+        fail(session, replies, reply_count);
+        return;
+    }
+    if (rebuilt > 0) {
+        debug("session %" PRIu64 ": rebuilt %d DATA packets",
+              session->session_id,
+              rebuilt);
+        session->stats.rebuilt += (uint64_t)rebuilt;
+    }
+
+    while (session->left > 0 && fec_window_peek(window, &held, &held_count)) {
+        const char* packet = held;
+        if (!decode(session, &packet, &held_count) ||
+            !deliver(session, packet, held_count))
+        {
+            fail(session, replies, reply_count);
+            return;
+        }
+        fec_window_advance(window);
+    }
+
+    if (session->left == 0) finish(session, now, replies, reply_count);
+    else advertise(session, false, now, replies, reply_count);
+}
+
+// Handle PAR of the udpf mode.
+static void on_parity(session_t* session,
+                      const char* buf,
+                      size_t length,
+                      uint64_t now,
+                      reply_t* replies,
+                      int* reply_count) {
+    par_t par;
+
+    if (length < sizeof(par)) {
+        error("session %" PRIu64 ": invalid PAR (size=%zu)",
+              session->session_id,
+              length);
+        fail(session, replies, reply_count);
+        return;
+    }
+    memcpy(&par, buf, sizeof(par));
+    uint64_t first_packet_no = be64toh(par.packet_no);
+    uint32_t parity_count    = be32toh(par.packet_count);
+    if (par.data_count < 1 || par.data_count > FEC_DATA_MAX ||
+        par.parity_count < 1 || par.parity_count > FEC_PARITY_MAX ||
+        par.parity_no >= par.parity_count ||
+        parity_count < sizeof(uint32_t) || parity_count > FEC_SYMBOL_MAX ||
+        length != sizeof(par) + parity_count)
+    {
+        error("session %" PRIu64 ": invalid PAR (data_count=%u, "
+              "parity_count=%u, parity_no=%u, packet_count=%u)",
+              session->session_id,
+              par.data_count,
+              par.parity_count,
+              par.parity_no,
+              parity_count);
+        fail(session, replies, reply_count);
+        return;
+    }
+
+    session->deadline     = now + MAX_WAIT_NS;
+    session->wnd_deadline = now + WND_REPEAT_NS;
+    if (!fec_window_store_parity(session->fec,
+                                 first_packet_no,
+                                 par.data_count,
+                                 par.parity_no,
+                                 buf + sizeof(par),
+                                 parity_count))
+    {
+        error("session %" PRIu64 ": PAR beyond the blocks held "
+              "(packet_no=%" PRIu64 ")",
+              session->session_id,
+              first_packet_no);
+        fail(session, replies, reply_count);
+        return;
+    }
+    release_fec(session, now, replies, reply_count);
+}
+
+// Handle DATA of the udpf mode.
+static void on_fec_data(session_t* session,
+                        uint64_t packet_no,
+                        const char* packet,
+                        uint32_t packet_count,
+                        uint64_t now,
+                        reply_t* replies,
+                        int* reply_count) {
+    // Released already, or rebuilt before it came.
+    if (packet_no < session->fec->next_packet_no) return;
+
+    session->stats.data_packets++;
+    session->stats.data_bytes += packet_count;
+    session->deadline     = now + MAX_WAIT_NS;
+    session->wnd_deadline = now + WND_REPEAT_NS;
+    if (!fec_window_store(session->fec, packet_no, packet, packet_count)) {
+        error("session %" PRIu64 ": DATA beyond the blocks held "
+              "(packet_no=%" PRIu64 ")",
+              session->session_id,
+              packet_no);
+        fail(session, replies, reply_count);
+        return;
+    }
+    release_fec(session, now, replies, reply_count);
+}
+
+// Check the header and the size of a DATA packet, and its checksum in a
+// session with checksums. Return false if it is invalid, and set checked
+// to false if only the checksum does not match.
+static bool parse_data(const session_t* session,
+                       const char* buf,
+                       size_t length,
+                       data_t* data,
+                       const char** packet,
+                       bool* checked) {
+    size_t header   = session_header_size(session);
+    bool open_ended = session->total_count == UNKNOWN_COUNT;
+    *checked        = true;
+
+    if (length < header || buf[0] != DATA_ID) {
+        error("session %" PRIu64 ": unexpected packet (type_id=%u, size=%zu)",
+              session->session_id,
+              (uint8_t)buf[0],
+              length);
+        return false;
+    }
+
+    memcpy(data, buf, sizeof(*data));
+    uint32_t packet_count = be32toh(data->packet_count);
+    if (be64toh(data->session_id) != session->session_id ||
+        (packet_count < 1 && !open_ended) || MAX_PACKET_COUNT < packet_count ||
+        length != header + packet_count)
+    {
+        error("session %" PRIu64 ": invalid DATA (packet_count=%u, size=%zu)",
+              session->session_id,
+              packet_count,
+              length);
+        return false;
+    }
+    *packet = buf + header;
+
+    if (session->features & FEATURE_CRC) {
+        data_ext_t data_ext;
+        memcpy(&data_ext, buf, sizeof(data_ext));
+        uint32_t crc =
+            crc32c(crc32c(0, buf, sizeof(data_t)), *packet, packet_count);
+        if (crc != be32toh(data_ext.crc)) {
+            error("session %" PRIu64 ": DATA checksum mismatch "
+                  "(packet_no=%" PRIu64 ")",
+                  session->session_id,
+                  be64toh(data->packet_no));
+            *checked = false;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool session_parse_conn(const char* buf,
+                        size_t length,
+                        conn_t* conn,
+                        uint64_t* transfer_id) {
+    *transfer_id = 0;
+    if (length < sizeof(*conn) || buf[0] != CONN_ID) {
+        error("received invalid CONN (size=%zu)", length);
+        return false;
+    }
+    memcpy(conn, buf, sizeof(*conn));
+    // Only a CONN resuming a transfer carries its ID.
+    size_t expected = conn->protocol_id & FEATURE_RESUME ? sizeof(conn_resume_t)
+                                                         : sizeof(conn_t);
+    if (length != expected) {
+        error("received invalid CONN (size=%zu)", length);
+        return false;
+    }
+    if (conn->protocol_id & FEATURE_RESUME) {
+        memcpy(transfer_id,
+               buf + offsetof(conn_resume_t, transfer_id),
+               sizeof(*transfer_id));
+        *transfer_id = be64toh(*transfer_id);
+    }
+    return true;
+}
+
+bool session_accepts(const conn_t* conn, uint8_t server_protocol_id) {
+    uint8_t client = conn->protocol_id & ~FEATURE_MASK;
+    if (conn->type_id != CONN_ID) return false;
+    if (server_protocol_id == TCP_ID) return client == TCP_ID;
+    return client == UDP_ID || client == UDPR_ID || client == UDPW_ID ||
+           client == UDPF_ID;
+}
+
+session_t* session_open(const struct sockaddr_in* address,
+                        const conn_t* conn,
+                        const sink_t* sink,
+                        const session_config_t* config,
+                        uint64_t now,
+                        reply_t* replies,
+                        int* reply_count) {
+    *reply_count = 0;
+
+    session_t* session;
+    ASSERT_MALLOC_OK(session = calloc(1, sizeof(*session)));
+    session->address        = *address;
+    session->session_id     = be64toh(conn->session_id);
+    session->protocol_id    = conn->protocol_id & ~FEATURE_MASK;
+    session->asked_features = conn->protocol_id & FEATURE_MASK;
+    session->features       = session->asked_features & config->features;
+    session->state          = SESSION_ACTIVE;
+    session->total_count    = be64toh(conn->total_count);
+    session->left           = session->total_count == UNKNOWN_COUNT
+                                  ? UNKNOWN_COUNT
+                                  : session->total_count - sink->offset;
+    session->ack_policy     = config->ack_policy;
+    session->deadline       = now + MAX_WAIT_NS;
+    session->room           = config->room;
+    session->sink           = *sink;
+    session->offset         = sink->offset;
+    session->synced         = sink->offset;
+    recv_window_init(&session->window);
+
+    // Only TCP sessions are striped.
+    if (session->protocol_id != TCP_ID) session->features &= ~FEATURE_STRIPE;
+    if (session->protocol_id == UDPF_ID) {
+        ASSERT_MALLOC_OK(session->fec = calloc(1, sizeof(*session->fec)));
+        fec_window_reset(session->fec);
+    }
+    if (session->features & FEATURE_STRIPE) {
+        ASSERT_MALLOC_OK(
+            session->stripes = malloc(sizeof(*session->stripes)));
+        stripe_window_init(session->stripes);
+        session->stripes->next_offset = sink->offset;
+    }
+
+    debug("session %" PRIu64 ": opened (protocol_id=%u, features=%#x, "
+          "total_count=%" PRIu64 ", offset=%" PRIu64 ")",
+          session->session_id,
+          session->protocol_id,
+          session->features,
+          session->total_count,
+          session->offset);
+
+    // A stream of zero length is complete at once.
+    if (session->left == 0) {
+        reply_CONACC(session, replies, reply_count);
+        finish(session, now, replies, reply_count);
+        return session;
+    }
+
+    // The first window goes out on both sides of CONACC, to be there when
+    // sending starts even if one copy is lost.
+    if (flow_controlled(session)) {
+        advertise(session, true, now, replies, reply_count);
+    }
+    reply_CONACC(session, replies, reply_count);
+    if (flow_controlled(session)) {
+        advertise(session, true, now, replies, reply_count);
+    }
+    return session;
+}
+
+void session_close(session_t* session) {
+    debug("session %" PRIu64 ": closed", session->session_id);
+    // A failed transfer is resumed after what was written of it.
+    if (session->sink.progress_fd >= 0) {
+        save_progress(session);
+        ASSERT_SYS_OK(close(session->sink.progress_fd));
+    }
+    if (session->sink.fd >= 0 && session->sink.fd != STDOUT_FILENO) {
+        ASSERT_SYS_OK(close(session->sink.fd));
+    }
+    recv_window_free(&session->window);
+    if (session->fec != NULL) {
+        fec_window_free(session->fec);
+        free(session->fec);
+    }
+    if (session->stripes != NULL) {
+        stripe_window_free(session->stripes);
+        free(session->stripes);
+    }
+    free(session);
+}
+
+size_t session_header_size(const session_t* session) {
+    return session->features & FEATURE_CRC ? sizeof(data_ext_t)
+                                           : sizeof(data_t);
+}
+
+void session_on_packet(session_t* session,
+                       const char* buf,
+                       size_t length,
+                       uint64_t now,
+                       reply_t* replies,
+                       int* reply_count) {
+    *reply_count          = 0;
+    recv_window_t* window = &session->window;
+    data_t data;
+    const char* packet;
+    bool checked;
+
+    // The client missed RCVD and is still retransmitting. Parity trailing
+    // the last block of the udpf mode needs no answer.
+    if (session->state == SESSION_DONE) {
+        if (buf[0] == PAR_ID) return;
+        session->deadline = now + LINGER_NS;
+        reply_RCVD(session, replies, reply_count);
+        return;
+    }
+
+    if (session->fec != NULL && buf[0] == PAR_ID) {
+        on_parity(session, buf, length, now, replies, reply_count);
+        return;
+    }
+
+    if (!parse_data(session, buf, length, &data, &packet, &checked)) {
+        // A corrupted packet is retransmitted in reliable modes, and
+        // rebuilt like a lost one in udpf mode.
+        if (checked) {
+            fail(session, replies, reply_count);
+        }
+        else if (session->protocol_id == UDPR_ID ||
+                 session->protocol_id == UDPW_ID)
+        {
+            reply_NAK(
+                session, be64toh(data.packet_no), replies, reply_count);
+        }
+        else if (session->protocol_id != UDPF_ID) {
+            fail(session, replies, reply_count);
+        }
+        return;
+    }
+    uint64_t packet_no    = be64toh(data.packet_no);
+    uint32_t packet_count = be32toh(data.packet_count);
+
+    if (session->fec != NULL) {
+        on_fec_data(session,
+                    packet_no,
+                    packet,
+                    packet_count,
+                    now,
+                    replies,
+                    reply_count);
+        return;
+    }
+
+    // Old packet from a client which missed the acknowledgment.
+    if (packet_no < window->next_packet_no &&
+        (session->protocol_id == UDPR_ID || session->protocol_id == UDPW_ID))
+    {
+        reply_last_ack(session, replies, reply_count);
+        return;
+    }
+
+    bool ahead = packet_no > window->next_packet_no;
+    if (session->stripes == NULL &&
+        (packet_no < window->next_packet_no ||
+         (ahead && session->protocol_id != UDPW_ID) ||
+         packet_no - window->next_packet_no >= WINDOW_MAX))
+    {
+        error("session %" PRIu64 ": unexpected packet number %" PRIu64
+              " (expected %" PRIu64 ")",
+              session->session_id,
+              packet_no,
+              window->next_packet_no);
+        fail(session, replies, reply_count);
+        return;
+    }
+
+    session->stats.data_packets++;
+    session->stats.data_bytes += packet_count;
+    session->retransmits  = 0;
+    session->deadline     = now + MAX_WAIT_NS;
+    session->wnd_deadline = now + WND_REPEAT_NS;
+
+    if (!decode(session, &packet, &packet_count)) {
+        fail(session, replies, reply_count);
+        return;
+    }
+
+    if (session->stripes != NULL) {
+        on_stripe_data(session,
+                       packet_no,
+                       packet,
+                       packet_count,
+                       now,
+                       replies,
+                       reply_count);
+        return;
+    }
+
+    // Gaps are reported at once for the client to retransmit soon.
+    if (ahead) {
+        recv_window_store(window, packet_no, packet, packet_count);
+        reply_window_ack(session, replies, reply_count);
+        return;
+    }
+
+    // Release the packet and the ones buffered right after it.
+    bool ok = deliver(session, packet, packet_count);
+    recv_window_advance(window);
+    char* buffered;
+    uint32_t buffered_count;
+    while (ok && session->left > 0 &&
+           recv_window_peek(window, &buffered, &buffered_count))
+    {
+        ok = deliver(session, buffered, buffered_count);
+        recv_window_advance(window);
+    }
+    if (!ok) {
+        fail(session, replies, reply_count);
+        return;
+    }
+
+    if (session->protocol_id == UDPR_ID) {
+        reply_ACC(session, packet_no, replies, reply_count);
+    }
+    else if (session->protocol_id == UDPW_ID && session->left > 0) {
+        // While the output lags behind, the client's window stops.
+        if (recv_window_bitmap(window) != 0 ||
+            (++session->pending >= session->ack_policy.every &&
+             !session->backlogged))
+        {
+            reply_window_ack(session, replies, reply_count);
+        }
+        else if (session->pending == 1) {
+            session->ack_deadline = now + session->ack_policy.delay_ns;
+        }
+    }
+    else if (flow_controlled(session) && session->left > 0) {
+        advertise(session, false, now, replies, reply_count);
+    }
+
+    if (session->left == 0) finish(session, now, replies, reply_count);
+}
+
+bool session_passes(const session_t* session, const data_t* data) {
+    uint32_t packet_count = be32toh(data->packet_count);
+    bool open_ended       = session->total_count == UNKNOWN_COUNT;
+    return session->protocol_id == TCP_ID &&
+           session->state == SESSION_ACTIVE &&
+           !(session->features & (FEATURE_LZ | FEATURE_CRC | FEATURE_STRIPE)) &&
+           data->type_id == DATA_ID &&
+           be64toh(data->session_id) == session->session_id &&
+           be64toh(data->packet_no) == session->window.next_packet_no &&
+           (packet_count > 0 || open_ended) &&
+           packet_count <= MAX_PACKET_COUNT && packet_count <= session->left;
+}
+
+void session_on_passed(session_t* session,
+                       const data_t* data,
+                       uint64_t now,
+                       reply_t* replies,
+                       int* reply_count) {
+    uint32_t packet_count = be32toh(data->packet_count);
+    *reply_count          = 0;
+
+    session->stats.data_packets++;
+    session->stats.data_bytes += packet_count;
+    session->deadline = now + MAX_WAIT_NS;
+    if (!advance(session, packet_count)) {
+        fail(session, replies, reply_count);
+        return;
+    }
+    recv_window_advance(&session->window);
+    if (session->left == 0) finish(session, now, replies, reply_count);
+}
+
+bool session_joins(const session_t* session, const conn_t* conn) {
+    return session->stripes != NULL && session->state == SESSION_ACTIVE &&
+           conn->type_id == CONN_ID &&
+           be64toh(conn->session_id) == session->session_id &&
+           conn->protocol_id ==
+               (session->protocol_id | session->asked_features);
+}
+
+void session_on_conn(session_t* session,
+                     uint64_t now,
+                     reply_t* replies,
+                     int* reply_count) {
+    *reply_count = 0;
+
+    // Only the handshake may be repeated, the client missed CONACC.
+    if (session->state == SESSION_ACTIVE && !started(session)) {
+        reply_CONACC(session, replies, reply_count);
+        if (flow_controlled(session)) {
+            advertise(session, true, now, replies, reply_count);
+        }
+    }
+}
+
+void session_on_timer(session_t* session,
+                      uint64_t now,
+                      reply_t* replies,
+                      int* reply_count) {
+    *reply_count = 0;
+
+    if (session->pending > 0 && session->ack_deadline <= now) {
+        if (session->backlogged) {
+            session->ack_deadline = now + ACK_HOLD_NS;
+        }
+        else {
+            reply_window_ack(session, replies, reply_count);
+        }
+    }
+
+    if (flow_controlled(session) && session->state == SESSION_ACTIVE &&
+        session->wnd_deadline <= now)
+    {
+        advertise(session, true, now, replies, reply_count);
+    }
+
+    if (session->deadline > now) return;
+
+    if (session->state == SESSION_DONE) {
+        session->state = SESSION_CLOSED;
+        return;
+    }
+
+    if (session->protocol_id != UDPR_ID && session->protocol_id != UDPW_ID) {
+        error("session %" PRIu64 ": no DATA for %d s",
+              session->session_id,
+              MAX_WAIT);
+        session->state = SESSION_FAILED;
+        return;
+    }
+
+    if (++session->retransmits > MAX_RETRANSMITS) {
+        error("session %" PRIu64 ": failed to retransmit acknowledgment",
+              session->session_id);
+        session->state = SESSION_FAILED;
+        return;
+    }
+    debug("session %" PRIu64 ": attempt %d to retransmit acknowledgment",
+          session->session_id,
+          session->retransmits);
+    reply_last_ack(session, replies, reply_count);
+    session->deadline = now + MAX_WAIT_NS;
+}
+
+uint64_t session_deadline(const session_t* session) {
+    uint64_t deadline = session->deadline;
+    if (session->pending > 0 && session->ack_deadline < deadline) {
+        deadline = session->ack_deadline;
+    }
+    if (flow_controlled(session) && session->state == SESSION_ACTIVE &&
+        session->wnd_deadline < deadline)
+    {
+        deadline = session->wnd_deadline;
+    }
+    return deadline;
+}
+
+bool session_reject(const char* buf, size_t length, reply_t* reply) {
+    uint64_t session_id, packet_no = 0;
+    int reply_count = 0;
+
+    if (length < sizeof(uint8_t) + sizeof(uint64_t)) return false;
+    memcpy(&session_id, buf + sizeof(uint8_t), sizeof(session_id));
+    session_id = be64toh(session_id);
+
+    if (buf[0] == CONN_ID) {
+        conrjt_t* conrjt =
+            &add_reply(reply, &reply_count, sizeof(conrjt_t))->packet.conrjt;
+        conrjt->type_id    = CONRJT_ID;
+        conrjt->session_id = htobe64(session_id);
+        debug("session %" PRIu64 ": sending CONRJT", session_id);
+        return true;
+    }
+
+    if (buf[0] == DATA_ID && length >= sizeof(data_t)) {
+        memcpy(&packet_no,
+               buf + offsetof(data_t, packet_no),
+               sizeof(packet_no));
+        packet_no = be64toh(packet_no);
+    }
+    reply_RJT(session_id, packet_no, reply, &reply_count);
+    return true;
+}
+
+static size_t bucket_of(const session_table_t* table,
+                        const struct sockaddr_in* address,
+                        uint64_t session_id) {
+    uint64_t key = session_id ^ ((uint64_t)address->sin_addr.s_addr << 16) ^
+                   address->sin_port;
+    // Fibonacci hashing, bucket_count is a power of two.
+    return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) &
+           (table->bucket_count - 1);
+}
+
+static bool same_key(const session_t* session,
+                     const struct sockaddr_in* address,
+                     uint64_t session_id) {
+    return session->session_id == session_id &&
+           session->address.sin_addr.s_addr == address->sin_addr.s_addr &&
+           session->address.sin_port == address->sin_port;
+}
+
+// Bucket of the transfer chains, hashed like those of the table.
+static size_t transfer_bucket_of(const session_table_t* table,
+                                 uint64_t transfer_id) {
+    return (size_t)((transfer_id * 0x9E3779B97F4A7C15ull) >> 32) &
+           (table->bucket_count - 1);
+}
+
+static bool resumable(const session_t* session) {
+    return session->sink.progress_fd >= 0;
+}
+
+void session_table_init(session_table_t* table) {
+    table->bucket_count = 64;
+    table->count        = 0;
+    ASSERT_MALLOC_OK(
+        table->buckets = calloc(table->bucket_count, sizeof(session_t*)));
+    ASSERT_MALLOC_OK(
+        table->transfers = calloc(table->bucket_count, sizeof(session_t*)));
+}
+
+session_t* session_table_find(session_table_t* table,
+                              const struct sockaddr_in* address,
+                              uint64_t session_id) {
+    session_t* session = table->buckets[bucket_of(table, address, session_id)];
+    while (session != NULL && !same_key(session, address, session_id)) {
+        session = session->next;
+    }
+    return session;
+}
+
+static void link_transfer(session_table_t* table, session_t* session) {
+    size_t bucket = transfer_bucket_of(table, session->sink.transfer_id);
+    session->next_transfer   = table->transfers[bucket];
+    table->transfers[bucket] = session;
+}
+
+static void rehash(session_table_t* table, size_t bucket_count) {
+    session_t** old_buckets = table->buckets;
+    size_t old_count        = table->bucket_count;
+
+    table->bucket_count = bucket_count;
+    ASSERT_MALLOC_OK(table->buckets = calloc(bucket_count, sizeof(session_t*)));
+    free(table->transfers);
+    ASSERT_MALLOC_OK(
+        table->transfers = calloc(bucket_count, sizeof(session_t*)));
+    for (size_t i = 0; i < old_count; i++) {
+        session_t* session = old_buckets[i];
+        while (session != NULL) {
+            session_t* next = session->next;
+            size_t bucket =
+                bucket_of(table, &session->address, session->session_id);
+            session->next          = table->buckets[bucket];
+            table->buckets[bucket] = session;
+            if (resumable(session)) link_transfer(table, session);
+            session = next;
+        }
+    }
+    free(old_buckets);
+}
+
+void session_table_insert(session_table_t* table, session_t* session) {
+    if (table->count >= table->bucket_count) {
+        rehash(table, table->bucket_count * 2);
+    }
+    size_t bucket = bucket_of(table, &session->address, session->session_id);
+    session->next          = table->buckets[bucket];
+    table->buckets[bucket] = session;
+    if (resumable(session)) link_transfer(table, session);
+    table->count++;
+}
+
+void session_table_remove(session_table_t* table, session_t* session) {
+    size_t bucket = bucket_of(table, &session->address, session->session_id);
+    session_t** link = &table->buckets[bucket];
+    while (*link != session) {
+        link = &(*link)->next;
+    }
+    *link = session->next;
+
+    if (resumable(session)) {
+        bucket = transfer_bucket_of(table, session->sink.transfer_id);
+        link   = &table->transfers[bucket];
+        while (*link != session) {
+            link = &(*link)->next_transfer;
+        }
+        *link = session->next_transfer;
+    }
+    table->count--;
+}
+
+session_t* session_table_find_transfer(session_table_t* table,
+                                       uint64_t transfer_id) {
+    session_t* session =
+        table->transfers[transfer_bucket_of(table, transfer_id)];
+    while (session != NULL && session->sink.transfer_id != transfer_id) {
+        session = session->next_transfer;
+    }
+    return session;
+}
+
+bool session_replaceable(const session_t* session,
+                         uint64_t session_id,
+                         uint64_t now) {
+    return session->session_id == session_id ||
+           session->state != SESSION_ACTIVE || session->retransmits > 0 ||
+           session->deadline <= now;
+}
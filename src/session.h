@@ -0,0 +1,225 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <inttypes.h>
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fec.h"
+#include "protocol.h"
+#include "stats.h"
+#include "stripe.h"
+#include "timers.h"
+#include "window.h"
+
+// Maximum number of sessions served at once by a concurrent server.
+#define MAX_SESSIONS 16384
+
+// Maximum number of packets a session sends in response to one event.
+#define MAX_REPLIES 3
+
+// Bytes of a resumable transfer written between updates of its progress.
+#define RESUME_SYNC_BYTES (64 << 20)
+
+// Acknowledgment policy of the udpw mode.
+typedef struct {
+    uint64_t every;    // acknowledge every that many packets received in order
+    uint64_t delay_ns; // or that long after the first unacknowledged one
+} ack_policy_t;
+
+// Settings the transport opens sessions with.
+typedef struct {
+    ack_policy_t ack_policy;
+    uint8_t features; // agreed to if the client asks for them
+    uint64_t room;    // bytes of DATA buffered for a session, see WND
+} session_config_t;
+
+// Packet to be sent by the transport on behalf of a session.
+typedef struct {
+    size_t length;
+    union {
+        conacc_t conacc;
+        conacc_ext_t conacc_ext;
+        conacc_resume_t conacc_resume;
+        conrjt_t conrjt;
+        acc_t acc;
+        rjt_t rjt;
+        nak_t nak;
+        rcvd_t rcvd;
+        rcvd_ext_t rcvd_ext;
+        sack_t sack;
+        wnd_t wnd;
+    } packet;
+} reply_t;
+
+// File the byte stream of a session goes to. That of a resumable transfer
+// holds it up to the offset, and its progress file the offset confirmed.
+// Stdout is written through the output path of the serial server.
+typedef struct {
+    int fd;
+    int progress_fd;      // -1 unless the transfer can be resumed
+    uint64_t offset;      // of the transfer the stream continues from
+    uint64_t transfer_id; // chosen by the client, if resumable
+} sink_t;
+
+// Contents of the progress file of a transfer, in network byte order.
+// Everything before the offset was synced to the sink before it was
+// written.
+typedef struct __attribute__((__packed__)) {
+    uint64_t total_count;
+    uint64_t offset;
+} progress_t;
+
+typedef enum {
+    SESSION_ACTIVE,
+    SESSION_DONE,   // whole stream received, lingering to repeat RCVD
+    SESSION_CLOSED, // to be closed after success
+    SESSION_FAILED, // to be closed after an error
+} session_state_t;
+
+/*
+    Server side of a single session, in any mode and with any features. The
+    session does no network I/O: the transport feeds it received packets
+    and expired deadlines, and sends the replies it produces. Received data
+    is decoded, checked and written to the session's sink.
+*/
+typedef struct session {
+    struct sockaddr_in address;
+    uint64_t session_id;
+    uint8_t protocol_id;    // protocol chosen by the client
+    uint8_t asked_features; // in its CONN
+    uint8_t features;       // agreed to
+    session_state_t state;
+
+    uint64_t total_count;
+    uint64_t left;
+    recv_window_t window;      // next expected packet in udp, udpr and udpw
+    fec_window_t* fec;         // in udpf mode instead
+    stripe_window_t* stripes;  // in a striped session instead, by offset
+
+    ack_policy_t ack_policy;
+    bool backlogged;       // output lags behind, udpw holds acknowledgments
+    uint64_t pending;      // packets received in order, not yet acknowledged
+    uint64_t ack_deadline; // of the delayed acknowledgment, if pending
+    uint64_t deadline;     // of the retransmission, idle or linger timeout
+    int retransmits;
+
+    // Receive window advertised in WND to clients of modes without
+    // acknowledgments, udp and udpf. The transport keeps the room up to
+    // date with what it can buffer.
+    uint64_t room;
+    uint64_t limit;        // stream offset advertised last
+    uint64_t wnd_deadline; // of repeating WND, in case the client missed it
+
+    sink_t sink;
+    uint64_t offset;     // of the transfer written to the sink so far
+    uint64_t synced;     // offset in the progress file
+    uint32_t stream_crc; // of the stream written, with FEATURE_CRC
+    stats_t stats;
+
+    struct session* next;          // in the same table bucket
+    struct session* next_transfer; // in the same transfer bucket
+    timer_node_t timer;   // armed by the transport at session_deadline()
+} session_t;
+
+// Parse a CONN of the given length and the transfer ID of one asking for
+// FEATURE_RESUME, else set it to 0. Return false if the CONN is invalid.
+bool session_parse_conn(const char* buf,
+                        size_t length,
+                        conn_t* conn,
+                        uint64_t* transfer_id);
+
+// Start a session from a CONN packet, reply with CONACC. The stream goes to
+// the sink from its offset on.
+session_t* session_open(const struct sockaddr_in* address,
+                        const conn_t* conn,
+                        const sink_t* sink,
+                        const session_config_t* config,
+                        uint64_t now,
+                        reply_t* replies,
+                        int* reply_count);
+
+// Close the session and its sink, recording the progress of a resumable
+// transfer.
+void session_close(session_t* session);
+
+// Handle a packet of the session other than CONN.
+void session_on_packet(session_t* session,
+                       const char* buf,
+                       size_t length,
+                       uint64_t now,
+                       reply_t* replies,
+                       int* reply_count);
+
+// Get the length of the header of DATA packets of the session.
+size_t session_header_size(const session_t* session);
+
+// Check if the transport may move the payload of the DATA packet with the
+// given header to the sink itself, without reading it: the packet is the
+// next one expected in tcp mode, and needs no decoding or checking.
+bool session_passes(const session_t* session, const data_t* data);
+
+// Handle a DATA packet whose payload the transport moved to the sink, after
+// session_passes() allowed it.
+void session_on_passed(session_t* session,
+                       const data_t* data,
+                       uint64_t now,
+                       reply_t* replies,
+                       int* reply_count);
+
+// Check if a CONN received on another TCP connection joins the session,
+// which is striped.
+bool session_joins(const session_t* session, const conn_t* conn);
+
+// Handle a repeated CONN of the session, or one joining it.
+void session_on_conn(session_t* session,
+                     uint64_t now,
+                     reply_t* replies,
+                     int* reply_count);
+
+// Handle expired deadlines of the session.
+void session_on_timer(session_t* session,
+                      uint64_t now,
+                      reply_t* replies,
+                      int* reply_count);
+
+// Get the nearest deadline of the session.
+uint64_t session_deadline(const session_t* session);
+
+// Build RJT or CONRJT for a packet not belonging to any session.
+bool session_reject(const char* buf, size_t length, reply_t* reply);
+
+// Check if CONN fields can start a session on the given server protocol.
+bool session_accepts(const conn_t* conn, uint8_t server_protocol_id);
+
+// Sessions keyed by client address and session ID. Those writing a
+// resumable transfer are also chained by transfer ID.
+typedef struct {
+    session_t** buckets;
+    session_t** transfers; // bucket_count of them
+    size_t bucket_count;
+    size_t count;
+} session_table_t;
+
+void session_table_init(session_table_t* table);
+session_t* session_table_find(session_table_t* table,
+                              const struct sockaddr_in* address,
+                              uint64_t session_id);
+void session_table_insert(session_table_t* table, session_t* session);
+void session_table_remove(session_table_t* table, session_t* session);
+
+// Find the session writing a resumable transfer.
+session_t* session_table_find_transfer(session_table_t* table,
+                                       uint64_t transfer_id);
+
+// Check if a CONN resuming the session's transfer may take it over: it
+// carries the session ID, so it comes from the client which owns the
+// session, maybe from another address. A CONN of any other session only
+// takes over a session which is finished or heard nothing from its client
+// for MAX_WAIT, so another client cannot cut a live transfer short.
+bool session_replaceable(const session_t* session,
+                         uint64_t session_id,
+                         uint64_t now);
+
+#endif
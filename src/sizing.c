@@ -0,0 +1,160 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/errqueue.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "protocol.h"
+#include "sizing.h"
+
+// Probes go to the discard port of the server host: a port unreachable
+// error is as good as an answer, it shows the probe got through whole.
+#define DISCARD_PORT 9
+
+static char probe_payload[UDP_PAYLOAD_MAX];
+
+bool sizing_parse(const char* string, sizing_t* sizing) {
+    if (strcmp(string, "random") == 0) {
+        sizing->kind = SIZING_RANDOM;
+    }
+    else if (strcmp(string, "pmtu") == 0) {
+        sizing->kind = SIZING_PMTU;
+    }
+    else if (strcmp(string, "fixed") == 0) {
+        sizing->kind = SIZING_FIXED;
+        sizing->size = MAX_NO_FRAGMENTS;
+    }
+    else if (strncmp(string, "fixed:", strlen("fixed:")) == 0) {
+        sizing->kind = SIZING_FIXED;
+        sizing->size = (uint32_t)read_number(
+            string + strlen("fixed:"), 1, MAX_PACKET_COUNT);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Get the MTU the kernel knows for the path of a connected socket.
+static int path_mtu(int socket_fd) {
+    int mtu;
+    ASSERT_SYS_OK(getsockopt(socket_fd,
+                             IPPROTO_IP,
+                             IP_MTU,
+                             &mtu,
+                             &((socklen_t){sizeof(mtu)})));
+    return mtu;
+}
+
+// Wait for an ICMP error about the last probe. Return the MTU reported by
+// a router the probe was too big for, or 0 if there was no such error.
+static int probe_error(int probe_fd) {
+    struct pollfd pfd = {.fd = probe_fd, .events = 0};
+    union {
+        char buf[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in))];
+        size_t align; // of struct cmsghdr
+    } control;
+    struct msghdr msg = {
+        .msg_control    = &control,
+        .msg_controllen = sizeof(control),
+    };
+    struct sock_extended_err ee;
+
+    if (poll(&pfd, 1, PMTU_PROBE_MS) <= 0) return 0;
+    if (recvmsg(probe_fd, &msg, MSG_ERRQUEUE) < 0) return 0;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    while (cmsg != NULL) {
+        if (cmsg->cmsg_level == IPPROTO_IP && cmsg->cmsg_type == IP_RECVERR) {
+            memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+            return ee.ee_errno == EMSGSIZE ? (int)ee.ee_info : 0;
+        }
+        cmsg = CMSG_NXTHDR(&msg, cmsg);
+    }
+    return 0;
+}
+
+// Send probes with the DF bit set, as big as the path is known to take,
+// until no router reports a smaller MTU. Return the path MTU.
+static int probe_path(int socket_fd) {
+    struct sockaddr_in address;
+    int probe_fd;
+
+    ASSERT_SYS_OK(getpeername(socket_fd,
+                              (struct sockaddr*)&address,
+                              &((socklen_t){sizeof(address)})));
+    address.sin_port = htons(DISCARD_PORT);
+
+    ASSERT_SYS_OK(probe_fd = socket(AF_INET, SOCK_DGRAM, 0));
+    ASSERT_SYS_OK(setsockopt(probe_fd,
+                             IPPROTO_IP,
+                             IP_MTU_DISCOVER,
+                             &(int){IP_PMTUDISC_DO},
+                             sizeof(int)));
+    ASSERT_SYS_OK(
+        setsockopt(probe_fd, IPPROTO_IP, IP_RECVERR, &(int){1}, sizeof(int)));
+    ASSERT_SYS_OK(connect(probe_fd,
+                          (struct sockaddr*)&address,
+                          (socklen_t)sizeof(address)));
+
+    int mtu = path_mtu(probe_fd);
+    for (int i = 0; i < PMTU_PROBES; i++) {
+        size_t size = (size_t)mtu - IP_UDP_HEADERS;
+        if (size > UDP_PAYLOAD_MAX) size = UDP_PAYLOAD_MAX;
+
+        if (send(probe_fd, probe_payload, size, 0) < 0) {
+            // The kernel already knows of a smaller MTU.
+            if (errno != EMSGSIZE) break;
+            mtu = path_mtu(probe_fd);
+            continue;
+        }
+        int reported = probe_error(probe_fd);
+        if (reported == 0 || reported >= mtu) break;
+        debug("probe of %zu bytes too big, path MTU is %d", size, reported);
+        mtu = reported;
+    }
+    errno = 0; // errors of probes are answers, not failures
+
+    ASSERT_SYS_OK(close(probe_fd));
+    return mtu;
+}
+
+void sizing_prepare(sizing_t* sizing, int socket_fd, bool probe) {
+    // TCP segments the stream itself, only datagrams are fragmented.
+    sizing->unfragmented = MAX_PACKET_COUNT;
+    if (probe) {
+        int mtu = sizing->kind == SIZING_PMTU ? probe_path(socket_fd)
+                                              : path_mtu(socket_fd);
+        int payload = mtu - IP_UDP_HEADERS - (int)sizeof(data_t);
+        if (payload < 1) payload = 1;
+        if (payload < MAX_PACKET_COUNT) sizing->unfragmented = payload;
+        debug("path MTU %d, largest unfragmented DATA payload %" PRIu32,
+              mtu,
+              sizing->unfragmented);
+    }
+
+    if (sizing->kind == SIZING_PMTU) {
+        sizing->size = sizing->unfragmented;
+    }
+    else if (sizing->kind == SIZING_FIXED &&
+             sizing->size > sizing->unfragmented)
+    {
+        debug("DATA of %" PRIu32 " bytes will be fragmented", sizing->size);
+    }
+}
+
+void sizing_reserve(sizing_t* sizing, uint32_t header_bytes) {
+    if (sizing->kind != SIZING_RANDOM && sizing->size > header_bytes) {
+        sizing->size -= header_bytes;
+    }
+}
+
+uint32_t sizing_next(const sizing_t* sizing, uint64_t left) {
+    if (sizing->kind == SIZING_RANDOM) return generate_packet_count(left);
+    return left < sizing->size ? (uint32_t)left : sizing->size;
+}
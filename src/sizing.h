@@ -0,0 +1,50 @@
+#ifndef SIZING_H
+#define SIZING_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// IPv4 header without options and UDP header.
+#define IP_UDP_HEADERS (20 + 8)
+
+// Probes sent to discover the path MTU, and how long to wait for an ICMP
+// error after each.
+#define PMTU_PROBES   4
+#define PMTU_PROBE_MS 100
+
+typedef enum {
+    SIZING_RANDOM, // any size up to MAX_PACKET_COUNT, fragmented over UDP
+    SIZING_FIXED,  // the given size, MAX_NO_FRAGMENTS by default
+    SIZING_PMTU,   // the largest size not fragmented on the path
+} sizing_kind_t;
+
+/*
+    Policy choosing the payload size of DATA packets sent by the client.
+
+    Once the socket is connected, every policy works out the largest
+    payload which fits the path MTU without IP fragmentation. Losing one
+    fragment of a UDP datagram loses all of it, so a datagram split into n
+    fragments is n times as likely to be lost.
+*/
+typedef struct {
+    sizing_kind_t kind;
+    uint32_t size;         // of fixed and pmtu payloads
+    uint32_t unfragmented; // largest payload not fragmented on the path
+} sizing_t;
+
+// Parse "random", "fixed", "fixed:<size>" or "pmtu", return false if the
+// policy is not valid.
+bool sizing_parse(const char* string, sizing_t* sizing);
+
+// Find the largest unfragmented payload for a connected socket. The pmtu
+// policy probes the path of a UDP socket first, and sizes payloads to it.
+void sizing_prepare(sizing_t* sizing, int socket_fd, bool probe);
+
+// Take header_bytes more off the payloads of the fixed and pmtu policies,
+// so that their datagrams keep their size as DATA headers grow.
+void sizing_reserve(sizing_t* sizing, uint32_t header_bytes);
+
+// Get the size of the next payload with 'left' bytes of the stream to send.
+uint32_t sizing_next(const sizing_t* sizing, uint64_t left);
+
+#endif
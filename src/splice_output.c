@@ -0,0 +1,111 @@
+// splice() is a GNU extension, so this file does not include err.h, whose
+// error_t clashes with the GNU one.
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "splice_output.h"
+#include "stats.h"
+
+static struct {
+    bool active;
+    int out_fd;
+    int pipe_fds[2]; // between the socket and an output which is not a pipe
+    size_t pipe_size;
+} spliced = {.pipe_fds = {-1, -1}};
+
+bool splice_output_init(int out_fd) {
+    struct stat st;
+    int flags;
+
+    if (isatty(out_fd) || fstat(out_fd, &st) < 0) return false;
+    if ((flags = fcntl(out_fd, F_GETFL)) < 0 || (flags & O_APPEND)) {
+        return false;
+    }
+
+    if (!S_ISFIFO(st.st_mode)) {
+        if (pipe2(spliced.pipe_fds, O_CLOEXEC) < 0) return false;
+        // A smaller pipe only takes more rounds, keep the default then.
+        int size = fcntl(spliced.pipe_fds[1], F_SETPIPE_SZ, SPLICE_PIPE_SIZE);
+        if (size < 0) size = fcntl(spliced.pipe_fds[1], F_GETPIPE_SZ);
+        if (size < 0) {
+            close(spliced.pipe_fds[0]);
+            close(spliced.pipe_fds[1]);
+            return false;
+        }
+        spliced.pipe_size = (size_t)size;
+    }
+    errno          = 0;
+    spliced.out_fd = out_fd;
+    spliced.active = true;
+    return true;
+}
+
+bool splice_output_active(void) {
+    return spliced.active;
+}
+
+// Move n bytes from the socket into the pipe to_fd, return how many moved.
+static splice_result_t splice_in(int socket_fd,
+                                 int to_fd,
+                                 size_t n,
+                                 size_t* moved) {
+    ssize_t result;
+    do {
+        stats.syscalls++;
+        result = splice(
+            socket_fd, NULL, to_fd, NULL, n, SPLICE_F_MOVE | SPLICE_F_MORE);
+    } while (result < 0 && errno == EINTR);
+
+    if (result < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return SPLICE_TIMEOUT;
+    }
+    if (result < 0) return SPLICE_RECV_FAILED;
+    if (result == 0) return SPLICE_CLOSED;
+    *moved = (size_t)result;
+    return SPLICE_OK;
+}
+
+// Move n bytes from our pipe to the output.
+static splice_result_t drain(size_t n) {
+    while (n > 0) {
+        stats.syscalls++;
+        ssize_t result = splice(spliced.pipe_fds[0],
+                                NULL,
+                                spliced.out_fd,
+                                NULL,
+                                n,
+                                SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) return SPLICE_OUTPUT_FAILED;
+        n -= (size_t)result;
+    }
+    return SPLICE_OK;
+}
+
+splice_result_t splice_output(int socket_fd, size_t n) {
+    splice_result_t result = SPLICE_OK;
+    size_t moved;
+
+    while (n > 0 && result == SPLICE_OK) {
+        if (spliced.pipe_fds[1] < 0) {
+            // The output is a pipe, a write error shows up on the socket
+            // side as EPIPE.
+            result = splice_in(socket_fd, spliced.out_fd, n, &moved);
+            if (result == SPLICE_RECV_FAILED && errno == EPIPE) {
+                result = SPLICE_OUTPUT_FAILED;
+            }
+        }
+        else {
+            size_t chunk = n < spliced.pipe_size ? n : spliced.pipe_size;
+            result =
+                splice_in(socket_fd, spliced.pipe_fds[1], chunk, &moved);
+            if (result == SPLICE_OK) result = drain(moved);
+        }
+        if (result == SPLICE_OK) n -= moved;
+    }
+    return result;
+}
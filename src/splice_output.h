@@ -0,0 +1,35 @@
+#ifndef SPLICE_OUTPUT_H
+#define SPLICE_OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Pipe capacity requested for moving payloads to an output which is not a
+// pipe itself.
+#define SPLICE_PIPE_SIZE (256 << 10)
+
+typedef enum {
+    SPLICE_OK,
+    SPLICE_TIMEOUT,       // the socket receive timeout expired
+    SPLICE_CLOSED,        // the peer closed the connection
+    SPLICE_RECV_FAILED,   // errno is set
+    SPLICE_OUTPUT_FAILED, // errno is set
+} splice_result_t;
+
+/*
+    Output path of the serial TCP server moving DATA payloads from the
+    socket to the output with splice(), so they never reach user space.
+    An output pipe is spliced into directly, a file through a pipe of its
+    own. A terminal, or a file opened for appending, cannot be spliced
+    into: the payloads are then read and printed as usual.
+*/
+
+// Set up splicing to out_fd, return false if it cannot be spliced into.
+bool splice_output_init(int out_fd);
+
+bool splice_output_active(void);
+
+// Move the next n bytes received on the socket to the output.
+splice_result_t splice_output(int socket_fd, size_t n);
+
+#endif
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "stats.h"
+
+_Thread_local stats_t stats;
+
+void stats_reset(void) {
+    memset(&stats, 0, sizeof(stats));
+}
+
+void stats_report(uint64_t session_id, const stats_t* session_stats) {
+    const stats_t* s     = session_stats;
+    double acks_per_data = s->data_packets
+                               ? (double)s->acks / (double)s->data_packets
+                               : 0;
+    fprintf(stderr,
+            "STATS: session %" PRIu64 ": %" PRIu64 " DATA packets, %" PRIu64
+            " bytes, %" PRIu64 " acknowledgments (%.3f per DATA)",
+            session_id,
+            s->data_packets,
+            s->data_bytes,
+            s->acks,
+            acks_per_data);
+    if (s->syscalls > 0) {
+        fprintf(stderr,
+                ", %" PRIu64 " I/O syscalls (%.1f per MB)",
+                s->syscalls,
+                s->data_bytes ? (double)s->syscalls * 1e6 / (double)s->data_bytes
+                              : 0);
+    }
+    if (s->rebuilt > 0) {
+        fprintf(stderr, ", %" PRIu64 " DATA rebuilt", s->rebuilt);
+    }
+    fprintf(stderr, "\n");
+}
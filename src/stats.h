@@ -0,0 +1,23 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <inttypes.h>
+
+// Counters of a server session, reported with -v.
+typedef struct {
+    uint64_t data_packets; // DATA packets received
+    uint64_t data_bytes;   // payload bytes received
+    uint64_t acks;         // ACC and SACK packets sent
+    uint64_t syscalls;     // socket and output I/O system calls
+    uint64_t rebuilt;      // DATA packets rebuilt from parity in udpf mode
+} stats_t;
+
+// Counters of the session served by the current thread.
+extern _Thread_local stats_t stats;
+
+void stats_reset(void);
+
+// Print the counters of a session to stderr.
+void stats_report(uint64_t session_id, const stats_t* session_stats);
+
+#endif
@@ -0,0 +1,91 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "stripe.h"
+
+#define STRIPE_INITIAL_CAPACITY 64
+
+static void swap(stripe_chunk_t* a, stripe_chunk_t* b) {
+    stripe_chunk_t tmp = *a;
+    *a                 = *b;
+    *b                 = tmp;
+}
+
+static void sift_up(stripe_window_t* window, size_t i) {
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (window->heap[parent].offset <= window->heap[i].offset) break;
+        swap(&window->heap[parent], &window->heap[i]);
+        i = parent;
+    }
+}
+
+static void sift_down(stripe_window_t* window, size_t i) {
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= window->count) break;
+        if (child + 1 < window->count &&
+            window->heap[child + 1].offset < window->heap[child].offset)
+        {
+            child++;
+        }
+        if (window->heap[i].offset <= window->heap[child].offset) break;
+        swap(&window->heap[i], &window->heap[child]);
+        i = child;
+    }
+}
+
+void stripe_window_init(stripe_window_t* window) {
+    window->next_offset = 0;
+    window->count       = 0;
+    window->capacity    = STRIPE_INITIAL_CAPACITY;
+    ASSERT_MALLOC_OK(
+        window->heap = malloc(window->capacity * sizeof(stripe_chunk_t)));
+}
+
+void stripe_window_free(stripe_window_t* window) {
+    for (size_t i = 0; i < window->count; i++) free(window->heap[i].payload);
+    free(window->heap);
+    window->heap  = NULL;
+    window->count = 0;
+}
+
+void stripe_window_store(stripe_window_t* window,
+                         uint64_t offset,
+                         const char* packet,
+                         uint32_t packet_count) {
+    if (window->count == window->capacity) {
+        window->capacity *= 2;
+        size_t size = window->capacity * sizeof(stripe_chunk_t);
+        ASSERT_MALLOC_OK(window->heap = realloc(window->heap, size));
+    }
+    stripe_chunk_t* chunk = &window->heap[window->count];
+    chunk->offset         = offset;
+    chunk->count          = packet_count;
+    ASSERT_MALLOC_OK(chunk->payload = malloc(packet_count));
+    memcpy(chunk->payload, packet, packet_count);
+    sift_up(window, window->count++);
+}
+
+void stripe_window_advance(stripe_window_t* window, uint32_t packet_count) {
+    window->next_offset += packet_count;
+    while (window->count > 0 &&
+           window->heap[0].offset < window->next_offset)
+    {
+        free(window->heap[0].payload);
+        window->heap[0] = window->heap[--window->count];
+        sift_down(window, 0);
+    }
+}
+
+bool stripe_window_peek(stripe_window_t* window,
+                        char** packet,
+                        uint32_t* packet_count) {
+    if (window->count == 0 || window->heap[0].offset != window->next_offset)
+        return false;
+
+    *packet       = window->heap[0].payload;
+    *packet_count = window->heap[0].count;
+    return true;
+}
@@ -0,0 +1,52 @@
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "protocol.h"
+
+// How far past the released stream a connection of a striped session may
+// have been read. It covers the batches of all connections the client
+// flushes at once, so the one it is writing to is never left unread.
+#define STRIPE_AHEAD_MAX (16 << 20)
+
+/*
+    Reassembly of the byte stream of a striped session. Each connection
+    carries its DATA in stream order, but ahead of or behind the others, so
+    payloads arriving ahead of the next offset are copied and held in a
+    min-heap by offset until the stream before them is released.
+*/
+typedef struct {
+    uint64_t offset;
+    uint32_t count;
+    char* payload;
+} stripe_chunk_t;
+
+typedef struct {
+    uint64_t next_offset; // all bytes before it were released
+    stripe_chunk_t* heap;
+    size_t count;
+    size_t capacity;
+} stripe_window_t;
+
+void stripe_window_init(stripe_window_t* window);
+void stripe_window_free(stripe_window_t* window);
+
+// Hold a payload received ahead of the next offset.
+void stripe_window_store(stripe_window_t* window,
+                         uint64_t offset,
+                         const char* packet,
+                         uint32_t packet_count);
+
+// Mark packet_count bytes at the next offset as released, held or not.
+void stripe_window_advance(stripe_window_t* window, uint32_t packet_count);
+
+// Get the payload at the next offset if it is held, return false otherwise.
+// It stays valid until the next call to stripe_window_advance().
+bool stripe_window_peek(stripe_window_t* window,
+                        char** packet,
+                        uint32_t* packet_count);
+
+#endif
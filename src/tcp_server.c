@@ -0,0 +1,396 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "protconst.h"
+#include "server.h"
+
+#define MAX_EVENTS 64
+
+#define MAX_WAIT_NS ((uint64_t)MAX_WAIT * NS_PER_SEC)
+
+// Longest frame sent by a client: DATA with a checksum and the largest
+// payload.
+#define MAX_FRAME (sizeof(data_ext_t) + MAX_PACKET_COUNT)
+
+// Room for replies a slow client did not take yet.
+#define OUT_SIZE (4 * sizeof(((reply_t*)NULL)->packet))
+
+typedef struct connection {
+    int fd;
+    struct sockaddr_in address;
+    session_t* session; // opened by the first CONN
+    uint64_t deadline;  // of CONN, until the session is opened
+    bool closing;       // close once pending replies are written
+    uint32_t events;    // registered with epoll
+    timer_node_t timer; // armed at the deadline of the session or CONN
+
+    char* in; // received bytes [in_start, in_end) not parsed yet
+    size_t in_start;
+    size_t in_end;
+    char out[OUT_SIZE]; // replies not written yet
+    size_t out_length;
+
+    struct connection* prev;
+    struct connection* next;
+} connection_t;
+
+typedef struct {
+    int epoll_fd;
+    int listen_fd;
+    bool accepting; // false while out of file descriptors
+    const server_config_t* config;
+    connection_t* connections;
+    size_t session_count;
+    timers_t timers; // of all connections
+} tcp_server_t;
+
+static void watch(tcp_server_t* server,
+                  int op,
+                  int fd,
+                  void* ptr,
+                  uint32_t events) {
+    struct epoll_event event = {.events = events, .data.ptr = ptr};
+    ASSERT_SYS_OK(epoll_ctl(server->epoll_fd, op, fd, &event));
+}
+
+static uint64_t connection_deadline(const connection_t* conn) {
+    return conn->session != NULL ? session_deadline(conn->session)
+                                 : conn->deadline;
+}
+
+// Get the length of the DATA header of the connection's session.
+static size_t data_header(const connection_t* conn) {
+    return conn->session != NULL ? session_header_size(conn->session)
+                                 : sizeof(data_t);
+}
+
+static void close_connection(tcp_server_t* server, connection_t* conn) {
+    timers_cancel(&server->timers, &conn->timer);
+    if (conn->session != NULL) {
+        if (server->config->verbose) {
+            stats_report(conn->session->session_id, &conn->session->stats);
+        }
+        session_close(conn->session);
+        server->session_count--;
+    }
+    tcp_disconnect(conn->fd, &conn->address);
+
+    if (conn->prev != NULL) conn->prev->next = conn->next;
+    else server->connections = conn->next;
+    if (conn->next != NULL) conn->next->prev = conn->prev;
+    free(conn->in);
+    free(conn);
+
+    // A descriptor was freed, new connections can be accepted again.
+    if (!server->accepting) {
+        server->accepting = true;
+        watch(server, EPOLL_CTL_ADD, server->listen_fd, NULL, EPOLLIN);
+    }
+}
+
+// Write as many pending replies as the socket takes without blocking.
+static bool flush(connection_t* conn) {
+    while (conn->out_length > 0) {
+        ssize_t sent = send(conn->fd, conn->out, conn->out_length, 0);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            errno = 0;
+            break;
+        }
+        if (sent < 0) {
+            error("send failed");
+            return false;
+        }
+        conn->out_length -= (size_t)sent;
+        memmove(conn->out, conn->out + sent, conn->out_length);
+    }
+    return true;
+}
+
+// Write pending replies and close the connection or update its epoll
+// registration and timer. Return false if the connection was closed.
+static bool settle(tcp_server_t* server, connection_t* conn) {
+    if (!flush(conn) || (conn->closing && conn->out_length == 0)) {
+        close_connection(server, conn);
+        return false;
+    }
+    uint32_t events = (conn->closing ? 0 : EPOLLIN) |
+                      (conn->out_length > 0 ? EPOLLOUT : 0);
+    if (events != conn->events) {
+        watch(server, EPOLL_CTL_MOD, conn->fd, conn, events);
+        conn->events = events;
+    }
+    timers_set(&server->timers, &conn->timer, connection_deadline(conn));
+    return true;
+}
+
+static void queue_replies(connection_t* conn,
+                          const reply_t* replies,
+                          int reply_count) {
+    for (int i = 0; i < reply_count; i++) {
+        if (conn->out_length + replies[i].length > OUT_SIZE) {
+            error("client does not read replies");
+            conn->closing    = true;
+            conn->out_length = 0;
+            return;
+        }
+        memcpy(conn->out + conn->out_length,
+               &replies[i].packet,
+               replies[i].length);
+        conn->out_length += replies[i].length;
+    }
+}
+
+static void accept_all(tcp_server_t* server, uint64_t now) {
+    struct sockaddr_in address;
+
+    while (1) {
+        int fd = accept(server->listen_fd,
+                        (struct sockaddr*)&address,
+                        &((socklen_t){sizeof(address)}));
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                errno = 0; // not an error for the next message
+                return;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                // Leave clients in the backlog until a connection closes.
+                error("out of file descriptors, pausing accept");
+                server->accepting = false;
+                watch(server, EPOLL_CTL_DEL, server->listen_fd, NULL, 0);
+                return;
+            }
+            syserr("accept failed");
+        }
+        socket_set_nonblocking(fd);
+
+        connection_t* conn;
+        ASSERT_MALLOC_OK(conn = calloc(1, sizeof(*conn)));
+        ASSERT_MALLOC_OK(conn->in = malloc(MAX_FRAME));
+        conn->fd       = fd;
+        conn->address  = address;
+        conn->deadline = now + MAX_WAIT_NS;
+        conn->events   = EPOLLIN;
+        conn->next     = server->connections;
+        if (conn->next != NULL) conn->next->prev = conn;
+        server->connections = conn;
+        watch(server, EPOLL_CTL_ADD, fd, conn, conn->events);
+        timers_set(&server->timers, &conn->timer, conn->deadline);
+
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        debug("connected to %s:%" PRIu16, host, ntohs(address.sin_port));
+    }
+}
+
+// Get the length of the frame at the start of buf, given the length of the
+// DATA header, return false if it was not received whole yet.
+static bool next_frame(const char* buf,
+                       size_t available,
+                       size_t header,
+                       size_t* length) {
+    uint32_t packet_count;
+
+    if (available < 1) return false;
+    if (buf[0] == CONN_ID) {
+        // CONN asking for resumption is longer.
+        if (available <= offsetof(conn_t, protocol_id)) return false;
+        *length = buf[offsetof(conn_t, protocol_id)] & FEATURE_RESUME
+                      ? sizeof(conn_resume_t)
+                      : sizeof(conn_t);
+    }
+    else if (buf[0] == DATA_ID) {
+        if (available < header) return false;
+        memcpy(&packet_count,
+               buf + offsetof(data_t, packet_count),
+               sizeof(packet_count));
+        packet_count = be32toh(packet_count);
+        // An oversized DATA is passed on without payload, to be rejected.
+        *length = header +
+                  (packet_count <= MAX_PACKET_COUNT ? packet_count : 0);
+    }
+    else {
+        *length = sizeof(uint8_t) + sizeof(uint64_t);
+    }
+    return available >= *length;
+}
+
+static void handle_frame(tcp_server_t* server,
+                         connection_t* conn,
+                         const char* frame,
+                         size_t length,
+                         uint64_t now) {
+    reply_t replies[MAX_REPLIES];
+    int reply_count = 0;
+    conn_t conn_packet;
+    uint64_t transfer_id;
+    sink_t sink = {.fd = -1};
+
+    if (conn->session != NULL) {
+        if (frame[0] == CONN_ID) {
+            session_on_conn(conn->session, now, replies, &reply_count);
+        }
+        else {
+            session_on_packet(conn->session,
+                              frame,
+                              length,
+                              now,
+                              replies,
+                              &reply_count);
+        }
+        conn->closing = conn->session->state != SESSION_ACTIVE;
+        queue_replies(conn, replies, reply_count);
+        return;
+    }
+
+    if (frame[0] != CONN_ID) {
+        error("unexpected type ID: %u", (uint8_t)frame[0]);
+        conn->closing = true;
+        return;
+    }
+
+    if (!session_parse_conn(frame, length, &conn_packet, &transfer_id)) {
+        conn->closing = true;
+        return;
+    }
+    if (!session_accepts(&conn_packet, TCP_ID)) {
+        error("received invalid CONN (protocol_id=%u)",
+              conn_packet.protocol_id);
+    }
+    else if (server->session_count < MAX_SESSIONS) {
+        server_open_sink(server->config, &conn_packet, transfer_id, &sink);
+    }
+
+    if (sink.fd < 0) {
+        reply_count   = session_reject(frame, length, replies) ? 1 : 0;
+        conn->closing = true;
+    }
+    else {
+        conn->session = session_open(&conn->address,
+                                     &conn_packet,
+                                     &sink,
+                                     &server->config->session,
+                                     now,
+                                     replies,
+                                     &reply_count);
+        server->session_count++;
+        conn->closing = conn->session->state != SESSION_ACTIVE;
+    }
+    queue_replies(conn, replies, reply_count);
+}
+
+// Read what the client sent and handle all complete frames.
+static void handle_readable(tcp_server_t* server,
+                            connection_t* conn,
+                            uint64_t now) {
+    // Move the incomplete frame to the front, so a whole one fits.
+    if (conn->in_start > 0) {
+        conn->in_end -= conn->in_start;
+        memmove(conn->in, conn->in + conn->in_start, conn->in_end);
+        conn->in_start = 0;
+    }
+
+    ssize_t received =
+        recv(conn->fd, conn->in + conn->in_end, MAX_FRAME - conn->in_end, 0);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK ||
+                         errno == EINTR))
+    {
+        errno = 0;
+        return;
+    }
+    if (received <= 0) {
+        if (received < 0) error("recv failed");
+        else error("connection closed by client");
+        conn->closing    = true;
+        conn->out_length = 0;
+        return;
+    }
+    conn->in_end += (size_t)received;
+
+    size_t length;
+    while (!conn->closing && next_frame(conn->in + conn->in_start,
+                                        conn->in_end - conn->in_start,
+                                        data_header(conn),
+                                        &length))
+    {
+        handle_frame(server, conn, conn->in + conn->in_start, length, now);
+        conn->in_start += length;
+    }
+}
+
+// Fire expired deadlines. Only connections whose deadline passed are
+// visited.
+static void handle_deadlines(tcp_server_t* server, uint64_t now) {
+    reply_t replies[MAX_REPLIES];
+    int reply_count;
+    timer_node_t* timer;
+
+    while ((timer = timers_expired(&server->timers, now)) != NULL) {
+        connection_t* conn = timer_owner(timer, connection_t, timer);
+        if (conn->closing || conn->session == NULL) {
+            // The client stalls, do not wait for it any longer.
+            if (conn->session == NULL) error("timeout waiting for CONN");
+            conn->closing    = true;
+            conn->out_length = 0;
+        }
+        else {
+            session_on_timer(conn->session, now, replies, &reply_count);
+            conn->closing = conn->session->state != SESSION_ACTIVE;
+            queue_replies(conn, replies, reply_count);
+        }
+        settle(server, conn);
+    }
+}
+
+noreturn void tcp_serve(int listen_fd, const server_config_t* config) {
+    struct epoll_event events[MAX_EVENTS];
+    tcp_server_t server = {
+        .listen_fd = listen_fd,
+        .accepting = true,
+        .config    = config,
+    };
+
+    // Clients queue up only between two rounds of accept().
+    ASSERT_SYS_OK(listen(listen_fd, SOMAXCONN));
+    socket_set_nonblocking(listen_fd);
+    ASSERT_SYS_OK(server.epoll_fd = epoll_create1(EPOLL_CLOEXEC));
+    watch(&server, EPOLL_CTL_ADD, listen_fd, NULL, EPOLLIN);
+
+    timers_init(&server.timers);
+    while (1) {
+        uint64_t now = monotonic_ns();
+        handle_deadlines(&server, now);
+        uint64_t nearest = timers_next(&server.timers);
+
+        int timeout_ms = -1;
+        if (nearest != UINT64_MAX) {
+            timeout_ms = (int)((nearest - now + NS_PER_MS - 1) / NS_PER_MS);
+        }
+        int ready = epoll_wait(server.epoll_fd, events, MAX_EVENTS, timeout_ms);
+        if (ready < 0 && errno == EINTR) continue;
+        ASSERT_SYS_OK(ready);
+
+        now = monotonic_ns();
+        for (int i = 0; i < ready; i++) {
+            connection_t* conn = events[i].data.ptr;
+            if (conn == NULL) {
+                accept_all(&server, now);
+                continue;
+            }
+            if (!conn->closing &&
+                (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+            {
+                handle_readable(&server, conn, now);
+            }
+            settle(&server, conn);
+        }
+    }
+}
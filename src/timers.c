@@ -0,0 +1,99 @@
+#include <stdlib.h>
+
+#include "err.h"
+#include "timers.h"
+
+#define TIMERS_INITIAL_CAPACITY 64
+
+static void place(timers_t* timers, size_t i, timer_node_t* node) {
+    timers->heap[i] = node;
+    node->slot      = i + 1;
+}
+
+static void sift_up(timers_t* timers, size_t i) {
+    timer_node_t* node = timers->heap[i];
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (timers->heap[parent]->deadline <= node->deadline) break;
+        place(timers, i, timers->heap[parent]);
+        i = parent;
+    }
+    place(timers, i, node);
+}
+
+static void sift_down(timers_t* timers, size_t i) {
+    timer_node_t* node = timers->heap[i];
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= timers->count) break;
+        if (child + 1 < timers->count &&
+            timers->heap[child + 1]->deadline < timers->heap[child]->deadline)
+        {
+            child++;
+        }
+        if (node->deadline <= timers->heap[child]->deadline) break;
+        place(timers, i, timers->heap[child]);
+        i = child;
+    }
+    place(timers, i, node);
+}
+
+void timers_init(timers_t* timers) {
+    timers->count    = 0;
+    timers->capacity = TIMERS_INITIAL_CAPACITY;
+    ASSERT_MALLOC_OK(
+        timers->heap = malloc(timers->capacity * sizeof(timer_node_t*)));
+}
+
+void timers_free(timers_t* timers) {
+    free(timers->heap);
+    timers->heap = NULL;
+}
+
+void timers_set(timers_t* timers, timer_node_t* node, uint64_t deadline) {
+    if (deadline == UINT64_MAX) {
+        timers_cancel(timers, node);
+        return;
+    }
+
+    if (node->slot == 0) {
+        if (timers->count == timers->capacity) {
+            timers->capacity *= 2;
+            size_t size = timers->capacity * sizeof(timer_node_t*);
+            ASSERT_MALLOC_OK(timers->heap = realloc(timers->heap, size));
+        }
+        node->deadline = deadline;
+        place(timers, timers->count++, node);
+        sift_up(timers, timers->count - 1);
+        return;
+    }
+
+    uint64_t old   = node->deadline;
+    node->deadline = deadline;
+    if (deadline < old) sift_up(timers, node->slot - 1);
+    else if (deadline > old) sift_down(timers, node->slot - 1);
+}
+
+void timers_cancel(timers_t* timers, timer_node_t* node) {
+    if (node->slot == 0) return;
+
+    // Fill the hole with the last timer, which may go either way from there.
+    size_t i           = node->slot - 1;
+    timer_node_t* last = timers->heap[--timers->count];
+    node->slot         = 0;
+    if (last == node) return;
+    place(timers, i, last);
+    sift_up(timers, i);
+    sift_down(timers, last->slot - 1);
+}
+
+uint64_t timers_next(const timers_t* timers) {
+    return timers->count > 0 ? timers->heap[0]->deadline : UINT64_MAX;
+}
+
+timer_node_t* timers_expired(timers_t* timers, uint64_t now) {
+    if (timers->count == 0 || timers->heap[0]->deadline > now) return NULL;
+    timer_node_t* node = timers->heap[0];
+    timers_cancel(timers, node);
+    return node;
+}
@@ -0,0 +1,45 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Deadline of one object, embedded in it. Zeroed memory is a timer which is
+// not armed.
+typedef struct {
+    uint64_t deadline;
+    size_t slot; // position in the heap plus one, 0 if not armed
+} timer_node_t;
+
+/*
+    Deadlines of many objects in a binary min-heap, for an event loop which
+    sleeps until the nearest one. Arming, moving and cancelling a timer take
+    O(log n), finding the nearest deadline O(1), so the loop no longer scans
+    every session on each wakeup.
+*/
+typedef struct {
+    timer_node_t** heap;
+    size_t count;
+    size_t capacity;
+} timers_t;
+
+// Get the object a timer node is embedded in as member.
+#define timer_owner(node, type, member) \
+    ((type*)((char*)(node) - offsetof(type, member)))
+
+void timers_init(timers_t* timers);
+void timers_free(timers_t* timers);
+
+// Arm or move the timer, cancel it if the deadline is UINT64_MAX.
+void timers_set(timers_t* timers, timer_node_t* node, uint64_t deadline);
+
+void timers_cancel(timers_t* timers, timer_node_t* node);
+
+// Get the nearest deadline, UINT64_MAX if no timer is armed.
+uint64_t timers_next(const timers_t* timers);
+
+// Disarm and return the timer with the nearest deadline if it is not after
+// now, return NULL otherwise.
+timer_node_t* timers_expired(timers_t* timers, uint64_t now);
+
+#endif
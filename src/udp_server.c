@@ -0,0 +1,223 @@
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "common.h"
+#include "err.h"
+#include "server.h"
+
+typedef struct {
+    int socket_fd;
+    const server_config_t* config;
+    session_config_t session_config; // with the room of the socket
+    session_table_t table;
+    timers_t timers; // of all sessions
+    batch_t* received;
+    batch_t* replies; // sent once the received batch is handled
+} udp_server_t;
+
+static void flush_replies(udp_server_t* server) {
+    if (batch_send(server->socket_fd, server->replies) < 0) {
+        error("sendmmsg failed");
+    }
+}
+
+static void send_replies(udp_server_t* server,
+                         const reply_t* replies,
+                         int reply_count,
+                         const struct sockaddr_in* address) {
+    for (int i = 0; i < reply_count; i++) {
+        while (!batch_add(server->replies,
+                          &replies[i].packet,
+                          replies[i].length,
+                          NULL,
+                          0,
+                          address))
+        {
+            flush_replies(server);
+        }
+    }
+}
+
+// Arm the timer of the session for its nearest deadline.
+static void rearm(udp_server_t* server, session_t* session) {
+    timers_set(&server->timers, &session->timer, session_deadline(session));
+}
+
+static void close_session(udp_server_t* server, session_t* session) {
+    session_table_t* table = &server->table;
+    if (server->config->verbose) {
+        stats_report(session->session_id, &session->stats);
+    }
+    char host[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &session->address.sin_addr, host, sizeof(host));
+    debug("stopped serving %s:%" PRIu16,
+          host,
+          ntohs(session->address.sin_port));
+    timers_cancel(&server->timers, &session->timer);
+    session_table_remove(table, session);
+    session_close(session);
+}
+
+// Fire expired deadlines and close sessions which finished. Only sessions
+// whose deadline passed are visited.
+static void handle_deadlines(udp_server_t* server, uint64_t now) {
+    reply_t replies[MAX_REPLIES];
+    int reply_count;
+    timer_node_t* timer;
+
+    while ((timer = timers_expired(&server->timers, now)) != NULL) {
+        session_t* session = timer_owner(timer, session_t, timer);
+        session_on_timer(session, now, replies, &reply_count);
+        send_replies(server, replies, reply_count, &session->address);
+        if (session->state == SESSION_CLOSED ||
+            session->state == SESSION_FAILED)
+        {
+            close_session(server, session);
+        }
+        else {
+            rearm(server, session);
+        }
+    }
+}
+
+// Handle a datagram from the given address.
+static void handle_datagram(udp_server_t* server,
+                            const char* buf,
+                            size_t length,
+                            struct sockaddr_in* address,
+                            uint64_t now) {
+    session_table_t* table        = &server->table;
+    const server_config_t* config = server->config;
+    reply_t replies[MAX_REPLIES];
+    int reply_count = 0;
+    uint64_t session_id;
+    uint64_t transfer_id;
+    conn_t conn;
+
+    if (length < sizeof(uint8_t) + sizeof(uint64_t)) {
+        error("received packet too short (size=%zu)", length);
+        return;
+    }
+    memcpy(&session_id, buf + sizeof(uint8_t), sizeof(session_id));
+    session_id = be64toh(session_id);
+
+    session_t* session = session_table_find(table, address, session_id);
+    if (session != NULL && buf[0] == CONN_ID) {
+        session_on_conn(session, now, replies, &reply_count);
+    }
+    else if (session != NULL) {
+        session_on_packet(session, buf, length, now, replies, &reply_count);
+    }
+    else if (buf[0] == CONN_ID) {
+        if (!session_parse_conn(buf, length, &conn, &transfer_id)) return;
+        sink_t sink = {.fd = -1};
+        if (!session_accepts(&conn, UDP_ID)) {
+            error("received invalid CONN (protocol_id=%u)", conn.protocol_id);
+        }
+        else if (table->count < MAX_SESSIONS) {
+            // A session which is over, or whose own client resumes it from
+            // another address, would keep the transfer busy until it times
+            // out. Any other one keeps it, and the lock of its sink gets the
+            // CONN rejected.
+            session_t* stale = conn.protocol_id & FEATURE_RESUME
+                                   ? session_table_find_transfer(table,
+                                                                 transfer_id)
+                                   : NULL;
+            if (stale != NULL && session_replaceable(stale, session_id, now)) {
+                close_session(server, stale);
+            }
+            server_open_sink(config, &conn, transfer_id, &sink);
+        }
+        if (sink.fd < 0) {
+            // Not served, too busy or the stream cannot be stored.
+            reply_count = session_reject(buf, length, replies) ? 1 : 0;
+        }
+        else {
+            session = session_open(address,
+                                   &conn,
+                                   &sink,
+                                   &server->session_config,
+                                   now,
+                                   replies,
+                                   &reply_count);
+            session_table_insert(table, session);
+            char host[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &address->sin_addr, host, sizeof(host));
+            debug("serving %s:%" PRIu16 " (%zu sessions)",
+                  host,
+                  ntohs(address->sin_port),
+                  table->count);
+        }
+    }
+    else {
+        // Packet of a session which is not served (any more).
+        error("received packet of unknown session %" PRIu64, session_id);
+        reply_count = session_reject(buf, length, replies) ? 1 : 0;
+    }
+
+    send_replies(server, replies, reply_count, address);
+    if (session == NULL) return;
+    if (session->state == SESSION_CLOSED || session->state == SESSION_FAILED) {
+        close_session(server, session);
+    }
+    else {
+        rearm(server, session);
+    }
+}
+
+// Trust the socket buffer with a quarter of its size, as the kernel charges
+// it with the overhead of every datagram as well.
+uint64_t udp_window_room(int socket_fd) {
+    int size;
+    socklen_t length = sizeof(size);
+    ASSERT_SYS_OK(
+        getsockopt(socket_fd, SOL_SOCKET, SO_RCVBUF, &size, &length));
+    uint64_t room = (uint64_t)size / 4;
+    return room < MAX_PACKET_COUNT ? MAX_PACKET_COUNT : room;
+}
+
+noreturn void udp_serve(int socket_fd, const server_config_t* config) {
+    udp_server_t server = {
+        .socket_fd      = socket_fd,
+        .config         = config,
+        .session_config = config->session,
+    };
+    struct sockaddr_in address;
+
+    server.session_config.room = udp_window_room(socket_fd);
+
+    // Every worker of a sharded server has its own batches.
+    ASSERT_MALLOC_OK(server.received = batch_new(BUFFER_SIZE));
+    ASSERT_MALLOC_OK(server.replies = batch_new(0));
+
+    session_table_init(&server.table);
+    timers_init(&server.timers);
+    while (1) {
+        uint64_t now = monotonic_ns();
+        handle_deadlines(&server, now);
+        flush_replies(&server);
+        uint64_t nearest = timers_next(&server.timers);
+
+        // Sleep until the nearest deadline, if nothing arrives earlier.
+        int timeout_ms = -1;
+        if (nearest != UINT64_MAX) {
+            timeout_ms = (int)((nearest - now + NS_PER_MS - 1) / NS_PER_MS);
+        }
+        if (!socket_wait(socket_fd, timeout_ms)) continue;
+
+        if (batch_recv(socket_fd, server.received) < 0) {
+            error("recvmmsg failed");
+            continue;
+        }
+        now = monotonic_ns();
+        size_t length;
+        const char* buf;
+        while ((buf = batch_next(server.received, &length, &address)) != NULL)
+        {
+            handle_datagram(&server, buf, length, &address, now);
+        }
+        flush_replies(&server);
+    }
+}
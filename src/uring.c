@@ -0,0 +1,513 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "err.h"
+#include "stats.h"
+#include "uring.h"
+
+#define URING_ENTRIES 64
+
+// Provided buffers, each holds a whole datagram with its recvmsg header.
+#define URING_BUFFERS     64 // power of two
+#define URING_BUFFER_SIZE (BUFFER_SIZE + 256)
+#define URING_GROUP       0
+
+// Output is staged in two halves, one is filled while the other is written.
+#define OUTPUT_HALF (1 << 20)
+
+// Receive timeouts are recorded for descriptors below this one.
+#define MAX_TIMEOUT_FD 1024
+
+// Kind of request in the low byte of user_data, the rest is the descriptor
+// (or the output half).
+enum { OP_RECV, OP_WRITE, OP_CANCEL };
+#define USER_DATA(op, fd) (((uint64_t)(fd) << 8) | (op))
+
+// Part of the received stream, or a received datagram.
+typedef struct {
+    int error;     // errno of a failed receive, 0 otherwise
+    bool buffered; // holds a provided buffer
+    uint16_t bid;
+    size_t offset; // of the unread bytes in the buffer
+    size_t length; // unread bytes, 0 at the end of a stream
+    struct sockaddr_in address;
+} chunk_t;
+
+static struct {
+    bool active;
+    int fd;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    unsigned sq_local_tail;
+    unsigned to_submit;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    struct io_uring_buf_ring* buf_ring;
+    uint16_t buf_tail;
+    char* buffers;
+
+    int recv_fd;   // socket with a multishot receive, -1 if none
+    bool datagram; // recv_fd is a UDP socket
+    bool armed;    // the multishot receive is posted
+    bool cancelling;
+    struct msghdr msg; // layout of received datagrams
+    chunk_t chunks[2 * URING_BUFFERS];
+    size_t chunk_head;
+    size_t chunk_count;
+
+    char* output;
+    int output_half; // being filled
+    size_t output_fill;
+    size_t output_inflight[2]; // bytes being written from each half
+
+    int timeouts[MAX_TIMEOUT_FD]; // in milliseconds plus one, 0 if none
+} ring = {.recv_fd = -1};
+
+bool uring_init(void) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0) {
+        error("io_uring_setup failed");
+        return false;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+        !(params.features & IORING_FEAT_EXT_ARG))
+    {
+        error("io_uring lacks required features");
+        ASSERT_SYS_OK(close(fd));
+        return false;
+    }
+
+    // The submission and completion rings share one mapping.
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size =
+        params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    size_t size = sq_size > cq_size ? sq_size : cq_size;
+    char* rings = mmap(NULL,
+                       size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       fd,
+                       IORING_OFF_SQ_RING);
+    void* sqes  = mmap(NULL,
+                      params.sq_entries * sizeof(struct io_uring_sqe),
+                      PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE,
+                      fd,
+                      IORING_OFF_SQES);
+    void* bufs  = mmap(NULL,
+                      URING_BUFFERS * sizeof(struct io_uring_buf),
+                      PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS,
+                      -1,
+                      0);
+    if (rings == MAP_FAILED || sqes == MAP_FAILED || bufs == MAP_FAILED) {
+        syserr("mmap failed");
+    }
+
+    ring.fd            = fd;
+    ring.sq_head       = (unsigned*)(rings + params.sq_off.head);
+    ring.sq_tail       = (unsigned*)(rings + params.sq_off.tail);
+    ring.sq_mask       = *(unsigned*)(rings + params.sq_off.ring_mask);
+    ring.sq_array      = (unsigned*)(rings + params.sq_off.array);
+    ring.sq_local_tail = *ring.sq_tail;
+    ring.sqes          = sqes;
+    ring.cq_head       = (unsigned*)(rings + params.cq_off.head);
+    ring.cq_tail       = (unsigned*)(rings + params.cq_off.tail);
+    ring.cq_mask       = *(unsigned*)(rings + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+
+    // Receives pick buffers from the ring themselves (Linux 5.19+).
+    struct io_uring_buf_reg reg = {
+        .ring_addr    = (uint64_t)(uintptr_t)bufs,
+        .ring_entries = URING_BUFFERS,
+        .bgid         = URING_GROUP,
+    };
+    if (syscall(__NR_io_uring_register,
+                fd,
+                IORING_REGISTER_PBUF_RING,
+                &reg,
+                1) < 0)
+    {
+        error("cannot register provided buffers");
+        ASSERT_SYS_OK(munmap(bufs, URING_BUFFERS * sizeof(struct io_uring_buf)));
+        ASSERT_SYS_OK(close(fd));
+        return false;
+    }
+    ring.buf_ring = bufs;
+    ASSERT_MALLOC_OK(ring.buffers = malloc(URING_BUFFERS * URING_BUFFER_SIZE));
+    ASSERT_MALLOC_OK(ring.output = malloc(2 * OUTPUT_HALF));
+    for (uint16_t bid = 0; bid < URING_BUFFERS; bid++) {
+        struct io_uring_buf* buf = &ring.buf_ring->bufs[bid];
+        buf->addr = (uint64_t)(uintptr_t)(ring.buffers + bid * URING_BUFFER_SIZE);
+        buf->len  = URING_BUFFER_SIZE;
+        buf->bid  = bid;
+    }
+    ring.buf_tail = URING_BUFFERS;
+    __atomic_store_n(&ring.buf_ring->tail, ring.buf_tail, __ATOMIC_RELEASE);
+
+    ring.msg.msg_namelen = sizeof(struct sockaddr_in);
+    ring.active          = true;
+    debug("using io_uring");
+    return true;
+}
+
+bool uring_active(void) {
+    return ring.active;
+}
+
+// Give a provided buffer back to the kernel.
+static void recycle(uint16_t bid) {
+    struct io_uring_buf* buf =
+        &ring.buf_ring->bufs[ring.buf_tail & (URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring.buffers + bid * URING_BUFFER_SIZE);
+    buf->len  = URING_BUFFER_SIZE;
+    buf->bid  = bid;
+    ring.buf_tail++;
+    __atomic_store_n(&ring.buf_ring->tail, ring.buf_tail, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_sqe* get_sqe(void) {
+    unsigned index           = ring.sq_local_tail & ring.sq_mask;
+    struct io_uring_sqe* sqe = &ring.sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring.sq_array[index] = index;
+    ring.sq_local_tail++;
+    ring.to_submit++;
+    return sqe;
+}
+
+// Submit queued requests and wait for a completion or the timeout.
+static void submit_and_wait(int timeout_ms) {
+    struct __kernel_timespec ts = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * (long long)NS_PER_MS,
+    };
+    struct io_uring_getevents_arg arg = {
+        .sigmask_sz = _NSIG / 8,
+        .ts         = timeout_ms >= 0 ? (uint64_t)(uintptr_t)&ts : 0,
+    };
+    __atomic_store_n(ring.sq_tail, ring.sq_local_tail, __ATOMIC_RELEASE);
+
+    long submitted;
+    do {
+        stats.syscalls++;
+        submitted = syscall(__NR_io_uring_enter,
+                            ring.fd,
+                            ring.to_submit,
+                            1,
+                            IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                            &arg,
+                            sizeof(arg));
+    } while (submitted < 0 && errno == EINTR);
+    if (submitted < 0 && (errno == ETIME || errno == EBUSY)) {
+        // Timed out, or completions have to be reaped first.
+        errno = 0;
+        return;
+    }
+    ASSERT_SYS_OK(submitted);
+    ring.to_submit -= (unsigned)submitted;
+}
+
+static chunk_t* push_chunk(void) {
+    size_t index =
+        (ring.chunk_head + ring.chunk_count++) % (2 * URING_BUFFERS);
+    chunk_t* chunk = &ring.chunks[index];
+    memset(chunk, 0, sizeof(*chunk));
+    return chunk;
+}
+
+static void pop_chunk(void) {
+    chunk_t* chunk = &ring.chunks[ring.chunk_head];
+    if (chunk->buffered) recycle(chunk->bid);
+    ring.chunk_head = (ring.chunk_head + 1) % (2 * URING_BUFFERS);
+    ring.chunk_count--;
+}
+
+static void handle_recv(const struct io_uring_cqe* cqe, int fd) {
+    bool current = fd == ring.recv_fd && !ring.cancelling;
+    if (fd == ring.recv_fd && !(cqe->flags & IORING_CQE_F_MORE)) {
+        ring.armed = false;
+    }
+
+    if (cqe->flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!current) {
+            recycle(bid);
+            return;
+        }
+        chunk_t* chunk  = push_chunk();
+        chunk->buffered = true;
+        chunk->bid      = bid;
+        if (!ring.datagram) {
+            chunk->length = (size_t)cqe->res;
+            return;
+        }
+
+        char* buf                        = ring.buffers + bid * URING_BUFFER_SIZE;
+        struct io_uring_recvmsg_out* out = (struct io_uring_recvmsg_out*)buf;
+        chunk->offset = sizeof(*out) + ring.msg.msg_namelen;
+        chunk->length = (size_t)cqe->res - chunk->offset;
+        if (out->payloadlen < chunk->length) chunk->length = out->payloadlen;
+        memcpy(&chunk->address, buf + sizeof(*out), sizeof(chunk->address));
+        return;
+    }
+
+    // Out of buffers, the receive is posted again once some are consumed.
+    if (!current || cqe->res == -ENOBUFS || cqe->res == -ECANCELED) return;
+    chunk_t* chunk = push_chunk();
+    chunk->error   = cqe->res < 0 ? -cqe->res : 0; // 0 bytes is end of stream
+}
+
+static void handle_write(const struct io_uring_cqe* cqe, int half) {
+    size_t length = ring.output_inflight[half];
+    char* data    = ring.output + half * OUTPUT_HALF;
+    if (cqe->res < 0) {
+        errno = -cqe->res;
+        syserr("write to stdout failed");
+    }
+    // Short writes are rare, finish them synchronously.
+    if ((size_t)cqe->res < length &&
+        !tcp_writen(STDOUT_FILENO, data + cqe->res, length - cqe->res))
+        fatal("write to stdout failed");
+    ring.output_inflight[half] = 0;
+}
+
+static void reap(void) {
+    unsigned head = *ring.cq_head;
+    unsigned tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        const struct io_uring_cqe* cqe = &ring.cqes[head & ring.cq_mask];
+        int fd                         = (int)(cqe->user_data >> 8);
+        switch (cqe->user_data & 0xff) {
+            case OP_RECV: handle_recv(cqe, fd); break;
+            case OP_WRITE: handle_write(cqe, fd); break;
+            default: break;
+        }
+    }
+    __atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Queue writing the half being filled, and continue in the other one.
+static void write_half(void) {
+    int half                 = ring.output_half;
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode              = IORING_OP_WRITE;
+    sqe->fd                  = STDOUT_FILENO;
+    sqe->off                 = (uint64_t)-1; // at the current file position
+    sqe->addr      = (uint64_t)(uintptr_t)(ring.output + half * OUTPUT_HALF);
+    sqe->len       = (unsigned)ring.output_fill;
+    sqe->user_data = USER_DATA(OP_WRITE, half);
+
+    ring.output_inflight[half] = ring.output_fill;
+    ring.output_half ^= 1;
+    ring.output_fill = 0;
+}
+
+static void wait_output(int half) {
+    while (ring.output_inflight[half] > 0) {
+        submit_and_wait(-1);
+        reap();
+    }
+}
+
+// Receive from the socket from now on.
+static void select_socket(int fd) {
+    if (fd == ring.recv_fd) return;
+    uring_forget(ring.recv_fd);
+
+    int type;
+    ASSERT_SYS_OK(getsockopt(fd,
+                             SOL_SOCKET,
+                             SO_TYPE,
+                             &type,
+                             &((socklen_t){sizeof(type)})));
+    ring.recv_fd  = fd;
+    ring.datagram = type == SOCK_DGRAM;
+}
+
+static void arm(void) {
+    struct io_uring_sqe* sqe = get_sqe();
+    sqe->opcode    = ring.datagram ? IORING_OP_RECVMSG : IORING_OP_RECV;
+    sqe->fd        = ring.recv_fd;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_GROUP;
+    sqe->user_data = USER_DATA(OP_RECV, ring.recv_fd);
+    if (ring.datagram) {
+        sqe->addr = (uint64_t)(uintptr_t)&ring.msg;
+        sqe->len  = 1;
+    }
+    ring.armed = true;
+}
+
+// Wait until something is received on the socket, return false on timeout.
+static bool wait_chunk(int fd, int timeout_ms) {
+    uint64_t deadline = UINT64_MAX;
+    if (timeout_ms >= 0) {
+        deadline = monotonic_ns() + (uint64_t)timeout_ms * NS_PER_MS;
+    }
+
+    select_socket(fd);
+    while (1) {
+        reap();
+        if (ring.chunk_count > 0) return true;
+
+        // About to block: post the receive and write out what is staged.
+        if (!ring.armed) arm();
+        if (ring.output_fill > 0 &&
+            ring.output_inflight[ring.output_half ^ 1] == 0)
+            write_half();
+
+        int wait_ms = -1;
+        if (deadline != UINT64_MAX) {
+            uint64_t now = monotonic_ns();
+            if (now >= deadline) return false;
+            wait_ms = (int)((deadline - now + NS_PER_MS - 1) / NS_PER_MS);
+        }
+        submit_and_wait(wait_ms);
+    }
+}
+
+static int timeout_of(int fd) {
+    return fd < MAX_TIMEOUT_FD ? ring.timeouts[fd] - 1 : -1;
+}
+
+// Take a failed receive off the queue, return false if it was one.
+static bool check_chunk(const char* func) {
+    chunk_t* chunk = &ring.chunks[ring.chunk_head];
+    if (chunk->error == 0) return true;
+    errno = chunk->error;
+    pop_chunk();
+    error("%s: failed", func);
+    current_error = ERRIO;
+    return false;
+}
+
+bool uring_readn(int fd, void* buf, size_t n) {
+    char* ptr = buf;
+
+    while (n > 0) {
+        if (!wait_chunk(fd, timeout_of(fd))) {
+            error("%s: timeout", __func__);
+            current_error = ERRTIMEOUT;
+            return false;
+        }
+        if (!check_chunk(__func__)) return false;
+
+        chunk_t* chunk = &ring.chunks[ring.chunk_head];
+        if (chunk->length == 0) {
+            pop_chunk();
+            error("%s: connection closed by peer", __func__);
+            current_error = ERRIO;
+            return false;
+        }
+        size_t taken = chunk->length < n ? chunk->length : n;
+        memcpy(ptr,
+               ring.buffers + chunk->bid * URING_BUFFER_SIZE + chunk->offset,
+               taken);
+        chunk->offset += taken;
+        chunk->length -= taken;
+        ptr += taken;
+        n -= taken;
+        if (chunk->length == 0) pop_chunk();
+    }
+    return true;
+}
+
+bool uring_recvfrom(int fd,
+                    void* buf,
+                    size_t* n,
+                    struct sockaddr_in* client_address) {
+    if (!wait_chunk(fd, timeout_of(fd))) {
+        // Callers retransmit or repeat WND, or report giving up.
+        debug("%s: timeout", __func__);
+        current_error = ERRTIMEOUT;
+        return false;
+    }
+    if (!check_chunk(__func__)) return false;
+
+    // Like recvfrom(), the rest of a datagram too long is discarded.
+    chunk_t* chunk = &ring.chunks[ring.chunk_head];
+    *n             = chunk->length < *n ? chunk->length : *n;
+    memcpy(buf,
+           ring.buffers + chunk->bid * URING_BUFFER_SIZE + chunk->offset,
+           *n);
+    if (client_address != NULL) *client_address = chunk->address;
+    pop_chunk();
+    return true;
+}
+
+bool uring_wait(int fd, int timeout_ms) {
+    return wait_chunk(fd, timeout_ms);
+}
+
+void uring_set_timeout(int fd, int timeout_ms) {
+    if (fd < MAX_TIMEOUT_FD) ring.timeouts[fd] = timeout_ms + 1;
+}
+
+void uring_write_output(const char* buf, size_t n) {
+    while (n > 0) {
+        if (ring.output_fill == OUTPUT_HALF) {
+            wait_output(ring.output_half ^ 1);
+            write_half();
+        }
+        size_t room  = OUTPUT_HALF - ring.output_fill;
+        size_t taken = n < room ? n : room;
+        memcpy(ring.output + ring.output_half * OUTPUT_HALF + ring.output_fill,
+               buf,
+               taken);
+        ring.output_fill += taken;
+        buf += taken;
+        n -= taken;
+    }
+}
+
+void uring_flush_output(void) {
+    if (ring.output_fill > 0) {
+        wait_output(ring.output_half ^ 1);
+        write_half();
+    }
+    wait_output(0);
+    wait_output(1);
+}
+
+void uring_forget(int fd) {
+    if (!ring.active || fd < 0 || fd != ring.recv_fd) return;
+
+    // The receive ends with a completion without IORING_CQE_F_MORE.
+    if (ring.armed) {
+        struct io_uring_sqe* sqe = get_sqe();
+        sqe->opcode       = IORING_OP_ASYNC_CANCEL;
+        sqe->fd           = fd;
+        sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+        sqe->user_data    = USER_DATA(OP_CANCEL, fd);
+        ring.cancelling   = true;
+        while (ring.armed) {
+            submit_and_wait(-1);
+            reap();
+        }
+        ring.cancelling = false;
+    }
+    while (ring.chunk_count > 0) {
+        pop_chunk();
+    }
+    ring.recv_fd = -1;
+}
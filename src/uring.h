@@ -0,0 +1,44 @@
+#ifndef URING_H
+#define URING_H
+
+#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+    Optional io_uring backend of the serial server's receive and output path.
+
+    Once enabled, tcp_readn(), udp_recvfrom(), socket_wait() and
+    print_packet() are served from the ring: the socket being read keeps a
+    multishot receive posted with a ring of provided buffers, and output is
+    staged and written to stdout in batches. A single io_uring_enter()
+    submits the pending writes and collects all packets that arrived since
+    the previous one.
+*/
+
+// Set up the ring, return false if io_uring is not available.
+bool uring_init(void);
+
+bool uring_active(void);
+
+// Counterparts of tcp_readn(), udp_recvfrom() and socket_wait().
+bool uring_readn(int fd, void* buf, size_t n);
+bool uring_recvfrom(int fd,
+                    void* buf,
+                    size_t* n,
+                    struct sockaddr_in* client_address);
+bool uring_wait(int fd, int timeout_ms);
+
+// Record the receive timeout of a socket, -1 for none.
+void uring_set_timeout(int fd, int timeout_ms);
+
+// Stage output for stdout.
+void uring_write_output(const char* buf, size_t n);
+
+// Wait until all staged output is written.
+void uring_flush_output(void);
+
+// Stop receiving from a socket which is about to be closed.
+void uring_forget(int fd);
+
+#endif
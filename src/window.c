@@ -0,0 +1,60 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+#include "window.h"
+
+void recv_window_init(recv_window_t* window) {
+    memset(window->slots, 0, sizeof(window->slots));
+    recv_window_reset(window);
+}
+
+void recv_window_reset(recv_window_t* window) {
+    window->next_packet_no = START_NO;
+    window->buffered       = 0;
+}
+
+void recv_window_free(recv_window_t* window) {
+    for (int i = 0; i < WINDOW_MAX; i++) {
+        free(window->slots[i]);
+        window->slots[i] = NULL;
+    }
+}
+
+static char* slot(recv_window_t* window, uint64_t packet_no) {
+    char** slot = &window->slots[packet_no % WINDOW_MAX];
+    if (*slot == NULL) ASSERT_MALLOC_OK(*slot = malloc(MAX_PACKET_COUNT));
+    return *slot;
+}
+
+void recv_window_store(recv_window_t* window,
+                       uint64_t packet_no,
+                       const char* packet,
+                       uint32_t packet_count) {
+    uint64_t bit = (uint64_t)1 << (packet_no - window->next_packet_no);
+    if (window->buffered & bit) return; // duplicate
+
+    memcpy(slot(window, packet_no), packet, packet_count);
+    window->counts[packet_no % WINDOW_MAX] = packet_count;
+    window->buffered |= bit;
+}
+
+void recv_window_advance(recv_window_t* window) {
+    window->next_packet_no++;
+    window->buffered >>= 1;
+}
+
+bool recv_window_peek(recv_window_t* window,
+                      char** packet,
+                      uint32_t* packet_count) {
+    if (!(window->buffered & 1)) return false;
+
+    *packet       = slot(window, window->next_packet_no);
+    *packet_count = window->counts[window->next_packet_no % WINDOW_MAX];
+    return true;
+}
+
+uint64_t recv_window_bitmap(recv_window_t* window) {
+    // The next expected packet itself is never buffered once released.
+    return window->buffered >> 1;
+}
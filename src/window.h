@@ -0,0 +1,42 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "protocol.h"
+
+/*
+    Receive window of the udpw mode. DATA packets arriving ahead of the next
+    expected one are buffered until the gap before them is filled, then the
+    contiguous prefix is released in order.
+*/
+typedef struct {
+    uint64_t next_packet_no; // all packets before it were released
+    uint64_t buffered;       // bit i set if next_packet_no + i is buffered
+    uint32_t counts[WINDOW_MAX];
+    char* slots[WINDOW_MAX]; // allocated when first needed
+} recv_window_t;
+
+void recv_window_init(recv_window_t* window);
+void recv_window_reset(recv_window_t* window);
+void recv_window_free(recv_window_t* window);
+
+// Buffer a packet received ahead of the next expected one.
+void recv_window_store(recv_window_t* window,
+                       uint64_t packet_no,
+                       const char* packet,
+                       uint32_t packet_count);
+
+// Mark the next expected packet as released.
+void recv_window_advance(recv_window_t* window);
+
+// Get the next expected packet if it is buffered, return false otherwise.
+bool recv_window_peek(recv_window_t* window,
+                      char** packet,
+                      uint32_t* packet_count);
+
+// Bitmap of buffered packets in the format of SACK packets.
+uint64_t recv_window_bitmap(recv_window_t* window);
+
+#endif
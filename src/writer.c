@@ -0,0 +1,134 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "err.h"
+#include "writer.h"
+
+static struct {
+    bool active;
+    int fd;
+    char* ring;
+    size_t size;
+    size_t high_water;
+
+    // Bytes ever put and taken, the ring holds [tail, head).
+    _Atomic uint64_t head;
+    _Atomic uint64_t tail;
+
+    // A side about to sleep sets its flag, the other side wakes it.
+    pthread_mutex_t lock;
+    pthread_cond_t cond_data;
+    pthread_cond_t cond_room;
+    atomic_bool writer_waits;
+    atomic_bool receiver_waits;
+    pthread_t thread;
+} out;
+
+static void wake(atomic_bool* waits, pthread_cond_t* cond) {
+    // The position just stored must be visible before the flag is read.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!atomic_load(waits)) return;
+    ASSERT_ZERO(pthread_mutex_lock(&out.lock));
+    ASSERT_ZERO(pthread_cond_signal(cond));
+    ASSERT_ZERO(pthread_mutex_unlock(&out.lock));
+}
+
+// Sleep on cond until the ring holds from min to max bytes.
+static void wait_used(atomic_bool* waits,
+                      pthread_cond_t* cond,
+                      size_t min,
+                      size_t max) {
+    ASSERT_ZERO(pthread_mutex_lock(&out.lock));
+    atomic_store(waits, true);
+    while (1) {
+        uint64_t used = atomic_load(&out.head) - atomic_load(&out.tail);
+        if (used >= min && used <= max) break;
+        ASSERT_ZERO(pthread_cond_wait(cond, &out.lock));
+    }
+    atomic_store(waits, false);
+    ASSERT_ZERO(pthread_mutex_unlock(&out.lock));
+}
+
+static void* writer_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        uint64_t tail = atomic_load_explicit(&out.tail, memory_order_relaxed);
+        uint64_t head = atomic_load_explicit(&out.head, memory_order_acquire);
+        if (head == tail) {
+            wait_used(&out.writer_waits, &out.cond_data, 1, SIZE_MAX);
+            continue;
+        }
+
+        // Everything queued up to the end of the ring, in one write.
+        size_t offset = (size_t)(tail % out.size);
+        size_t length = (size_t)(head - tail);
+        if (length > out.size - offset) length = out.size - offset;
+        if (!tcp_writen(out.fd, out.ring + offset, length)) {
+            fatal("write to stdout failed");
+        }
+        atomic_store_explicit(&out.tail, tail + length, memory_order_release);
+        wake(&out.receiver_waits, &out.cond_room);
+    }
+    return NULL;
+}
+
+void writer_start(int fd, size_t ring_size) {
+    out.fd         = fd;
+    out.size       = ring_size;
+    out.high_water = ring_size / 100 * WRITER_HIGH_WATER;
+    ASSERT_MALLOC_OK(out.ring = malloc(ring_size));
+    ASSERT_ZERO(pthread_mutex_init(&out.lock, NULL));
+    ASSERT_ZERO(pthread_cond_init(&out.cond_data, NULL));
+    ASSERT_ZERO(pthread_cond_init(&out.cond_room, NULL));
+    ASSERT_ZERO(pthread_create(&out.thread, NULL, writer_thread, NULL));
+    ASSERT_ZERO(pthread_detach(out.thread));
+    out.active = true;
+}
+
+bool writer_active(void) {
+    return out.active;
+}
+
+void writer_put(const char* buf, size_t n) {
+    uint64_t head = atomic_load_explicit(&out.head, memory_order_relaxed);
+    while (n > 0) {
+        uint64_t tail = atomic_load_explicit(&out.tail, memory_order_acquire);
+        size_t room   = out.size - (size_t)(head - tail);
+        if (room == 0) {
+            wait_used(&out.receiver_waits, &out.cond_room, 0, out.size - 1);
+            continue;
+        }
+
+        size_t offset = (size_t)(head % out.size);
+        size_t length = n < room ? n : room;
+        if (length > out.size - offset) length = out.size - offset;
+        memcpy(out.ring + offset, buf, length);
+        buf += length;
+        n -= length;
+        head += length;
+        atomic_store_explicit(&out.head, head, memory_order_release);
+        wake(&out.writer_waits, &out.cond_data);
+    }
+}
+
+void writer_flush(void) {
+    wait_used(&out.receiver_waits, &out.cond_room, 0, 0);
+}
+
+size_t writer_room(void) {
+    if (!out.active) return 0;
+    return out.size - (size_t)(atomic_load(&out.head) - atomic_load(&out.tail));
+}
+
+bool writer_above_high_water(void) {
+    return atomic_load(&out.head) - atomic_load(&out.tail) > out.high_water;
+}
+
+void writer_throttle(void) {
+    if (!out.active) return;
+    wait_used(&out.receiver_waits, &out.cond_room, 0, out.high_water);
+}
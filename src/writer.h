@@ -0,0 +1,51 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Ring sizes of the output writer, in KiB.
+#define WRITER_RING_MIN_KB     64
+#define WRITER_RING_MAX_KB     (1 << 20)
+#define WRITER_RING_DEFAULT_KB (16 << 10)
+
+// Share of the ring in use, in percent, above which the receiver holds
+// back its senders.
+#define WRITER_HIGH_WATER 75
+
+/*
+    Output of the serial server written by a thread of its own.
+
+    The receive loop copies every payload into a ring and goes back to the
+    socket at once, while the writer thread empties the ring into the output
+    with as few write() calls as possible, in order. Only the receive loop
+    puts and only the writer takes, so the ring positions are atomics
+    without a lock; a side waiting for data or room sleeps on a condition
+    variable until the other one wakes it.
+
+    The receive loop blocks only when the ring is full. Above the high-water
+    mark, reliable modes slow their senders down instead, see
+    writer_throttle().
+*/
+
+// Start the writer thread with a ring of ring_size bytes.
+void writer_start(int fd, size_t ring_size);
+
+bool writer_active(void);
+
+// Queue n bytes for output, waiting for room if the ring is full.
+void writer_put(const char* buf, size_t n);
+
+// Wait until everything queued is written.
+void writer_flush(void);
+
+// Get the number of bytes the ring has room for, 0 if there is no writer.
+size_t writer_room(void);
+
+// Check if the ring is filled above the high-water mark.
+bool writer_above_high_water(void);
+
+// Wait until the ring is filled no more than up to the high-water mark.
+void writer_throttle(void);
+
+#endif
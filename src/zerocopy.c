@@ -0,0 +1,199 @@
+#include <errno.h>
+#include <time.h> // before linux/errqueue.h, which needs struct timespec
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "err.h"
+#include "protconst.h"
+#include "stats.h"
+#include "zerocopy.h"
+
+// Completed ranges of sends kept while an earlier send is not complete.
+#define MAX_EARLY 64
+
+typedef struct {
+    uint32_t lo;
+    uint32_t hi;
+} range_t;
+
+struct zerocopy {
+    int fd;
+    uint32_t completed; // all sends before this one completed
+    uint32_t copied;    // completed sends the kernel copied after all
+    range_t early[MAX_EARLY];
+    int early_count;
+
+    struct {
+        uint32_t sends;
+        uint64_t end;
+    } records[ZEROCOPY_RECORDS]; // ring, oldest first
+    size_t first;
+    size_t count;
+    uint64_t recorded; // offset reached by the last record
+    uint64_t released; // offset reached by the last completed record
+};
+
+zerocopy_t* zerocopy_open(int socket_fd) {
+    zerocopy_t* zc;
+    int on = 1;
+
+    if (setsockopt(socket_fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+        return NULL;
+    }
+    ASSERT_MALLOC_OK(zc = calloc(1, sizeof(*zc)));
+    zc->fd = socket_fd;
+    return zc;
+}
+
+static void complete(zerocopy_t* zc, uint32_t lo, uint32_t hi) {
+    if (lo > zc->completed) {
+        // An earlier send is still pending.
+        if (zc->early_count < MAX_EARLY) {
+            zc->early[zc->early_count++] = (range_t){lo, hi};
+        }
+        return;
+    }
+    if (hi + 1 > zc->completed) zc->completed = hi + 1;
+
+    // Take ranges which no longer wait for an earlier send.
+    for (int i = 0; i < zc->early_count;) {
+        if (zc->early[i].lo <= zc->completed) {
+            if (zc->early[i].hi + 1 > zc->completed) {
+                zc->completed = zc->early[i].hi + 1;
+            }
+            zc->early[i] = zc->early[--zc->early_count];
+            i            = 0;
+        }
+        else {
+            i++;
+        }
+    }
+
+    while (zc->count > 0 && zc->records[zc->first].sends <= zc->completed) {
+        zc->released = zc->records[zc->first].end;
+        zc->first    = (zc->first + 1) % ZEROCOPY_RECORDS;
+        zc->count--;
+    }
+}
+
+// Read completion notifications, waiting up to timeout_ms for the first
+// one. Return false if none arrived in time.
+static bool collect(zerocopy_t* zc, int timeout_ms) {
+    struct pollfd pfd = {.fd = zc->fd, .events = 0};
+    union {
+        char buf[CMSG_SPACE(sizeof(struct sock_extended_err) +
+                            sizeof(struct sockaddr_in))];
+        size_t align; // of struct cmsghdr
+    } control;
+    struct sock_extended_err ee;
+    bool any = false;
+    int ready;
+
+    if (timeout_ms > 0) {
+        do {
+            stats.syscalls++;
+            ready = poll(&pfd, 1, timeout_ms);
+        } while (ready < 0 && errno == EINTR);
+        ASSERT_SYS_OK(ready);
+        if (ready == 0) return false;
+    }
+
+    while (1) {
+        struct msghdr msg = {
+            .msg_control    = &control,
+            .msg_controllen = sizeof(control),
+        };
+        stats.syscalls++;
+        if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                error("failed to read zero-copy completions");
+            }
+            errno = 0;
+            return any;
+        }
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        while (cmsg != NULL) {
+            if (cmsg->cmsg_level == IPPROTO_IP &&
+                cmsg->cmsg_type == IP_RECVERR)
+            {
+                memcpy(&ee, CMSG_DATA(cmsg), sizeof(ee));
+                if (ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY) {
+                    if (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                        zc->copied += ee.ee_data - ee.ee_info + 1;
+                    }
+                    complete(zc, ee.ee_info, ee.ee_data);
+                    any = true;
+                }
+            }
+            cmsg = CMSG_NXTHDR(&msg, cmsg);
+        }
+    }
+}
+
+void zerocopy_sent(zerocopy_t* zc, uint32_t sends, uint64_t end) {
+    zc->recorded = end;
+
+    // Bytes sent with copying are released along with earlier sends.
+    size_t last = (zc->first + zc->count - 1) % ZEROCOPY_RECORDS;
+    if (zc->count > 0 && zc->records[last].sends == sends) {
+        zc->records[last].end = end;
+        return;
+    }
+    if (zc->count == 0 && sends <= zc->completed) {
+        zc->released = end;
+        return;
+    }
+
+    while (zc->count == ZEROCOPY_RECORDS) {
+        if (!collect(zc, MAX_WAIT * 1000)) {
+            fatal("zero-copy sends do not complete");
+        }
+    }
+    last                    = (zc->first + zc->count) % ZEROCOPY_RECORDS;
+    zc->records[last].sends = sends;
+    zc->records[last].end   = end;
+    zc->count++;
+}
+
+void zerocopy_wait(zerocopy_t* zc, uint32_t sends) {
+    while (zc->completed < sends) {
+        if (!collect(zc, MAX_WAIT * 1000)) {
+            fatal("zero-copy sends do not complete");
+        }
+    }
+}
+
+uint64_t zerocopy_reap(zerocopy_t* zc, uint64_t max_pending) {
+    collect(zc, 0);
+    while (zc->recorded - zc->released > max_pending) {
+        if (!collect(zc, MAX_WAIT * 1000)) {
+            fatal("zero-copy sends do not complete");
+        }
+    }
+    return zc->released;
+}
+
+bool zerocopy_close(zerocopy_t* zc) {
+    bool done = true;
+
+    if (zc == NULL) return true;
+
+    time_t start = time(NULL);
+    collect(zc, 0);
+    while (zc->count > 0 && done) {
+        int left_ms = (int)(MAX_WAIT - (time(NULL) - start)) * 1000;
+        done        = left_ms > 0 && collect(zc, left_ms);
+    }
+    if (!done) error("zero-copy sends did not complete");
+    debug("zero-copy sends: %" PRIu32 ", copied by the kernel: %" PRIu32,
+          zc->completed,
+          zc->copied);
+
+    free(zc);
+    return done;
+}
@@ -0,0 +1,38 @@
+#ifndef ZEROCOPY_H
+#define ZEROCOPY_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// Most batches of zero-copy sends waiting for completion.
+#define ZEROCOPY_RECORDS 1024
+
+/*
+    Completions of sends made with MSG_ZEROCOPY on a socket.
+
+    Such a send returns while the kernel still reads the payload from user
+    memory. The kernel numbers the sends of a socket from 0 and reports
+    ranges of completed ones on the socket error queue. The sender records
+    how many sends carry the byte stream up to which offset, and gets back
+    the offset before which the kernel is done with all of it.
+*/
+typedef struct zerocopy zerocopy_t;
+
+// Enable zero-copy sends on the socket, return NULL if not supported.
+zerocopy_t* zerocopy_open(int socket_fd);
+
+// Record that the first 'sends' sends carry the stream up to offset end.
+void zerocopy_sent(zerocopy_t* zc, uint32_t sends, uint64_t end);
+
+// Wait until the first 'sends' sends complete.
+void zerocopy_wait(zerocopy_t* zc, uint32_t sends);
+
+// Collect completions, waiting for them while more than max_pending bytes
+// are not released. Return the offset before which all sends completed.
+uint64_t zerocopy_reap(zerocopy_t* zc, uint64_t max_pending);
+
+// Wait up to MAX_WAIT seconds for all sends to complete and free the
+// tracker, return false if some did not.
+bool zerocopy_close(zerocopy_t* zc);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include "err.h"
+
+/*
+    Checks of the unit tests. Each test is a program which quits with an
+    error naming the first check that failed, and returns 0 otherwise.
+*/
+#define CHECK(expr)                                                            \
+    do {                                                                       \
+        if (!(expr)) {                                                         \
+            fatal("check failed: %s, in function %s() in %s line %d",          \
+                  #expr,                                                       \
+                  __func__,                                                    \
+                  __FILE__,                                                    \
+                  __LINE__);                                                   \
+        }                                                                      \
+    } while (0)
+
+#endif
@@ -0,0 +1,88 @@
+#include "check.h"
+#include "common.h"
+#include "congestion.h"
+
+#define MS NS_PER_MS
+
+// The window through slow start, a loss, congestion avoidance, another loss
+// and a timeout.
+static void test_trajectory(void) {
+    congestion_t cc;
+    congestion_init(&cc, 100);
+    CHECK(cc.cwnd == CWND_INITIAL && congestion_slow_start(&cc));
+
+    // Slow start doubles the window every round trip.
+    int expected[] = {8, 16, 32, 64, 100};
+    for (int i = 0; i < 5; i++) {
+        congestion_on_ack(&cc, cc.cwnd, 0);
+        CHECK(cc.cwnd == expected[i]);
+    }
+    CHECK(!congestion_slow_start(&cc));
+
+    // A loss halves it once for all packets in flight then.
+    congestion_on_loss(&cc, 150, 200);
+    CHECK(cc.cwnd == 50 && cc.ssthresh == 50);
+    congestion_on_loss(&cc, 170, 210);
+    CHECK(cc.cwnd == 50);
+
+    // Congestion avoidance adds a packet per window acknowledged.
+    congestion_on_ack(&cc, 49, 0);
+    CHECK(cc.cwnd == 50);
+    congestion_on_ack(&cc, 1, 0);
+    CHECK(cc.cwnd == 51);
+    for (int i = 0; i < 51; i++) congestion_on_ack(&cc, 1, 0);
+    CHECK(cc.cwnd == 52);
+
+    // A packet sent after the last reaction is a new loss.
+    congestion_on_loss(&cc, 200, 260);
+    CHECK(cc.cwnd == 26 && cc.ssthresh == 26);
+
+    // A timeout starts over from CWND_MIN, in slow start up to half of the
+    // window it ended.
+    congestion_on_timeout(&cc, 300);
+    CHECK(cc.cwnd == CWND_MIN && cc.ssthresh == 13);
+    congestion_on_ack(&cc, 1, 0);
+    CHECK(cc.cwnd == 2 && congestion_slow_start(&cc));
+    congestion_on_loss(&cc, 299, 310);
+    CHECK(cc.cwnd == 2);
+
+    // Halving never goes below CWND_MIN.
+    congestion_on_timeout(&cc, 400);
+    congestion_on_loss(&cc, 400, 410);
+    CHECK(cc.cwnd == CWND_MIN && cc.ssthresh == CWND_MIN);
+}
+
+// Slow start ends once the RTT grows past the smallest one by an eighth.
+static void test_queue_delay(void) {
+    congestion_t cc;
+    congestion_init(&cc, 1000);
+    congestion_on_ack(&cc, 1, 40 * MS);
+    congestion_on_ack(&cc, 1, 44 * MS);
+    CHECK(congestion_slow_start(&cc) && cc.cwnd == 6);
+    congestion_on_ack(&cc, 1, 46 * MS);
+    CHECK(!congestion_slow_start(&cc) && cc.cwnd == 6);
+
+    // At a small RTT the growth must be at least QUEUE_DELAY_MIN_US.
+    congestion_init(&cc, 1000);
+    congestion_on_ack(&cc, 1, 1 * MS);
+    congestion_on_ack(&cc, 1, 1 * MS + QUEUE_DELAY_MIN_US * 1000);
+    CHECK(congestion_slow_start(&cc));
+    congestion_on_ack(&cc, 1, 2 * MS + 1);
+    CHECK(!congestion_slow_start(&cc));
+}
+
+// The initial window does not exceed the one set by the user.
+static void test_small_window(void) {
+    congestion_t cc;
+    congestion_init(&cc, 2);
+    CHECK(cc.cwnd == 2 && !congestion_slow_start(&cc));
+    congestion_on_ack(&cc, 10, 0);
+    CHECK(cc.cwnd == 2);
+}
+
+int main(void) {
+    test_trajectory();
+    test_queue_delay();
+    test_small_window();
+    return 0;
+}
@@ -0,0 +1,45 @@
+#include <string.h>
+
+#include "check.h"
+#include "crc32c.h"
+
+#define SIZE 4096
+
+// Bitwise CRC-32C, to check the fast paths against.
+static uint32_t reference(uint32_t crc, const unsigned char* data, size_t n) {
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) {
+            crc = crc & 1 ? crc >> 1 ^ 0x82f63b78 : crc >> 1;
+        }
+    }
+    return ~crc;
+}
+
+int main(void) {
+    static unsigned char data[SIZE + 8];
+
+    CHECK(crc32c(0, "123456789", 9) == 0xe3069283);
+    CHECK(crc32c(0, data, 0) == 0);
+
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = (unsigned char)(i * 31 + (i >> 8));
+    }
+    // Every length and alignment around the 8-byte steps and the three
+    // streams, which cover large buffers.
+    for (size_t start = 0; start < 8; start++) {
+        for (size_t n = 0; n <= SIZE; n += n < 64 ? 1 : 61) {
+            CHECK(crc32c(0, data + start, n) == reference(0, data + start, n));
+        }
+    }
+
+    // A CRC extended piece by piece is the CRC of the whole.
+    uint32_t crc = 0;
+    for (size_t offset = 0; offset < SIZE; offset += 100) {
+        size_t n = SIZE - offset < 100 ? SIZE - offset : 100;
+        crc      = crc32c(crc, data + offset, n);
+    }
+    CHECK(crc == crc32c(0, data, SIZE));
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "fec.h"
+
+static char payloads[FEC_DATA_MAX][1000];
+static uint32_t counts[FEC_DATA_MAX];
+static char parities[FEC_PARITY_MAX][FEC_SYMBOL_MAX];
+static uint32_t symbol_size;
+
+// Fill a block of DATA payloads of different lengths, and compute its
+// parity the way the udpf client does.
+static void encode_block(int data_count, int parity_count, int seed) {
+    memset(parities, 0, sizeof(parities));
+    symbol_size = 0;
+    for (int i = 0; i < data_count; i++) {
+        counts[i] = (uint32_t)(seed * 7 + i * 37) % sizeof(payloads[i]) + 1;
+        for (uint32_t k = 0; k < counts[i]; k++) {
+            payloads[i][k] = (char)(seed + i * 13 + k);
+        }
+        for (int j = 0; j < parity_count; j++) {
+            fec_encode(parities[j], j, i, payloads[i], counts[i]);
+        }
+        if (sizeof(uint32_t) + counts[i] > symbol_size) {
+            symbol_size = sizeof(uint32_t) + counts[i];
+        }
+    }
+}
+
+// Receive a block starting at first with the DATA packets for which lost
+// is false and all its parity, and check what is released.
+static bool receive_block(fec_window_t* window,
+                          uint64_t first,
+                          int data_count,
+                          int parity_count,
+                          const bool* lost) {
+    for (int j = 0; j < parity_count; j++) {
+        CHECK(fec_window_store_parity(
+            window, first, data_count, j, parities[j], symbol_size));
+    }
+    for (int i = 0; i < data_count; i++) {
+        if (lost[i]) continue;
+        CHECK(fec_window_store(window, first + i, payloads[i], counts[i]));
+    }
+
+    char* packet;
+    uint32_t packet_count;
+    for (int i = 0; i < data_count; i++) {
+        CHECK(fec_window_rebuild(window) >= 0);
+        if (!fec_window_peek(window, &packet, &packet_count)) return false;
+        CHECK(packet_count == counts[i]);
+        CHECK(memcmp(packet, payloads[i], counts[i]) == 0);
+        fec_window_advance(window);
+    }
+    return true;
+}
+
+// Losing as many packets as there is parity, anywhere in the block, still
+// rebuilds it, up to the largest block and parity.
+static void test_parity_limit(void) {
+    static const int geometries[][2] = {
+        {1, 1}, {4, 1}, {8, 3}, {10, 4}, {FEC_DATA_MAX, FEC_PARITY_MAX}};
+    static fec_window_t window;
+    int seed = 0;
+
+    for (size_t g = 0; g < sizeof(geometries) / sizeof(geometries[0]); g++) {
+        int data_count   = geometries[g][0];
+        int parity_count = geometries[g][1];
+        bool lost[FEC_DATA_MAX];
+        uint64_t first = START_NO;
+        fec_window_reset(&window);
+
+        // The last parity_count packets, then the first ones, then spread.
+        for (int pattern = 0; pattern < 3; pattern++) {
+            memset(lost, 0, sizeof(lost));
+            for (int k = 0; k < parity_count && k < data_count; k++) {
+                int i = pattern == 0   ? data_count - 1 - k
+                        : pattern == 1 ? k
+                                       : k * data_count / parity_count;
+                lost[i] = true;
+            }
+            encode_block(data_count, parity_count, seed++);
+            CHECK(receive_block(
+                &window, first, data_count, parity_count, lost));
+            first += (uint64_t)data_count;
+        }
+    }
+    fec_window_free(&window);
+}
+
+// One more lost packet than there is parity cannot be rebuilt.
+static void test_beyond_limit(void) {
+    static fec_window_t window;
+    bool lost[FEC_DATA_MAX] = {false};
+    fec_window_reset(&window);
+
+    lost[2] = lost[5] = lost[6] = true;
+    encode_block(8, 2, 1);
+    CHECK(!receive_block(&window, START_NO, 8, 2, lost));
+    CHECK(window.next_packet_no == 2);
+    fec_window_free(&window);
+}
+
+// Parity of a different geometry for a block seen already is refused.
+static void test_inconsistent_parity(void) {
+    static fec_window_t window;
+    fec_window_reset(&window);
+    encode_block(8, 2, 2);
+    CHECK(fec_window_store_parity(&window, 0, 8, 0, parities[0], symbol_size));
+    CHECK(!fec_window_store_parity(
+        &window, 0, 4, 1, parities[1], symbol_size));
+    CHECK(!fec_window_store_parity(
+        &window, 0, 8, 1, parities[1], symbol_size - 1));
+    fec_window_free(&window);
+}
+
+static void test_parse(void) {
+    fec_params_t params;
+    CHECK(fec_parse_params("10:4", &params));
+    CHECK(params.data_count == 10 && params.parity_count == 4);
+    CHECK(fec_parse_params("64:16", &params));
+    CHECK(!fec_parse_params("65:1", &params));
+    CHECK(!fec_parse_params("8:17", &params));
+    CHECK(!fec_parse_params("8:0", &params));
+    CHECK(!fec_parse_params("8:2x", &params));
+    CHECK(!fec_parse_params("8", &params));
+}
+
+int main(void) {
+    test_parity_limit();
+    test_beyond_limit();
+    test_inconsistent_parity();
+    test_parse();
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "lz.h"
+
+#define SIZE (256 << 10)
+
+static char raw[SIZE];
+static char packed[2 * SIZE];
+static char unpacked[SIZE];
+
+static uint64_t next_random(uint64_t* state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// Compress n bytes of raw and check that they decompress to the same.
+// Return the compressed length.
+static size_t round_trip(size_t n) {
+    size_t count = lz_compress(raw, n, packed, sizeof(packed));
+    CHECK(count > 0);
+    CHECK(lz_decompress(packed, count, unpacked, n));
+    CHECK(memcmp(raw, unpacked, n) == 0);
+    // The length decompressed to is part of the format.
+    if (n > 0) CHECK(!lz_decompress(packed, count, unpacked, n - 1));
+    return count;
+}
+
+// A run of one byte is a match overlapping itself at offset 1, longer than
+// a nibble and several continuation bytes of its length.
+static void test_overlapping_run(void) {
+    memset(raw, 'a', SIZE);
+    CHECK(round_trip(SIZE) < SIZE / 100);
+    CHECK(round_trip(5) > 0);
+}
+
+// A short period repeats through a match overlapping the bytes it copies.
+static void test_overlapping_period(void) {
+    for (size_t period = 2; period < 16; period++) {
+        for (size_t i = 0; i < SIZE; i++) raw[i] = (char)('a' + i % period);
+        CHECK(round_trip(SIZE) < SIZE / 100);
+        CHECK(round_trip(period * 3 + 1) > 0);
+    }
+}
+
+// Random data has no matches, only literal runs with long lengths, and
+// does not fit in fewer bytes than it has.
+static void test_literals(void) {
+    uint64_t state = 1;
+    for (size_t i = 0; i < SIZE; i++) raw[i] = (char)next_random(&state);
+    CHECK(round_trip(SIZE) >= SIZE);
+    CHECK(lz_compress(raw, SIZE, packed, SIZE) == 0);
+    for (size_t n = 0; n < 300; n++) round_trip(n);
+}
+
+// Words drawn from a small set, matched at offsets of all sizes.
+static void test_text(void) {
+    static const char* words[] = {
+        "the ", "stream ", "of ", "bytes ", "is ", "sent ", "over ", "UDP ",
+    };
+    uint64_t state = 7;
+    size_t n       = 0;
+    while (n < SIZE - 16) {
+        const char* word = words[next_random(&state) % 8];
+        memcpy(raw + n, word, strlen(word));
+        n += strlen(word);
+    }
+    CHECK(round_trip(n) < n / 2);
+}
+
+static void test_invalid(void) {
+    memset(raw, 'a', 64);
+    size_t count = lz_compress(raw, 64, packed, sizeof(packed));
+    CHECK(count > 0);
+    // Cut anywhere before the last sequence, which has no literals here,
+    // the data falls short of the length or of a field.
+    for (size_t n = 0; n + 1 < count; n++) {
+        CHECK(!lz_decompress(packed, n, unpacked, 64));
+    }
+
+    // One literal, then a match reaching before the start.
+    const char before[] = {0x10, 'a', 0x02, 0x00};
+    CHECK(!lz_decompress(before, sizeof(before), unpacked, 5));
+    // A match at offset 0.
+    const char zero[] = {0x10, 'a', 0x00, 0x00};
+    CHECK(!lz_decompress(zero, sizeof(zero), unpacked, 5));
+    // The same match at offset 1 is valid.
+    const char valid[] = {0x10, 'a', 0x01, 0x00};
+    CHECK(lz_decompress(valid, sizeof(valid), unpacked, 5));
+    CHECK(memcmp(unpacked, "aaaaa", 5) == 0);
+}
+
+static void test_frames(void) {
+    static char frame[MAX_PACKET_COUNT];
+    uint32_t raw_count;
+
+    CHECK(lz_frame_encode(raw, 0, frame) == 0);
+
+    memset(raw, 'x', LZ_RAW_MAX);
+    uint32_t count = lz_frame_encode(raw, LZ_RAW_MAX, frame);
+    CHECK(count < LZ_RAW_MAX / 100);
+    CHECK(lz_frame_decode(frame, count, unpacked, &raw_count));
+    CHECK(raw_count == LZ_RAW_MAX);
+    CHECK(memcmp(raw, unpacked, LZ_RAW_MAX) == 0);
+
+    // Random data is stored as it is.
+    uint64_t state = 3;
+    for (size_t i = 0; i < LZ_RAW_MAX; i++) raw[i] = (char)next_random(&state);
+    count = lz_frame_encode(raw, LZ_RAW_MAX, frame);
+    CHECK(count == sizeof(frame_t) + LZ_RAW_MAX);
+    CHECK(frame[0] == FRAME_STORED);
+    CHECK(lz_frame_decode(frame, count, unpacked, &raw_count));
+    CHECK(raw_count == LZ_RAW_MAX);
+    CHECK(memcmp(raw, unpacked, LZ_RAW_MAX) == 0);
+
+    CHECK(!lz_frame_decode(frame, count - 1, unpacked, &raw_count));
+    CHECK(!lz_frame_decode(frame, sizeof(frame_t) - 1, unpacked, &raw_count));
+    frame[0] = 2;
+    CHECK(!lz_frame_decode(frame, count, unpacked, &raw_count));
+}
+
+int main(void) {
+    test_overlapping_run();
+    test_overlapping_period();
+    test_literals();
+    test_text();
+    test_invalid();
+    test_frames();
+    return 0;
+}
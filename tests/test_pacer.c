@@ -0,0 +1,56 @@
+#include "check.h"
+#include "common.h"
+#include "pacer.h"
+
+#define RATE 1000000 // bytes per second, a byte per microsecond
+
+int main(void) {
+    pacer_t pacer;
+    uint64_t burst = RATE * PACING_BURST_US / 1000000;
+
+    // A full bucket lets a burst through, the send which empties it may
+    // overdraw it.
+    pacer_init(&pacer, RATE, 0);
+    pacer_consume(&pacer, burst - 1, 0);
+    CHECK(pacer_ready_at(&pacer) == 0);
+    pacer_consume(&pacer, 1001, 0);
+    CHECK(pacer.tokens == -1000);
+
+    // The next send waits until the debt and one byte are paid off.
+    CHECK(pacer_ready_at(&pacer) == 1001 * 1000);
+    pacer_consume(&pacer, 0, 1001 * 1000);
+    CHECK(pacer.tokens == 1 && pacer_ready_at(&pacer) == 0);
+
+    // Sending at the rate keeps the pace without a burst.
+    uint64_t now = 1001 * 1000;
+    for (int i = 0; i < 1000; i++) {
+        pacer_consume(&pacer, 1000, now);
+        now = pacer_ready_at(&pacer);
+        CHECK(now > 0);
+    }
+    CHECK(now >= 1001 * 1000 + 999 * NS_PER_MS);
+    CHECK(now <= 1001 * 1000 + 1001 * NS_PER_MS);
+
+    // After being idle, no more than a burst is let through.
+    now += NS_PER_SEC;
+    pacer_consume(&pacer, 0, now);
+    CHECK(pacer.tokens == (int64_t)burst);
+
+    // A lower rate cuts the bucket to its burst, 0 stops pacing.
+    pacer_set_rate(&pacer, RATE / 10, now);
+    CHECK(pacer.tokens == (int64_t)burst / 10);
+    pacer_set_rate(&pacer, 0, now);
+    pacer_consume(&pacer, 1 << 30, now);
+    CHECK(pacer_ready_at(&pacer) == 0);
+
+    CHECK(pacer_parse_rate("8") == 1);
+    CHECK(pacer_parse_rate("800k") == 100000);
+    CHECK(pacer_parse_rate("8M") == 1000000);
+    CHECK(pacer_parse_rate("1G") == 125000000);
+    CHECK(pacer_parse_rate("0") == 0);
+    CHECK(pacer_parse_rate("") == 0);
+    CHECK(pacer_parse_rate("5T") == 0);
+    CHECK(pacer_parse_rate("1M1") == 0);
+    CHECK(pacer_parse_rate("99999999999999999999") == 0);
+    return 0;
+}
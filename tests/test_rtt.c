@@ -0,0 +1,43 @@
+#include "check.h"
+#include "common.h"
+#include "protconst.h"
+#include "rtt.h"
+
+#define MS NS_PER_MS
+
+int main(void) {
+    rtt_t rtt;
+    rtt_init(&rtt);
+    CHECK(rtt_timeout(&rtt) == RTO_INITIAL_MS * MS);
+
+    // The first sample sets SRTT to it and RTTVAR to half of it.
+    rtt_sample(&rtt, 100 * MS);
+    CHECK(rtt.srtt_ns == 100 * MS && rtt.rttvar_ns == 50 * MS);
+    CHECK(rtt_timeout(&rtt) == 300 * MS);
+
+    // Later ones move them by 1/8 and 1/4 of the difference.
+    rtt_sample(&rtt, 200 * MS);
+    CHECK(rtt.srtt_ns == 112500 * 1000 && rtt.rttvar_ns == 62500 * 1000);
+    CHECK(rtt_timeout(&rtt) == 362500 * 1000);
+
+    // A steady RTT brings the timeout down towards it.
+    for (int i = 0; i < 100; i++) rtt_sample(&rtt, 100 * MS);
+    CHECK(rtt_timeout(&rtt) >= 100 * MS && rtt_timeout(&rtt) < 110 * MS);
+
+    // Every timeout doubles it, up to MAX_WAIT.
+    uint64_t rto = rtt_timeout(&rtt);
+    rtt_backoff(&rtt);
+    CHECK(rtt_timeout(&rtt) == 2 * rto);
+    for (int i = 0; i < 20; i++) rtt_backoff(&rtt);
+    CHECK(rtt_timeout(&rtt) == (uint64_t)MAX_WAIT * NS_PER_SEC);
+
+    // The next sample starts from the estimate, not from the backoff.
+    rtt_sample(&rtt, 100 * MS);
+    CHECK(rtt_timeout(&rtt) < 110 * MS);
+
+    // A tiny RTT is clamped to RTO_MIN_MS.
+    rtt_init(&rtt);
+    rtt_sample(&rtt, 1000);
+    CHECK(rtt_timeout(&rtt) == RTO_MIN_MS * MS);
+    return 0;
+}
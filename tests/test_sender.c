@@ -0,0 +1,115 @@
+#include <string.h>
+
+#include "check.h"
+#include "common.h"
+#include "protconst.h"
+#include "sender.h"
+
+#define SESSION_ID  42
+#define TOTAL_COUNT 1000000
+#define PAYLOAD     1000
+
+static sender_t sender;
+static send_t sends[MAX_SENDS];
+static int send_count;
+static char payload[PAYLOAD];
+
+static void receive_CONACC(uint64_t now) {
+    conacc_t conacc = {.type_id = CONACC_ID, .session_id = htobe64(SESSION_ID)};
+    sender_on_packet(
+        &sender, (char*)&conacc, sizeof(conacc), now, sends, &send_count);
+}
+
+static void receive_WND(uint64_t limit, uint64_t now) {
+    wnd_t wnd = {
+        .type_id    = WND_ID,
+        .session_id = htobe64(SESSION_ID),
+        .limit      = htobe64(limit),
+    };
+    sender_on_packet(
+        &sender, (char*)&wnd, sizeof(wnd), now, sends, &send_count);
+}
+
+// Push payloads while the sender takes them, return how many it took.
+static int push_all(uint64_t now) {
+    int pushed = 0;
+    while (sender_can_push(&sender, now)) {
+        sender_push(
+            &sender, payload, PAYLOAD, PAYLOAD, now, sends, &send_count);
+        CHECK(send_count == 1 && sends[0].payload_count == PAYLOAD);
+        pushed++;
+    }
+    return pushed;
+}
+
+int main(void) {
+    fec_params_t fec = {0, 0};
+    uint64_t now     = NS_PER_SEC;
+
+    sender_open(&sender,
+                UDP_ID,
+                0,
+                SESSION_ID,
+                0,
+                TOTAL_COUNT,
+                1,
+                0,
+                fec,
+                now,
+                sends,
+                &send_count);
+    CHECK(send_count == 1 && sends[0].header.conn.type_id == CONN_ID);
+    CHECK(!sender_can_push(&sender, now));
+    receive_CONACC(now);
+    CHECK(sender.state == SENDER_SENDING && sender_can_push(&sender, now));
+
+    // Nothing is sent past the limit, and sending stops once a packet of
+    // any size may not fit.
+    receive_WND(130000, now);
+    CHECK(push_all(now) > 0);
+    CHECK(sender.pushed <= 130000);
+    CHECK(sender.pushed + MAX_PACKET_COUNT > 130000);
+
+    // While the window is closed, the sender waits MAX_WAIT for an update.
+    CHECK(sender_deadline(&sender) == now + (uint64_t)MAX_WAIT * NS_PER_SEC);
+
+    // The window never shrinks, a reordered update changes nothing.
+    receive_WND(100000, now);
+    CHECK(sender.limit == 130000 && !sender_can_push(&sender, now));
+
+    // An update opens it and stops the wait.
+    now += NS_PER_MS;
+    receive_WND(260000, now);
+    CHECK(sender_deadline(&sender) <= now);
+    CHECK(push_all(now) > 0);
+    CHECK(sender.pushed <= 260000);
+
+    // The last packets only need room for what is left of the stream.
+    receive_WND(TOTAL_COUNT, now);
+    CHECK(push_all(now) > 0);
+    CHECK(sender.pushed == TOTAL_COUNT && sender.left == 0);
+    CHECK(sender.state == SENDER_FINISHING || sender.state == SENDER_SENDING);
+    sender_close(&sender);
+
+    // A window which stays closed fails the session after MAX_WAIT.
+    sender_open(&sender,
+                UDP_ID,
+                0,
+                SESSION_ID,
+                0,
+                TOTAL_COUNT,
+                1,
+                0,
+                fec,
+                now,
+                sends,
+                &send_count);
+    receive_CONACC(now);
+    receive_WND(PAYLOAD, now);
+    CHECK(!sender_can_push(&sender, now));
+    now += (uint64_t)MAX_WAIT * NS_PER_SEC;
+    sender_on_timer(&sender, now, sends, &send_count);
+    CHECK(sender.state == SENDER_FAILED);
+    sender_close(&sender);
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check.h"
+#include "common.h"
+#include "crc32c.h"
+#include "protconst.h"
+#include "session.h"
+
+#define SESSION_ID  42
+#define TRANSFER_ID 7
+#define TOTAL_COUNT 3000
+#define FIRST_PART  1000
+
+static struct sockaddr_in address;
+static session_config_t config = {.features = FEATURE_CRC | FEATURE_RESUME};
+static reply_t replies[MAX_REPLIES];
+static int reply_count;
+static char stream[TOTAL_COUNT];
+
+// Open a file the test removes at once, so it goes away with its descriptor.
+static int open_temporary(void) {
+    char path[] = "/tmp/test_session.XXXXXX";
+    int fd      = mkstemp(path);
+    CHECK(fd >= 0 && unlink(path) == 0);
+    return fd;
+}
+
+// Start a session resuming the transfer from the offset the sink holds.
+static session_t* resume(const sink_t* sink, uint64_t session_id) {
+    conn_resume_t conn = {
+        .type_id     = CONN_ID,
+        .session_id  = htobe64(session_id),
+        .protocol_id = TCP_ID | FEATURE_CRC | FEATURE_RESUME,
+        .total_count = htobe64(TOTAL_COUNT),
+        .transfer_id = htobe64(TRANSFER_ID),
+    };
+    conn_t parsed;
+    uint64_t transfer_id;
+    CHECK(session_parse_conn(
+        (char*)&conn, sizeof(conn), &parsed, &transfer_id));
+    CHECK(transfer_id == TRANSFER_ID);
+
+    session_t* session = session_open(
+        &address, &parsed, sink, &config, 0, replies, &reply_count);
+    conacc_resume_t* conacc = &replies[0].packet.conacc_resume;
+    CHECK(reply_count == 1 && replies[0].length == sizeof(*conacc));
+    CHECK(conacc->type_id == CONACC_ID);
+    CHECK(conacc->features == (FEATURE_CRC | FEATURE_RESUME));
+    CHECK(be64toh(conacc->offset) == sink->offset);
+    return session;
+}
+
+// Send the part of the stream from offset on, as one DATA packet.
+static void send_DATA(session_t* session,
+                      uint64_t packet_no,
+                      uint64_t offset,
+                      uint32_t packet_count) {
+    static char buf[sizeof(data_ext_t) + TOTAL_COUNT];
+    data_ext_t data = {
+        .type_id      = DATA_ID,
+        .session_id   = htobe64(session->session_id),
+        .packet_no    = htobe64(packet_no),
+        .packet_count = htobe32(packet_count),
+    };
+    data.crc = htobe32(crc32c(
+        crc32c(0, &data, sizeof(data_t)), stream + offset, packet_count));
+    memcpy(buf, &data, sizeof(data));
+    memcpy(buf + sizeof(data), stream + offset, packet_count);
+    session_on_packet(
+        session, buf, sizeof(data) + packet_count, 0, replies, &reply_count);
+}
+
+static progress_t read_progress(int progress_fd) {
+    progress_t progress;
+    CHECK(pread(progress_fd, &progress, sizeof(progress), 0) ==
+          sizeof(progress));
+    return progress;
+}
+
+int main(void) {
+    for (int i = 0; i < TOTAL_COUNT; i++) stream[i] = (char)rand();
+    int fd          = open_temporary();
+    int progress_fd = open_temporary();
+
+    // A transfer interrupted after its first part is recorded up to there.
+    sink_t sink = {
+        .fd          = dup(fd),
+        .progress_fd = dup(progress_fd),
+        .offset      = 0,
+        .transfer_id = TRANSFER_ID,
+    };
+    session_t* session = resume(&sink, SESSION_ID);
+    send_DATA(session, START_NO, 0, FIRST_PART);
+    CHECK(reply_count == 0 && session->state == SESSION_ACTIVE);
+    session_close(session);
+    progress_t progress = read_progress(progress_fd);
+    CHECK(be64toh(progress.total_count) == TOTAL_COUNT);
+    CHECK(be64toh(progress.offset) == FIRST_PART);
+
+    // Another session continues it from there, numbered from START_NO, and
+    // the checksum in RCVD covers what it received.
+    sink.fd     = dup(fd);
+    sink.offset = FIRST_PART;
+    CHECK(lseek(sink.fd, FIRST_PART, SEEK_SET) == FIRST_PART);
+    sink.progress_fd = dup(progress_fd);
+    session          = resume(&sink, SESSION_ID + 1);
+    CHECK(session->left == TOTAL_COUNT - FIRST_PART);
+    send_DATA(session, START_NO, FIRST_PART, TOTAL_COUNT - FIRST_PART);
+    rcvd_ext_t* rcvd = &replies[0].packet.rcvd_ext;
+    CHECK(reply_count == 1 && replies[0].length == sizeof(*rcvd));
+    CHECK(rcvd->type_id == RCVD_ID && session->state == SESSION_DONE);
+    CHECK(be32toh(rcvd->crc) ==
+          crc32c(0, stream + FIRST_PART, TOTAL_COUNT - FIRST_PART));
+    session_close(session);
+    progress = read_progress(progress_fd);
+    CHECK(be64toh(progress.offset) == TOTAL_COUNT);
+
+    // The sink holds the whole transfer.
+    static char output[TOTAL_COUNT + 1];
+    CHECK(pread(fd, output, sizeof(output), 0) == TOTAL_COUNT);
+    CHECK(memcmp(output, stream, TOTAL_COUNT) == 0);
+
+    // Too much data for what is left of the transfer fails the session.
+    sink.fd          = dup(fd);
+    sink.progress_fd = -1;
+    sink.offset      = TOTAL_COUNT - FIRST_PART;
+    session          = resume(&sink, SESSION_ID + 2);
+    send_DATA(session, START_NO, 0, FIRST_PART + 1);
+    CHECK(session->state == SESSION_FAILED);
+    CHECK(reply_count == 1 && replies[0].packet.rjt.type_id == RJT_ID);
+    session_close(session);
+
+    CHECK(close(fd) == 0 && close(progress_fd) == 0);
+    return 0;
+}
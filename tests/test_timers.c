@@ -0,0 +1,100 @@
+#include <stdlib.h>
+
+#include "check.h"
+#include "timers.h"
+
+#define COUNT 1000
+
+typedef struct {
+    int id;
+    timer_node_t timer;
+} object_t;
+
+static object_t objects[COUNT];
+
+// Take expired timers up to now, check that they come in order and return
+// how many there were.
+static int drain(timers_t* timers, uint64_t now) {
+    uint64_t last = 0;
+    int count     = 0;
+    timer_node_t* node;
+    while ((node = timers_expired(timers, now)) != NULL) {
+        object_t* object = timer_owner(node, object_t, timer);
+        CHECK(object->timer.slot == 0);
+        CHECK(object->timer.deadline >= last && object->timer.deadline <= now);
+        last = object->timer.deadline;
+        count++;
+    }
+    return count;
+}
+
+// Many timers armed, moved and cancelled, past the initial capacity.
+static void test_order(void) {
+    timers_t timers;
+    timers_init(&timers);
+    srand(1);
+    for (int i = 0; i < COUNT; i++) {
+        objects[i].id = i;
+        uint64_t deadline = 1000 + (uint64_t)rand() % 1000;
+        timers_set(&timers, &objects[i].timer, deadline);
+    }
+    CHECK(timers.count == COUNT);
+    for (int i = 0; i < COUNT; i += 3) {
+        timers_set(&timers, &objects[i].timer, (uint64_t)rand() % 3000);
+    }
+    for (int i = 1; i < COUNT; i += 3) {
+        timers_cancel(&timers, &objects[i].timer);
+    }
+    // Cancelling twice, or a timer never armed, does nothing.
+    timers_cancel(&timers, &objects[1].timer);
+    timer_node_t unarmed = {0};
+    timers_cancel(&timers, &unarmed);
+
+    int armed = COUNT - (COUNT + 1) / 3;
+    CHECK((int)timers.count == armed);
+    uint64_t next = timers_next(&timers);
+    CHECK(next == 0 || drain(&timers, next - 1) == 0);
+    int fired = drain(&timers, 1500);
+    CHECK(timers_next(&timers) > 1500);
+    CHECK(fired + drain(&timers, UINT64_MAX - 1) == armed);
+    CHECK(timers_next(&timers) == UINT64_MAX);
+    timers_free(&timers);
+}
+
+// Deadlines at the top of the clock's range are ordered like any other,
+// UINT64_MAX itself disarms.
+static void test_wraparound(void) {
+    timers_t timers;
+    timer_node_t a = {0}, b = {0}, c = {0};
+    timers_init(&timers);
+
+    timers_set(&timers, &a, UINT64_MAX - 1);
+    timers_set(&timers, &b, UINT64_MAX - 2);
+    timers_set(&timers, &c, 0);
+    CHECK(timers_next(&timers) == 0);
+    CHECK(timers_expired(&timers, 0) == &c);
+    CHECK(timers_next(&timers) == UINT64_MAX - 2);
+    CHECK(timers_expired(&timers, UINT64_MAX - 3) == NULL);
+
+    timers_set(&timers, &b, UINT64_MAX);
+    CHECK(b.slot == 0 && timers.count == 1);
+    CHECK(timers_next(&timers) == UINT64_MAX - 1);
+    CHECK(timers_expired(&timers, UINT64_MAX - 1) == &a);
+    CHECK(timers_next(&timers) == UINT64_MAX);
+
+    // A timer moved from the top of the range to the bottom and back.
+    timers_set(&timers, &a, UINT64_MAX - 1);
+    timers_set(&timers, &b, 5);
+    timers_set(&timers, &a, 1);
+    CHECK(timers_expired(&timers, 10) == &a);
+    timers_set(&timers, &b, UINT64_MAX - 1);
+    CHECK(timers_expired(&timers, UINT64_MAX - 2) == NULL);
+    CHECK(timers_expired(&timers, UINT64_MAX - 1) == &b);
+    timers_free(&timers);
+}
+
+int main(void) {
+    test_order();
+    test_wraparound();
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <string.h>
+
+#include "check.h"
+#include "window.h"
+
+static char packet_of[WINDOW_MAX * 2][16];
+
+static void store(recv_window_t* window, uint64_t packet_no) {
+    recv_window_store(window,
+                      packet_no,
+                      packet_of[packet_no],
+                      (uint32_t)packet_no % 16 + 1);
+}
+
+// Release the next packet if it is buffered, check it and return true.
+static bool release(recv_window_t* window) {
+    char* packet;
+    uint32_t packet_count;
+    uint64_t packet_no = window->next_packet_no;
+    if (!recv_window_peek(window, &packet, &packet_count)) return false;
+    CHECK(packet_count == packet_no % 16 + 1);
+    CHECK(memcmp(packet, packet_of[packet_no], packet_count) == 0);
+    recv_window_advance(window);
+    return true;
+}
+
+int main(void) {
+    static recv_window_t window;
+    for (int i = 0; i < WINDOW_MAX * 2; i++) {
+        memset(packet_of[i], 'a' + i % 26, sizeof(packet_of[i]));
+    }
+    recv_window_init(&window);
+
+    // Packet 0 arrives in order and is released at once, 2 and 4 are held.
+    recv_window_advance(&window);
+    store(&window, 2);
+    store(&window, 4);
+    store(&window, 4);
+    CHECK(recv_window_bitmap(&window) == 0x5);
+    CHECK(!release(&window));
+
+    // Filling the gaps releases what follows them.
+    recv_window_advance(&window);
+    CHECK(release(&window) && !release(&window));
+    CHECK(window.next_packet_no == 3 && recv_window_bitmap(&window) == 0x1);
+    store(&window, 3);
+    CHECK(release(&window) && release(&window) && !release(&window));
+    CHECK(window.next_packet_no == 5 && window.buffered == 0);
+
+    // The whole window is held, the slots wrap around.
+    for (uint64_t i = 6; i < 5 + WINDOW_MAX; i++) store(&window, i);
+    CHECK(recv_window_bitmap(&window) == UINT64_MAX >> 1);
+    store(&window, 5);
+    for (int i = 0; i < WINDOW_MAX; i++) CHECK(release(&window));
+    CHECK(window.next_packet_no == 5 + WINDOW_MAX && window.buffered == 0);
+
+    recv_window_reset(&window);
+    CHECK(window.next_packet_no == START_NO && !release(&window));
+    recv_window_free(&window);
+    return 0;
+}